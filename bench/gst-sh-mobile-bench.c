@@ -0,0 +1,544 @@
+/**
+ * gst-sh-mobile-bench
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Pushes synthetic frames through gst-sh-mobile-enc or gst-sh-mobile-dec-sink
+ * and reports the frame rate, the time the chain function took for each
+ * frame and, for the encoder, the time from pushing a frame to getting its
+ * encoded data. With --enable-mock-shcodecs and SH_VEU_BACKEND=fake it runs
+ * without the hardware.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/gst.h>
+
+/**
+ * State of one benchmark run
+ */
+
+typedef struct
+{
+  guint n_frames;
+  GstClockTime duration;
+
+  /* Indexed by the frame number */
+  GstClockTime *pushed;
+  GstClockTime *push_time;
+  GstClockTime *latency;
+
+  guint n_pushed;
+  guint n_out;
+  guint64 bytes_in;
+  guint64 bytes_out;
+  GstClockTime last_out;
+
+  GMutex *mutex;
+  GCond *cond;
+  gboolean eos;
+} BenchRun;
+
+static gchar *bench_element = "enc";
+static gchar *bench_codec = "h264";
+static gchar *bench_cntl_file = NULL;
+static gint bench_frames = 250;
+static gint bench_width = 320;
+static gint bench_height = 240;
+static gint bench_fps = 25;
+
+static GOptionEntry bench_options[] = {
+  {"element", 'e', 0, G_OPTION_ARG_STRING, &bench_element,
+   "Element to measure, enc or dec", "ELEMENT"},
+  {"codec", 'c', 0, G_OPTION_ARG_STRING, &bench_codec,
+   "Stream format, h264 or mpeg4", "CODEC"},
+  {"cntl-file", 'f', 0, G_OPTION_ARG_STRING, &bench_cntl_file,
+   "Control file of the encoder", "FILE"},
+  {"frames", 'n', 0, G_OPTION_ARG_INT, &bench_frames,
+   "Number of frames to push", "N"},
+  {"width", 'w', 0, G_OPTION_ARG_INT, &bench_width, "Frame width", "W"},
+  {"height", 'H', 0, G_OPTION_ARG_INT, &bench_height, "Frame height", "H"},
+  {"framerate", 'r', 0, G_OPTION_ARG_INT, &bench_fps,
+   "Frames per second", "FPS"},
+  {NULL}
+};
+
+/** Builds the caps of the encoded stream
+    @return the caps
+*/
+
+static GstCaps *
+bench_stream_caps (void)
+{
+  if(!strcmp(bench_codec, "mpeg4"))
+  {
+    return gst_caps_new_simple("video/mpeg",
+			       "mpegversion", G_TYPE_INT, 4,
+			       "width", G_TYPE_INT, bench_width,
+			       "height", G_TYPE_INT, bench_height,
+			       "framerate", GST_TYPE_FRACTION, bench_fps, 1,
+			       NULL);
+  }
+  return gst_caps_new_simple("video/x-h264",
+			     "width", G_TYPE_INT, bench_width,
+			     "height", G_TYPE_INT, bench_height,
+			     "framerate", GST_TYPE_FRACTION, bench_fps, 1,
+			     NULL);
+}
+
+/** Builds a NV12 frame with a pattern moving with the frame number
+    @param n Frame number
+    @return the buffer
+*/
+
+static GstBuffer *
+bench_raw_frame (guint n)
+{
+  GstBuffer *buf;
+  gint y_size = bench_width * bench_height;
+  gint y;
+
+  buf = gst_buffer_new_and_alloc(y_size * 3 / 2);
+  for(y = 0; y < bench_height; y++)
+  {
+    memset(GST_BUFFER_DATA(buf) + y * bench_width, (y + n) & 0xff,
+	   bench_width);
+  }
+  memset(GST_BUFFER_DATA(buf) + y_size, 0x80, y_size / 2);
+
+  return buf;
+}
+
+/** Builds an encoded frame: headers and an intra picture every second,
+    else a predicted picture. The payload has no start codes
+    @param n Frame number
+    @return the buffer
+*/
+
+static GstBuffer *
+bench_stream_frame (guint n)
+{
+  static const guint8 h264_headers[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x1e, 0x8d, 0x68, 0x0b, 0x04,
+    0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x38, 0x80
+  };
+  static const guint8 mpeg4_headers[] = {
+    0x00, 0x00, 0x01, 0xb0, 0x03,
+    0x00, 0x00, 0x01, 0xb5, 0x09,
+    0x00, 0x00, 0x01, 0x00,
+    0x00, 0x00, 0x01, 0x20, 0x08, 0xc8, 0x88, 0x80
+  };
+  gboolean intra = (n % bench_fps) == 0;
+  gint payload = bench_width * bench_height / (intra ? 8 : 32);
+  GstBuffer *buf;
+  guint8 *data;
+  gint i;
+
+  // The headers and the picture start of either codec
+  buf = gst_buffer_new_and_alloc(MAX(sizeof(h264_headers) + 6,
+				     sizeof(mpeg4_headers) + 5) + payload);
+  data = GST_BUFFER_DATA(buf);
+  GST_BUFFER_SIZE(buf) = 0;
+
+  if(!strcmp(bench_codec, "mpeg4"))
+  {
+    if(!n)
+    {
+      memcpy(data, mpeg4_headers, sizeof(mpeg4_headers));
+      data += sizeof(mpeg4_headers);
+    }
+    memcpy(data, "\0\0\1\xb6", 4);
+    data[4] = intra ? 0x10 : 0x50;
+    data += 5;
+  }
+  else
+  {
+    if(intra)
+    {
+      memcpy(data, h264_headers, sizeof(h264_headers));
+      data += sizeof(h264_headers);
+    }
+    memcpy(data, "\0\0\0\1", 4);
+    data[4] = intra ? 0x65 : 0x41;
+    data[5] = 0x88;
+    data += 6;
+  }
+
+  for(i = 0; i < payload; i++)
+  {
+    data[i] = 0x80 | ((i + n) & 0x7f);
+  }
+  data += payload;
+  GST_BUFFER_SIZE(buf) = data - GST_BUFFER_DATA(buf);
+
+  return buf;
+}
+
+/** Takes the encoded frames, the frame number comes from the timestamp
+    @param pad The pad after the element
+    @param buf The encoded frame
+    @return GST_FLOW_OK
+*/
+
+static GstFlowReturn
+bench_chain (GstPad * pad, GstBuffer * buf)
+{
+  BenchRun *run = g_object_get_data(G_OBJECT(pad), "bench-run");
+  GstClockTime now = gst_util_get_timestamp();
+  guint n;
+
+  g_mutex_lock(run->mutex);
+  if(GST_BUFFER_TIMESTAMP_IS_VALID(buf))
+  {
+    n = (GST_BUFFER_TIMESTAMP(buf) + run->duration / 2) / run->duration;
+    if(n < run->n_frames && !GST_CLOCK_TIME_IS_VALID(run->latency[n]))
+    {
+      run->latency[n] = now - run->pushed[n];
+    }
+  }
+  run->n_out++;
+  run->bytes_out += GST_BUFFER_SIZE(buf);
+  run->last_out = now;
+  g_mutex_unlock(run->mutex);
+
+  gst_buffer_unref(buf);
+  return GST_FLOW_OK;
+}
+
+/** Notes the end of the encoded stream
+    @param pad The pad after the element
+    @param event The event
+    @return TRUE
+*/
+
+static gboolean
+bench_event (GstPad * pad, GstEvent * event)
+{
+  BenchRun *run = g_object_get_data(G_OBJECT(pad), "bench-run");
+
+  if(GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+  {
+    g_mutex_lock(run->mutex);
+    run->eos = TRUE;
+    g_cond_signal(run->cond);
+    g_mutex_unlock(run->mutex);
+  }
+  gst_event_unref(event);
+  return TRUE;
+}
+
+static int
+bench_compare_time (const void *a, const void *b)
+{
+  GstClockTime ta = *(const GstClockTime *)a;
+  GstClockTime tb = *(const GstClockTime *)b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+/** Prints the percentiles of the valid times
+    @param what Name of the times
+    @param times The times
+    @param n Number of the times
+*/
+
+static void
+bench_print_times (const gchar * what, GstClockTime * times, guint n)
+{
+  GstClockTime *sorted;
+  guint i, count = 0;
+
+  sorted = g_new(GstClockTime, n);
+  for(i = 0; i < n; i++)
+  {
+    if(GST_CLOCK_TIME_IS_VALID(times[i]))
+    {
+      sorted[count++] = times[i];
+    }
+  }
+
+  if(count)
+  {
+    qsort(sorted, count, sizeof(GstClockTime), bench_compare_time);
+    printf("%-16s p50 %8" G_GUINT64_FORMAT " us  p90 %8" G_GUINT64_FORMAT
+	   " us  p99 %8" G_GUINT64_FORMAT " us  max %8" G_GUINT64_FORMAT
+	   " us\n", what,
+	   GST_TIME_AS_USECONDS(sorted[(count - 1) * 50 / 100]),
+	   GST_TIME_AS_USECONDS(sorted[(count - 1) * 90 / 100]),
+	   GST_TIME_AS_USECONDS(sorted[(count - 1) * 99 / 100]),
+	   GST_TIME_AS_USECONDS(sorted[count - 1]));
+  }
+  g_free(sorted);
+}
+
+/** Runs the benchmark of an element
+    @param encoder TRUE for the encoder, FALSE for the decoder sink
+    @return 0 on success
+*/
+
+static int
+bench_run (gboolean encoder)
+{
+  BenchRun run;
+  GstElement *pipeline, *element;
+  GstPad *srcpad, *sinkpad = NULL, *pad;
+  GstPadTemplate *templ;
+  GstCaps *caps, *stream_caps;
+  GstBus *bus;
+  GstMessage *msg;
+  GstBuffer *buf;
+  GstClockTime start, now, end;
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i;
+  gint result = 0;
+
+  memset(&run, 0, sizeof(run));
+  run.n_frames = bench_frames;
+  run.duration = gst_util_uint64_scale_int(GST_SECOND, 1, bench_fps);
+  run.pushed = g_new(GstClockTime, bench_frames);
+  run.push_time = g_new(GstClockTime, bench_frames);
+  run.latency = g_new(GstClockTime, bench_frames);
+  for(i = 0; i < run.n_frames; i++)
+  {
+    run.push_time[i] = run.latency[i] = GST_CLOCK_TIME_NONE;
+  }
+  run.mutex = g_mutex_new();
+  run.cond = g_cond_new();
+
+  pipeline = gst_pipeline_new("bench");
+  element = gst_element_factory_make(encoder ? "gst-sh-mobile-enc" :
+				     "gst-sh-mobile-dec-sink", NULL);
+  if(!element)
+  {
+    fprintf(stderr, "The element was not found, is GST_PLUGIN_PATH set?\n");
+    return 1;
+  }
+  if(encoder && bench_cntl_file)
+  {
+    g_object_set(element, "cntl-file", bench_cntl_file, NULL);
+  }
+  gst_bin_add(GST_BIN(pipeline), element);
+
+  stream_caps = bench_stream_caps();
+  if(encoder)
+  {
+    caps = gst_caps_new_simple("video/x-raw-yuv",
+			       "format", GST_TYPE_FOURCC,
+			       GST_MAKE_FOURCC('N', 'V', '1', '2'),
+			       "width", G_TYPE_INT, bench_width,
+			       "height", G_TYPE_INT, bench_height,
+			       "framerate", GST_TYPE_FRACTION, bench_fps, 1,
+			       NULL);
+
+    // The caps of the template choose the format of the encoder
+    templ = gst_pad_template_new("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+				 gst_caps_ref(stream_caps));
+    sinkpad = gst_pad_new_from_template(templ, "sink");
+    gst_object_unref(templ);
+    g_object_set_data(G_OBJECT(sinkpad), "bench-run", &run);
+    gst_pad_set_chain_function(sinkpad, bench_chain);
+    gst_pad_set_event_function(sinkpad, bench_event);
+    gst_pad_set_active(sinkpad, TRUE);
+    pad = gst_element_get_static_pad(element, "src");
+    gst_pad_link(pad, sinkpad);
+    gst_object_unref(pad);
+  }
+  else
+  {
+    caps = gst_caps_ref(stream_caps);
+  }
+
+  srcpad = gst_pad_new("src", GST_PAD_SRC);
+  gst_pad_set_active(srcpad, TRUE);
+  pad = gst_element_get_static_pad(element, "sink");
+  gst_pad_link(srcpad, pad);
+  gst_object_unref(pad);
+
+  if(gst_element_set_state(pipeline, GST_STATE_PLAYING) ==
+     GST_STATE_CHANGE_FAILURE)
+  {
+    fprintf(stderr, "Could not start the element\n");
+    return 1;
+  }
+
+  gst_pad_push_event(srcpad, gst_event_new_new_segment(FALSE, 1.0,
+						       GST_FORMAT_TIME,
+						       0, -1, 0));
+
+  start = gst_util_get_timestamp();
+  for(i = 0; i < run.n_frames && ret == GST_FLOW_OK; i++)
+  {
+    buf = encoder ? bench_raw_frame(i) : bench_stream_frame(i);
+    gst_buffer_set_caps(buf, caps);
+    GST_BUFFER_TIMESTAMP(buf) = i * run.duration;
+    GST_BUFFER_DURATION(buf) = run.duration;
+    run.bytes_in += GST_BUFFER_SIZE(buf);
+
+    g_mutex_lock(run.mutex);
+    run.pushed[i] = gst_util_get_timestamp();
+    g_mutex_unlock(run.mutex);
+    ret = gst_pad_push(srcpad, buf);
+    now = gst_util_get_timestamp();
+    run.push_time[i] = now - run.pushed[i];
+    run.n_pushed++;
+  }
+  if(ret != GST_FLOW_OK)
+  {
+    fprintf(stderr, "Push failed: %s\n", gst_flow_get_name(ret));
+    result = 1;
+  }
+
+  gst_pad_push_event(srcpad, gst_event_new_eos());
+  end = gst_util_get_timestamp();
+  bus = gst_element_get_bus(pipeline);
+
+  if(encoder)
+  {
+    g_mutex_lock(run.mutex);
+    while(!run.eos)
+    {
+      GTimeVal timeout;
+
+      g_get_current_time(&timeout);
+      g_time_val_add(&timeout, 30 * G_USEC_PER_SEC);
+      if(!g_cond_timed_wait(run.cond, run.mutex, &timeout))
+      {
+	fprintf(stderr, "No EOS from the encoder\n");
+	result = 1;
+	break;
+      }
+    }
+    end = run.last_out ? run.last_out : gst_util_get_timestamp();
+    g_mutex_unlock(run.mutex);
+  }
+  else
+  {
+    // The decoder sink posts EOS once it has shown the last frame
+    msg = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND, GST_MESSAGE_EOS);
+    if(msg)
+    {
+      gst_message_unref(msg);
+    }
+    else
+    {
+      fprintf(stderr, "No EOS from the decoder\n");
+      result = 1;
+    }
+    end = gst_util_get_timestamp();
+  }
+
+  while((msg = gst_bus_pop(bus)))
+  {
+    if(GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+      GError *err = NULL;
+
+      gst_message_parse_error(msg, &err, NULL);
+      fprintf(stderr, "Error: %s\n", err->message);
+      g_error_free(err);
+      result = 1;
+    }
+    gst_message_unref(msg);
+  }
+  gst_object_unref(bus);
+
+  printf("%s %s %dx%d@%d: %u frames pushed", encoder ? "enc" : "dec",
+	 bench_codec, bench_width, bench_height, bench_fps, run.n_pushed);
+  if(encoder)
+  {
+    printf(", %u out", run.n_out);
+  }
+  printf(" in %.3f s, %.1f fps\n", (double) (end - start) / GST_SECOND,
+	 end > start ? (double) run.n_pushed * GST_SECOND / (end - start) : 0);
+  printf("bytes in %" G_GUINT64_FORMAT ", out %" G_GUINT64_FORMAT "\n",
+	 run.bytes_in, run.bytes_out);
+  bench_print_times("chain", run.push_time, run.n_frames);
+  if(encoder)
+  {
+    bench_print_times("push to output", run.latency, run.n_frames);
+  }
+  else
+  {
+    guint64 avg, max;
+
+    g_object_get(element, "average-latency", &avg, "max-latency", &max,
+		 NULL);
+    printf("VEU latency avg %" G_GUINT64_FORMAT " us, max %"
+	   G_GUINT64_FORMAT " us\n", avg, max);
+  }
+  /* Only there when configured with --enable-copy-stats */
+  if(g_object_class_find_property(G_OBJECT_GET_CLASS(element),
+				  "bytes-copied"))
+  {
+    guint64 copied, allocated;
+
+    g_object_get(element, "bytes-copied", &copied,
+		 "buffers-allocated", &allocated, NULL);
+    printf("bytes copied %" G_GUINT64_FORMAT ", buffers allocated %"
+	   G_GUINT64_FORMAT "\n", copied, allocated);
+  }
+
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(srcpad);
+  if(sinkpad)
+  {
+    gst_object_unref(sinkpad);
+  }
+  gst_object_unref(pipeline);
+  gst_caps_unref(caps);
+  gst_caps_unref(stream_caps);
+  g_mutex_free(run.mutex);
+  g_cond_free(run.cond);
+  g_free(run.pushed);
+  g_free(run.push_time);
+  g_free(run.latency);
+
+  return result;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+
+  ctx = g_option_context_new("- measure the SH-Mobile elements");
+  g_option_context_add_main_entries(ctx, bench_options, NULL);
+  g_option_context_add_group(ctx, gst_init_get_option_group());
+  if(!g_option_context_parse(ctx, &argc, &argv, &err))
+  {
+    fprintf(stderr, "%s\n", err->message);
+    g_error_free(err);
+    return 1;
+  }
+  g_option_context_free(ctx);
+
+  if(bench_frames <= 0 || bench_fps <= 0)
+  {
+    fprintf(stderr, "The frames and the frame rate must be positive\n");
+    return 1;
+  }
+
+  return bench_run(!strcmp(bench_element, "enc"));
+}
@@ -0,0 +1,441 @@
+/*
+ * libshcodecs: A library for controlling SH-Mobile hardware codecs
+ * Copyright (C) 2009 Renesas Technology Corp.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ */
+
+/*
+ * V4L2 capture from the SH-Mobile CEU using memory mapped driver buffers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "capture.h"
+
+#define CEU_N_BUFFERS		4
+#define CEU_SELECT_TIMEOUT	2	/* seconds */
+
+struct ceu_buffer {
+	void *start;
+	size_t length;
+};
+
+struct ceu_device {
+	char *dev_name;
+	int fd;
+	struct ceu_buffer *buffers;
+	unsigned int n_buffers;
+	unsigned int memory;
+	int width;
+	int height;
+	unsigned int pixel_format;
+};
+
+static int xioctl(int fd, int request, void *arg)
+{
+	int r;
+
+	do
+		r = ioctl(fd, request, arg);
+	while (-1 == r && EINTR == errno);
+
+	return r;
+}
+
+static int init_mmap(struct ceu_device *dev)
+{
+	struct v4l2_requestbuffers req;
+	struct v4l2_buffer buf;
+	unsigned int i;
+
+	memset(&req, 0, sizeof(req));
+	req.count = CEU_N_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_REQBUFS, &req)) {
+		perror("VIDIOC_REQBUFS");
+		return -1;
+	}
+
+	if (req.count < 2) {
+		fprintf(stderr, "Insufficient buffer memory on %s\n",
+			dev->dev_name);
+		return -1;
+	}
+
+	dev->buffers = calloc(req.count, sizeof(*dev->buffers));
+	if (!dev->buffers)
+		return -1;
+
+	for (i = 0; i < req.count; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+
+		if (-1 == xioctl(dev->fd, VIDIOC_QUERYBUF, &buf)) {
+			perror("VIDIOC_QUERYBUF");
+			return -1;
+		}
+
+		dev->buffers[i].length = buf.length;
+		dev->buffers[i].start =
+		    mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, dev->fd, buf.m.offset);
+
+		if (MAP_FAILED == dev->buffers[i].start) {
+			perror("mmap");
+			dev->buffers[i].start = NULL;
+			return -1;
+		}
+		dev->n_buffers++;
+	}
+
+	return 0;
+}
+
+static int init_device(struct ceu_device *dev)
+{
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_QUERYCAP, &cap)) {
+		perror("VIDIOC_QUERYCAP");
+		return -1;
+	}
+
+	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+	    !(cap.capabilities & V4L2_CAP_STREAMING)) {
+		fprintf(stderr, "%s is no streaming capture device\n",
+			dev->dev_name);
+		return -1;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = dev->width;
+	fmt.fmt.pix.height = dev->height;
+	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_NV12;
+	fmt.fmt.pix.field = V4L2_FIELD_ANY;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_S_FMT, &fmt)) {
+		perror("VIDIOC_S_FMT");
+		return -1;
+	}
+
+	/* The callers depend on the size they asked for */
+	if (fmt.fmt.pix.width != dev->width ||
+	    fmt.fmt.pix.height != dev->height) {
+		fprintf(stderr, "%s does not support %dx%d\n",
+			dev->dev_name, dev->width, dev->height);
+		return -1;
+	}
+
+	dev->pixel_format = fmt.fmt.pix.pixelformat;
+
+	dev->memory = V4L2_MEMORY_MMAP;
+
+	return init_mmap(dev);
+}
+
+static void free_mmap(struct ceu_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->n_buffers; i++)
+		if (dev->buffers[i].start)
+			munmap(dev->buffers[i].start, dev->buffers[i].length);
+	free(dev->buffers);
+	dev->buffers = NULL;
+	dev->n_buffers = 0;
+}
+
+sh_ceu *sh_ceu_open(const char *device_name, int width, int height)
+{
+	struct ceu_device *dev;
+	struct stat st;
+
+	if (-1 == stat(device_name, &st) || !S_ISCHR(st.st_mode)) {
+		fprintf(stderr, "Cannot identify '%s'\n", device_name);
+		return NULL;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+
+	dev->dev_name = strdup(device_name);
+	dev->width = width;
+	dev->height = height;
+
+	dev->fd = open(device_name, O_RDWR | O_NONBLOCK, 0);
+	if (-1 == dev->fd) {
+		fprintf(stderr, "Cannot open '%s': %d, %s\n",
+			device_name, errno, strerror(errno));
+		free(dev->dev_name);
+		free(dev);
+		return NULL;
+	}
+
+	if (init_device(dev) < 0) {
+		sh_ceu_close((sh_ceu *) dev);
+		return NULL;
+	}
+
+	return (sh_ceu *) dev;
+}
+
+void sh_ceu_close(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+
+	if (!dev)
+		return;
+
+	if (dev->memory == V4L2_MEMORY_MMAP)
+		free_mmap(dev);
+
+	close(dev->fd);
+	free(dev->dev_name);
+	free(dev);
+}
+
+void sh_ceu_start_capturing(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	enum v4l2_buf_type type;
+	unsigned int i;
+
+	/* User buffers are queued by the caller */
+	if (dev->memory == V4L2_MEMORY_MMAP)
+		for (i = 0; i < dev->n_buffers; i++)
+			sh_ceu_queue_frame(ceu, i);
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (-1 == xioctl(dev->fd, VIDIOC_STREAMON, &type))
+		perror("VIDIOC_STREAMON");
+}
+
+void sh_ceu_stop_capturing(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	enum v4l2_buf_type type;
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (-1 == xioctl(dev->fd, VIDIOC_STREAMOFF, &type))
+		perror("VIDIOC_STREAMOFF");
+}
+
+int sh_ceu_dequeue_frame(sh_ceu * ceu, const unsigned char **frame_data,
+			 size_t * length, struct timeval *timestamp)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	struct v4l2_buffer buf;
+	struct timeval tv;
+	fd_set fds;
+	int r;
+
+	FD_ZERO(&fds);
+	FD_SET(dev->fd, &fds);
+
+	tv.tv_sec = CEU_SELECT_TIMEOUT;
+	tv.tv_usec = 0;
+
+	r = select(dev->fd + 1, &fds, NULL, NULL, &tv);
+	if (r == 0) {
+		errno = EAGAIN;
+		return -1;
+	} else if (r < 0) {
+		return -1;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = dev->memory;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_DQBUF, &buf))
+		return -1;
+
+	if (buf.index >= dev->n_buffers) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dev->memory == V4L2_MEMORY_USERPTR)
+		*frame_data = (const unsigned char *)buf.m.userptr;
+	else
+		*frame_data = dev->buffers[buf.index].start;
+	*length = buf.bytesused;
+	if (timestamp)
+		*timestamp = buf.timestamp;
+
+	return buf.index;
+}
+
+void sh_ceu_queue_frame(sh_ceu * ceu, int index)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_QBUF, &buf))
+		perror("VIDIOC_QBUF");
+}
+
+void sh_ceu_capture_frame(sh_ceu * ceu, sh_process_callback cb,
+			  void *user_data)
+{
+	const unsigned char *frame_data;
+	size_t length;
+	int index;
+
+	do {
+		index = sh_ceu_dequeue_frame(ceu, &frame_data, &length, NULL);
+	} while (index < 0 && (errno == EAGAIN || errno == EINTR));
+
+	if (index < 0) {
+		perror("VIDIOC_DQBUF");
+		return;
+	}
+
+	cb(ceu, frame_data, length, user_data);
+
+	sh_ceu_queue_frame(ceu, index);
+}
+
+int sh_ceu_queue_user_frame(sh_ceu * ceu, int index, unsigned char *data,
+			    size_t length)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	struct v4l2_buffer buf;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_USERPTR;
+	buf.index = index;
+	buf.m.userptr = (unsigned long)data;
+	buf.length = length;
+
+	return xioctl(dev->fd, VIDIOC_QBUF, &buf);
+}
+
+int sh_ceu_use_user_buffers(sh_ceu * ceu, int enable)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	struct v4l2_requestbuffers req;
+	unsigned int memory;
+
+	memory = enable ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+	if (dev->memory == memory)
+		return 0;
+
+	/* The mapped buffers must be gone before the driver frees them */
+	if (dev->memory == V4L2_MEMORY_MMAP)
+		free_mmap(dev);
+
+	memset(&req, 0, sizeof(req));
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = dev->memory;
+	xioctl(dev->fd, VIDIOC_REQBUFS, &req);
+
+	dev->memory = V4L2_MEMORY_MMAP;
+	dev->n_buffers = 0;
+	if (!enable)
+		return init_mmap(dev);
+
+	memset(&req, 0, sizeof(req));
+	req.count = CEU_N_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_USERPTR;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_REQBUFS, &req) || req.count < 2) {
+		/* Keep the device usable with its own buffers */
+		init_mmap(dev);
+		return -1;
+	}
+
+	dev->memory = V4L2_MEMORY_USERPTR;
+	dev->n_buffers = req.count;
+
+	return 0;
+}
+
+int sh_ceu_set_frame_rate(sh_ceu * ceu, int *numerator, int *denominator)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+	struct v4l2_streamparm parm;
+
+	memset(&parm, 0, sizeof(parm));
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_G_PARM, &parm))
+		return -1;
+
+	if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* The driver takes the frame period, and may round it */
+	parm.parm.capture.timeperframe.numerator = *denominator;
+	parm.parm.capture.timeperframe.denominator = *numerator;
+
+	if (-1 == xioctl(dev->fd, VIDIOC_S_PARM, &parm))
+		return -1;
+
+	*numerator = parm.parm.capture.timeperframe.denominator;
+	*denominator = parm.parm.capture.timeperframe.numerator;
+
+	return 0;
+}
+
+int sh_ceu_get_fd(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+
+	return dev->fd;
+}
+
+unsigned int sh_ceu_get_pixel_format(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+
+	return dev->pixel_format;
+}
+
+unsigned int sh_ceu_get_n_buffers(sh_ceu * ceu)
+{
+	struct ceu_device *dev = (struct ceu_device *)ceu;
+
+	return dev->n_buffers;
+}
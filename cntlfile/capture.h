@@ -20,6 +20,9 @@
 #ifndef __CAPTURE_H__
 #define __CAPTURE_H__
 
+#include <stddef.h>
+#include <sys/time.h>
+
 typedef void *sh_ceu;
 typedef void (*sh_process_callback) (sh_ceu * ceu, const unsigned char *frame_data,
 				     size_t length, void *user_data);
@@ -37,4 +40,42 @@ void sh_ceu_capture_frame(sh_ceu * ceu, sh_process_callback cb,
 
 unsigned int sh_ceu_get_pixel_format(sh_ceu * ceu);
 
+/*
+ * Sets the frame rate, before capturing starts. The rate the driver
+ * chose is returned in numerator and denominator. Returns -1 with errno
+ * set on failure (ENOTSUP if the driver has no frame rate control).
+ */
+int sh_ceu_set_frame_rate(sh_ceu * ceu, int *numerator, int *denominator);
+
+/*
+ * The file descriptor of the device, readable when a frame is captured
+ */
+int sh_ceu_get_fd(sh_ceu * ceu);
+
+/*
+ * Zero-copy access to the capture buffers. A dequeued frame stays owned
+ * by the caller and is not overwritten until it is given back with
+ * sh_ceu_queue_frame(). Returns the buffer index, or -1 with errno set
+ * (EAGAIN if no frame was captured within the timeout).
+ */
+int sh_ceu_dequeue_frame(sh_ceu * ceu, const unsigned char **frame_data,
+			 size_t * length, struct timeval *timestamp);
+
+void sh_ceu_queue_frame(sh_ceu * ceu, int index);
+
+/*
+ * Captures into memory given by the caller instead of the driver's own
+ * buffers, before capturing starts. The memory must be physically
+ * contiguous. Each of the sh_ceu_get_n_buffers() indexes is given
+ * memory with sh_ceu_queue_user_frame(), also after it was dequeued.
+ * Returns -1 if the driver can't capture to user memory, the device
+ * then keeps its own buffers.
+ */
+int sh_ceu_use_user_buffers(sh_ceu * ceu, int enable);
+
+int sh_ceu_queue_user_frame(sh_ceu * ceu, int index, unsigned char *data,
+			    size_t length);
+
+unsigned int sh_ceu_get_n_buffers(sh_ceu * ceu);
+
 #endif				/* __CAPTURE_H__ */
@@ -0,0 +1,830 @@
+/**
+ * gst-sh-mobile-ceu
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#include <gst/gst.h>
+
+#include "gstshvideoceu.h"
+
+/**
+ * Define capatibilities for the source factory
+ */
+
+static GstStaticPadTemplate src_factory =
+  GST_STATIC_PAD_TEMPLATE ("src",
+			   GST_PAD_SRC,
+			   GST_PAD_ALWAYS,
+			   GST_STATIC_CAPS ("video/x-raw-yuv, "
+					    "format = (fourcc) NV12,"
+					    "width = (int) [16, 2560],"
+					    "height = (int) [16, 1920],"
+					    "framerate = (fraction) [0, 30]")
+			   );
+
+GST_DEBUG_CATEGORY_STATIC (gst_sh_mobile_debug);
+#define GST_CAT_DEFAULT gst_sh_mobile_debug
+
+static GstPushSrcClass *parent_class = NULL;
+static GstBufferClass *buffer_parent_class = NULL;
+
+/**
+ * Define CEU source properties
+ */
+
+enum
+{
+  PROP_0,
+  PROP_DEVICE,
+  PROP_LAST
+};
+
+#define DEFAULT_DEVICE "/dev/video0"
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_FPS 30
+
+// Warn if no frame is captured for this long
+#define CEU_FRAME_TIMEOUT (2 * GST_SECOND)
+
+// Retry period while downstream holds all the imported capture buffers
+#define CEU_IMPORT_RETRY (10 * GST_MSECOND)
+
+static void
+gst_shvideo_ceu_buffer_finalize (GstshvideoCeuBuffer * buffer)
+{
+  GstshvideoCeu *src = buffer->src;
+
+  pthread_mutex_lock(&src->mutex);
+
+  // Let the driver fill the memory again
+  if(src->capturing && src->ceu == buffer->ceu)
+  {
+    sh_ceu_queue_frame(buffer->ceu, buffer->index);
+  }
+  src->buffers_out--;
+  gst_shvideo_ceu_close_device(src);
+
+  pthread_mutex_unlock(&src->mutex);
+
+  gst_object_unref(src);
+
+  GST_MINI_OBJECT_CLASS (buffer_parent_class)->finalize
+    (GST_MINI_OBJECT (buffer));
+}
+
+static void
+gst_shvideo_ceu_buffer_class_init (gpointer g_class, gpointer data)
+{
+  GstMiniObjectClass *mini_object_class = GST_MINI_OBJECT_CLASS (g_class);
+
+  buffer_parent_class = g_type_class_peek_parent (g_class);
+
+  mini_object_class->finalize = (GstMiniObjectFinalizeFunction)
+    gst_shvideo_ceu_buffer_finalize;
+}
+
+GType gst_shvideo_ceu_buffer_get_type (void)
+{
+  static GType object_type = 0;
+
+  if (object_type == 0) {
+    static const GTypeInfo object_info = {
+      sizeof (GstBufferClass),
+      NULL,
+      NULL,
+      gst_shvideo_ceu_buffer_class_init,
+      NULL,
+      NULL,
+      sizeof (GstshvideoCeuBuffer),
+      0,
+      NULL
+    };
+
+    object_type =
+      g_type_register_static (GST_TYPE_BUFFER, "GstshvideoCeuBuffer",
+			      &object_info, (GTypeFlags) 0);
+  }
+
+  return object_type;
+}
+
+static void
+gst_shvideo_ceu_init_class (gpointer g_class, gpointer data)
+{
+  parent_class = g_type_class_peek_parent (g_class);
+  gst_shvideo_ceu_class_init ((GstshvideoCeuClass *) g_class);
+}
+
+GType gst_shvideo_ceu_get_type (void)
+{
+  static GType object_type = 0;
+
+  if (object_type == 0) {
+    static const GTypeInfo object_info = {
+      sizeof (GstshvideoCeuClass),
+      gst_shvideo_ceu_base_init,
+      NULL,
+      gst_shvideo_ceu_init_class,
+      NULL,
+      NULL,
+      sizeof (GstshvideoCeu),
+      0,
+      (GInstanceInitFunc) gst_shvideo_ceu_init
+    };
+
+    object_type =
+      g_type_register_static (GST_TYPE_PUSH_SRC, "gst-sh-mobile-ceu",
+			      &object_info, (GTypeFlags) 0);
+  }
+
+  return object_type;
+}
+
+static void
+gst_shvideo_ceu_base_init (gpointer klass)
+{
+  static const GstElementDetails plugin_details =
+    GST_ELEMENT_DETAILS ("SH CEU camera source",
+			 "Source/Video",
+			 "Capture NV12 video from the SH-Mobile CEU",
+			 "gst-sh-mobile");
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+  gst_element_class_set_details (element_class, &plugin_details);
+}
+
+static void
+gst_shvideo_ceu_finalize (GObject * object)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (object);
+
+  // Every buffer holds a reference, so none can be in use here
+  if(shvideoceu->ceu)
+  {
+    sh_ceu_close(shvideoceu->ceu);
+    shvideoceu->ceu = NULL;
+  }
+
+  g_free(shvideoceu->device);
+  gst_poll_free(shvideoceu->poll);
+  pthread_mutex_destroy(&shvideoceu->mutex);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_shvideo_ceu_class_init (GstshvideoCeuClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstBaseSrcClass *basesrc_class;
+  GstPushSrcClass *pushsrc_class;
+
+  gobject_class = (GObjectClass *) klass;
+  basesrc_class = (GstBaseSrcClass *) klass;
+  pushsrc_class = (GstPushSrcClass *) klass;
+
+  gobject_class->finalize = gst_shvideo_ceu_finalize;
+  gobject_class->set_property = gst_shvideo_ceu_set_property;
+  gobject_class->get_property = gst_shvideo_ceu_get_property;
+
+  basesrc_class->get_caps = gst_shvideo_ceu_get_caps;
+  basesrc_class->set_caps = gst_shvideo_ceu_set_caps;
+  basesrc_class->fixate = gst_shvideo_ceu_fixate;
+  basesrc_class->stop = gst_shvideo_ceu_stop;
+  basesrc_class->unlock = gst_shvideo_ceu_unlock;
+  basesrc_class->unlock_stop = gst_shvideo_ceu_unlock_stop;
+  basesrc_class->query = gst_shvideo_ceu_query;
+
+  pushsrc_class->create = gst_shvideo_ceu_create;
+
+  GST_DEBUG_CATEGORY_INIT (gst_sh_mobile_debug, "gst-sh-mobile-ceu",
+      0, "Camera source for the SH-Mobile CEU");
+
+  g_object_class_install_property (gobject_class, PROP_DEVICE,
+      g_param_spec_string ("device", "Device",
+			   "Video4Linux device of the CEU",
+			   DEFAULT_DEVICE,
+			   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_shvideo_ceu_init (GstshvideoCeu * shvideoceu,
+		      GstshvideoCeuClass * gklass)
+{
+  GST_LOG_OBJECT(shvideoceu,"%s called",__FUNCTION__);
+
+  shvideoceu->device = g_strdup(DEFAULT_DEVICE);
+  shvideoceu->ceu = NULL;
+  shvideoceu->width = 0;
+  shvideoceu->height = 0;
+  shvideoceu->fps_numerator = 0;
+  shvideoceu->fps_denominator = 1;
+  shvideoceu->frame_size = 0;
+  shvideoceu->frame_count = 0;
+
+  shvideoceu->imports = NULL;
+  shvideoceu->n_imports = 0;
+
+  shvideoceu->poll = gst_poll_new(TRUE);
+  gst_poll_fd_init(&shvideoceu->poll_fd);
+
+  pthread_mutex_init(&shvideoceu->mutex,NULL);
+  shvideoceu->capturing = FALSE;
+  shvideoceu->flushing = FALSE;
+  shvideoceu->buffers_out = 0;
+
+  gst_base_src_set_live(GST_BASE_SRC(shvideoceu), TRUE);
+  gst_base_src_set_format(GST_BASE_SRC(shvideoceu), GST_FORMAT_TIME);
+}
+
+static void
+gst_shvideo_ceu_set_property (GObject * object, guint prop_id,
+			      const GValue * value, GParamSpec * pspec)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (object);
+
+  switch (prop_id)
+  {
+    case PROP_DEVICE:
+    {
+      g_free(shvideoceu->device);
+      shvideoceu->device = g_value_dup_string(value);
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static void
+gst_shvideo_ceu_get_property (GObject * object, guint prop_id,
+			      GValue * value, GParamSpec * pspec)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (object);
+
+  switch (prop_id)
+  {
+    case PROP_DEVICE:
+    {
+      g_value_set_string(value, shvideoceu->device);
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static GstCaps *
+gst_shvideo_ceu_get_caps (GstBaseSrc * src)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+  GstCaps *caps;
+
+  GST_LOG_OBJECT(shvideoceu,"%s called",__FUNCTION__);
+
+  caps = gst_caps_copy(gst_pad_get_pad_template_caps(GST_BASE_SRC_PAD(src)));
+
+  // An open device captures only in the size it was opened with
+  if(shvideoceu->ceu)
+  {
+    gst_caps_set_simple(caps,
+			"width", G_TYPE_INT, shvideoceu->width,
+			"height", G_TYPE_INT, shvideoceu->height,
+			NULL);
+  }
+
+  return caps;
+}
+
+static void
+gst_shvideo_ceu_fixate (GstBaseSrc * src, GstCaps * caps)
+{
+  GstStructure *structure;
+  guint i;
+
+  for(i = 0; i < gst_caps_get_size(caps); i++)
+  {
+    structure = gst_caps_get_structure(caps, i);
+    gst_structure_fixate_field_nearest_int(structure, "width",
+					   DEFAULT_WIDTH);
+    gst_structure_fixate_field_nearest_int(structure, "height",
+					   DEFAULT_HEIGHT);
+    gst_structure_fixate_field_nearest_fraction(structure, "framerate",
+						DEFAULT_FPS, 1);
+  }
+}
+
+static gboolean
+gst_shvideo_ceu_set_caps (GstBaseSrc * src, GstCaps * caps)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+  GstStructure *structure;
+  gint width, height, fps_n, fps_d;
+
+  GST_LOG_OBJECT(shvideoceu,"%s called",__FUNCTION__);
+
+  structure = gst_caps_get_structure (caps, 0);
+  if(!gst_structure_get_int (structure, "width", &width) ||
+     !gst_structure_get_int (structure, "height", &height))
+  {
+    return FALSE;
+  }
+
+  if(!gst_structure_get_fraction (structure, "framerate", &fps_n, &fps_d))
+  {
+    fps_n = 0;
+    fps_d = 1;
+  }
+
+  pthread_mutex_lock(&shvideoceu->mutex);
+
+  if(shvideoceu->ceu &&
+     shvideoceu->width == width && shvideoceu->height == height &&
+     shvideoceu->fps_numerator * fps_d == fps_n * shvideoceu->fps_denominator)
+  {
+    pthread_mutex_unlock(&shvideoceu->mutex);
+    return TRUE;
+  }
+
+  if(shvideoceu->ceu)
+  {
+    if(shvideoceu->buffers_out)
+    {
+      pthread_mutex_unlock(&shvideoceu->mutex);
+      GST_WARNING_OBJECT(shvideoceu,
+			 "Can't change the format, %d buffers still in use",
+			 shvideoceu->buffers_out);
+      return FALSE;
+    }
+    gst_shvideo_ceu_stop_capturing(shvideoceu);
+    gst_shvideo_ceu_close_device(shvideoceu);
+  }
+
+  shvideoceu->width = width;
+  shvideoceu->height = height;
+  shvideoceu->frame_size = width * height * 3 / 2;
+
+  shvideoceu->ceu = sh_ceu_open(shvideoceu->device, width, height);
+  if(!shvideoceu->ceu)
+  {
+    pthread_mutex_unlock(&shvideoceu->mutex);
+    GST_ELEMENT_ERROR((GstElement*)shvideoceu, RESOURCE, OPEN_READ_WRITE,
+		      ("Could not open %s for %dx%d capture",
+		       shvideoceu->device, width, height), (NULL));
+    return FALSE;
+  }
+
+  if(sh_ceu_get_pixel_format(shvideoceu->ceu) != V4L2_PIX_FMT_NV12)
+  {
+    sh_ceu_close(shvideoceu->ceu);
+    shvideoceu->ceu = NULL;
+    pthread_mutex_unlock(&shvideoceu->mutex);
+    GST_ELEMENT_ERROR((GstElement*)shvideoceu, RESOURCE, SETTINGS,
+		      ("%s does not capture NV12", shvideoceu->device),
+		      (NULL));
+    return FALSE;
+  }
+
+  // The frame rate can only be set while not capturing
+  shvideoceu->fps_numerator = fps_n;
+  shvideoceu->fps_denominator = fps_d;
+  if(fps_n > 0)
+  {
+    if(sh_ceu_set_frame_rate(shvideoceu->ceu, &fps_n, &fps_d) < 0)
+    {
+      GST_WARNING_OBJECT(shvideoceu, "Can't set %d/%d fps on %s: %s",
+			 shvideoceu->fps_numerator,
+			 shvideoceu->fps_denominator, shvideoceu->device,
+			 g_strerror(errno));
+    }
+    else if(fps_n * shvideoceu->fps_denominator !=
+	    shvideoceu->fps_numerator * fps_d)
+    {
+      GST_WARNING_OBJECT(shvideoceu, "%s captures %d/%d fps instead of %d/%d",
+			 shvideoceu->device, fps_n, fps_d,
+			 shvideoceu->fps_numerator,
+			 shvideoceu->fps_denominator);
+    }
+  }
+
+  shvideoceu->poll_fd.fd = sh_ceu_get_fd(shvideoceu->ceu);
+  gst_poll_add_fd(shvideoceu->poll, &shvideoceu->poll_fd);
+  gst_poll_fd_ctl_read(shvideoceu->poll, &shvideoceu->poll_fd, TRUE);
+
+  // Capturing starts with the first frame, downstream is linked then
+  shvideoceu->frame_count = 0;
+
+  pthread_mutex_unlock(&shvideoceu->mutex);
+
+  GST_DEBUG_OBJECT(shvideoceu, "Opened %s for %dx%d", shvideoceu->device,
+		   width, height);
+
+  return TRUE;
+}
+
+static GstBuffer *
+gst_shvideo_ceu_alloc_import (GstshvideoCeu * shvideoceu)
+{
+  GstPad *pad = GST_BASE_SRC_PAD(shvideoceu);
+  GstBuffer *buf;
+  GType veu_buffer;
+
+  // Registered by the VEU filter for the buffers in its memory
+  veu_buffer = g_type_from_name("GstshvideoVeuBuffer");
+  if(!veu_buffer)
+  {
+    return NULL;
+  }
+
+  if(gst_pad_alloc_buffer(pad, GST_BUFFER_OFFSET_NONE, shvideoceu->frame_size,
+			  GST_PAD_CAPS(pad), &buf) != GST_FLOW_OK)
+  {
+    return NULL;
+  }
+
+  if(!G_TYPE_CHECK_INSTANCE_TYPE(buf, veu_buffer) ||
+     GST_BUFFER_SIZE(buf) < shvideoceu->frame_size)
+  {
+    gst_buffer_unref(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+static guint
+gst_shvideo_ceu_refill (GstshvideoCeu * shvideoceu)
+{
+  guint i, queued;
+
+  queued = 0;
+  for(i = 0; i < shvideoceu->n_imports; i++)
+  {
+    if(!shvideoceu->imports[i])
+    {
+      shvideoceu->imports[i] = gst_shvideo_ceu_alloc_import(shvideoceu);
+      if(shvideoceu->imports[i] &&
+	 sh_ceu_queue_user_frame(shvideoceu->ceu, i,
+				 GST_BUFFER_DATA(shvideoceu->imports[i]),
+				 shvideoceu->frame_size) < 0)
+      {
+	GST_WARNING_OBJECT(shvideoceu, "Can't capture to the VEU memory: %s",
+			   g_strerror(errno));
+	gst_buffer_unref(shvideoceu->imports[i]);
+	shvideoceu->imports[i] = NULL;
+      }
+    }
+    if(shvideoceu->imports[i])
+    {
+      queued++;
+    }
+  }
+
+  return queued;
+}
+
+static void
+gst_shvideo_ceu_start_capturing (GstshvideoCeu * shvideoceu)
+{
+  GstBuffer *buf;
+  guint n;
+
+  /* The VEU reads frames captured to its memory in place, however many
+     filters scale them after a tee */
+  buf = gst_shvideo_ceu_alloc_import(shvideoceu);
+  if(buf)
+  {
+    gst_buffer_unref(buf);
+    if(sh_ceu_use_user_buffers(shvideoceu->ceu, 1) == 0)
+    {
+      n = sh_ceu_get_n_buffers(shvideoceu->ceu);
+      shvideoceu->imports = g_new0(GstBuffer *, n);
+      shvideoceu->n_imports = n;
+      if(gst_shvideo_ceu_refill(shvideoceu) == 0)
+      {
+	g_free(shvideoceu->imports);
+	shvideoceu->imports = NULL;
+	shvideoceu->n_imports = 0;
+      }
+    }
+  }
+
+  // Otherwise capture to the buffers of the driver
+  if(!shvideoceu->imports)
+  {
+    sh_ceu_use_user_buffers(shvideoceu->ceu, 0);
+  }
+
+  pthread_mutex_lock(&shvideoceu->mutex);
+  sh_ceu_start_capturing(shvideoceu->ceu);
+  shvideoceu->capturing = TRUE;
+  pthread_mutex_unlock(&shvideoceu->mutex);
+
+  GST_DEBUG_OBJECT(shvideoceu, "Capturing %dx%d from %s with %d buffers %s",
+		   shvideoceu->width, shvideoceu->height, shvideoceu->device,
+		   sh_ceu_get_n_buffers(shvideoceu->ceu),
+		   shvideoceu->imports ? "in the VEU memory" : "of the driver");
+}
+
+static void
+gst_shvideo_ceu_stop_capturing (GstshvideoCeu * shvideoceu)
+{
+  guint i;
+
+  if(shvideoceu->capturing)
+  {
+    sh_ceu_stop_capturing(shvideoceu->ceu);
+    shvideoceu->capturing = FALSE;
+  }
+
+  // The driver let go of the imported buffers when it stopped
+  for(i = 0; i < shvideoceu->n_imports; i++)
+  {
+    if(shvideoceu->imports[i])
+    {
+      gst_buffer_unref(shvideoceu->imports[i]);
+    }
+  }
+  g_free(shvideoceu->imports);
+  shvideoceu->imports = NULL;
+  shvideoceu->n_imports = 0;
+}
+
+static void
+gst_shvideo_ceu_close_device (GstshvideoCeu * shvideoceu)
+{
+  // The capture memory is unmapped on close
+  if(shvideoceu->ceu && !shvideoceu->capturing && !shvideoceu->buffers_out)
+  {
+    GST_DEBUG_OBJECT(shvideoceu, "Closing %s", shvideoceu->device);
+    gst_poll_remove_fd(shvideoceu->poll, &shvideoceu->poll_fd);
+    gst_poll_fd_init(&shvideoceu->poll_fd);
+    sh_ceu_close(shvideoceu->ceu);
+    shvideoceu->ceu = NULL;
+  }
+}
+
+static gboolean
+gst_shvideo_ceu_stop (GstBaseSrc * src)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+
+  GST_LOG_OBJECT(shvideoceu,"%s called",__FUNCTION__);
+
+  pthread_mutex_lock(&shvideoceu->mutex);
+  gst_shvideo_ceu_stop_capturing(shvideoceu);
+  // Delayed to the last buffer if some are still in use downstream
+  gst_shvideo_ceu_close_device(shvideoceu);
+  pthread_mutex_unlock(&shvideoceu->mutex);
+
+  return TRUE;
+}
+
+static gboolean
+gst_shvideo_ceu_unlock (GstBaseSrc * src)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+
+  pthread_mutex_lock(&shvideoceu->mutex);
+  shvideoceu->flushing = TRUE;
+  pthread_mutex_unlock(&shvideoceu->mutex);
+  // Wakes up create waiting for a frame
+  gst_poll_set_flushing(shvideoceu->poll, TRUE);
+
+  return TRUE;
+}
+
+static gboolean
+gst_shvideo_ceu_unlock_stop (GstBaseSrc * src)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+
+  pthread_mutex_lock(&shvideoceu->mutex);
+  shvideoceu->flushing = FALSE;
+  pthread_mutex_unlock(&shvideoceu->mutex);
+  gst_poll_set_flushing(shvideoceu->poll, FALSE);
+
+  return TRUE;
+}
+
+static gboolean
+gst_shvideo_ceu_query (GstBaseSrc * src, GstQuery * query)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+  GstClockTime min_latency, max_latency;
+
+  if(GST_QUERY_TYPE(query) == GST_QUERY_LATENCY &&
+     shvideoceu->ceu && shvideoceu->fps_numerator > 0)
+  {
+    // A frame is available one frame period after its capture started
+    min_latency = gst_util_uint64_scale_int(GST_SECOND,
+					    shvideoceu->fps_denominator,
+					    shvideoceu->fps_numerator);
+    max_latency = min_latency * (sh_ceu_get_n_buffers(shvideoceu->ceu) - 1);
+
+    GST_DEBUG_OBJECT(shvideoceu, "Latency min %" GST_TIME_FORMAT
+		     " max %" GST_TIME_FORMAT,
+		     GST_TIME_ARGS(min_latency), GST_TIME_ARGS(max_latency));
+
+    gst_query_set_latency(query, TRUE, min_latency, max_latency);
+    return TRUE;
+  }
+
+  return GST_BASE_SRC_CLASS (parent_class)->query (src, query);
+}
+
+static GstFlowReturn
+gst_shvideo_ceu_create (GstPushSrc * src, GstBuffer ** buffer)
+{
+  GstshvideoCeu *shvideoceu = GST_SHVIDEOCEU (src);
+  GstshvideoCeuBuffer *ceubuf;
+  GstBuffer *buf;
+  const unsigned char *frame_data;
+  size_t length;
+  struct timeval captured, now;
+  GstClockTime timestamp, delay;
+  GstClock *clock;
+  gint index, ret;
+
+  GST_LOG_OBJECT(shvideoceu,"%s called",__FUNCTION__);
+
+  if(!shvideoceu->ceu)
+  {
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if(!shvideoceu->capturing)
+  {
+    gst_shvideo_ceu_start_capturing(shvideoceu);
+  }
+
+  do
+  {
+    if(shvideoceu->flushing)
+    {
+      return GST_FLOW_WRONG_STATE;
+    }
+
+    // Downstream may hold all the VEU memory buffers for a while
+    if(shvideoceu->imports && !gst_shvideo_ceu_refill(shvideoceu))
+    {
+      GST_LOG_OBJECT(shvideoceu, "No VEU memory to capture to");
+      g_usleep(CEU_IMPORT_RETRY / GST_USECOND);
+      index = -1;
+      errno = EAGAIN;
+      continue;
+    }
+
+    // Unlock ends the wait at once
+    ret = gst_poll_wait(shvideoceu->poll, CEU_FRAME_TIMEOUT);
+    if(ret < 0 && errno == EBUSY)
+    {
+      return GST_FLOW_WRONG_STATE;
+    }
+    if(ret == 0)
+    {
+      GST_WARNING_OBJECT(shvideoceu, "No frame captured, %d buffers in use",
+			 shvideoceu->buffers_out);
+      index = -1;
+      errno = EAGAIN;
+      continue;
+    }
+    if(ret < 0)
+    {
+      index = -1;
+      continue;
+    }
+
+    index = sh_ceu_dequeue_frame(shvideoceu->ceu, &frame_data, &length,
+				 &captured);
+  } while(index < 0 && (errno == EAGAIN || errno == EINTR));
+
+  if(index < 0)
+  {
+    GST_ELEMENT_ERROR((GstElement*)shvideoceu, RESOURCE, READ,
+		      ("Could not capture from %s", shvideoceu->device),
+		      GST_ERROR_SYSTEM);
+    return GST_FLOW_ERROR;
+  }
+
+  /* Timestamp with the running time of the capture. The driver stamps
+     the frame when it is complete, take off the time it waited for us */
+  timestamp = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_LOCK (shvideoceu);
+  clock = GST_ELEMENT_CLOCK (shvideoceu);
+  if(clock)
+  {
+    gst_object_ref(clock);
+    timestamp = GST_ELEMENT_CAST (shvideoceu)->base_time;
+  }
+  GST_OBJECT_UNLOCK (shvideoceu);
+
+  if(clock)
+  {
+    gettimeofday(&now, NULL);
+    delay = 0;
+    if(GST_TIMEVAL_TO_TIME(now) > GST_TIMEVAL_TO_TIME(captured))
+    {
+      delay = GST_TIMEVAL_TO_TIME(now) - GST_TIMEVAL_TO_TIME(captured);
+    }
+    timestamp = gst_clock_get_time(clock) - timestamp;
+    timestamp = timestamp > delay ? timestamp - delay : 0;
+    gst_object_unref(clock);
+  }
+
+  if(shvideoceu->imports)
+  {
+    // Already in the VEU memory, the driver gets a new one on refill
+    buf = shvideoceu->imports[index];
+    shvideoceu->imports[index] = NULL;
+  }
+  else
+  {
+    // The buffer points straight to the capture memory
+    ceubuf = (GstshvideoCeuBuffer *)
+      gst_mini_object_new(GST_TYPE_SHVIDEOCEU_BUFFER);
+    ceubuf->src = gst_object_ref(shvideoceu);
+    ceubuf->ceu = shvideoceu->ceu;
+    ceubuf->index = index;
+
+    buf = GST_BUFFER(ceubuf);
+    GST_BUFFER_DATA(buf) = (guint8 *) frame_data;
+    GST_BUFFER_SIZE(buf) = shvideoceu->frame_size;
+    GST_BUFFER_FLAG_SET(buf, GST_BUFFER_FLAG_READONLY);
+
+    pthread_mutex_lock(&shvideoceu->mutex);
+    shvideoceu->buffers_out++;
+    pthread_mutex_unlock(&shvideoceu->mutex);
+  }
+
+  GST_BUFFER_TIMESTAMP(buf) = timestamp;
+  if(shvideoceu->fps_numerator > 0)
+  {
+    GST_BUFFER_DURATION(buf) =
+      gst_util_uint64_scale_int(GST_SECOND, shvideoceu->fps_denominator,
+				shvideoceu->fps_numerator);
+  }
+  GST_BUFFER_OFFSET(buf) = shvideoceu->frame_count++;
+  GST_BUFFER_OFFSET_END(buf) = shvideoceu->frame_count;
+  gst_buffer_set_caps(buf, GST_PAD_CAPS(GST_BASE_SRC_PAD(src)));
+
+  GST_LOG_OBJECT(shvideoceu, "Frame %d captured, %d bytes, %" GST_TIME_FORMAT,
+		 index, (gint) length, GST_TIME_ARGS(timestamp));
+
+  *buffer = buf;
+
+  return GST_FLOW_OK;
+}
+
+gboolean
+gst_shvideo_ceu_plugin_init (GstPlugin * plugin)
+{
+  if (!gst_element_register (plugin, "gst-sh-mobile-ceu", GST_RANK_NONE,
+          GST_TYPE_SHVIDEOCEU))
+    return FALSE;
+
+  return TRUE;
+}
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    "gst-sh-mobile-ceu",
+    "gst-sh-mobile",
+    gst_shvideo_ceu_plugin_init,
+    VERSION, "LGPL", GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
@@ -0,0 +1,288 @@
+/**
+ * gst-sh-mobile-ceu
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOCEU_H
+#define  GSTSHVIDEOCEU_H
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <pthread.h>
+
+#include "cntlfile/capture.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_SHVIDEOCEU \
+  (gst_shvideo_ceu_get_type())
+#define GST_SHVIDEOCEU(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_SHVIDEOCEU,GstshvideoCeu))
+#define GST_SHVIDEOCEU_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_SHVIDEOCEU,GstshvideoCeu))
+#define GST_IS_SHVIDEOCEU(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_SHVIDEOCEU))
+#define GST_IS_SHVIDEOCEU_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_SHVIDEOCEU))
+#define GST_TYPE_SHVIDEOCEU_BUFFER \
+  (gst_shvideo_ceu_buffer_get_type())
+typedef struct _GstshvideoCeu GstshvideoCeu;
+typedef struct _GstshvideoCeuClass GstshvideoCeuClass;
+typedef struct _GstshvideoCeuBuffer GstshvideoCeuBuffer;
+
+/**
+ * Define Gstreamer SH CEU camera source structure
+ */
+
+struct _GstshvideoCeu
+{
+  GstPushSrc element;
+
+  gchar *device;
+  sh_ceu *ceu;
+  gint width;
+  gint height;
+  gint fps_numerator;
+  gint fps_denominator;
+  guint frame_size;
+  guint64 frame_count;
+
+  /* Capture buffers allocated downstream in the VEU memory, indexed
+     like the capture buffers. NULL when not given to the driver */
+  GstBuffer **imports;
+  guint n_imports;
+
+  /* Waits for a frame, set to flushing by unlock */
+  GstPoll *poll;
+  GstPollFD poll_fd;
+
+  /* Protects the fields below, the buffers are released from any thread */
+  pthread_mutex_t mutex;
+  gboolean capturing;
+  gboolean flushing;
+  guint buffers_out;
+};
+
+/**
+ * Define Gstreamer SH CEU camera source Class structure
+ */
+
+struct _GstshvideoCeuClass
+{
+  GstPushSrcClass parent;
+};
+
+/**
+ * A buffer pointing to a CEU capture buffer. The capture buffer is
+ * given back to the driver when the buffer is finalized
+ */
+
+struct _GstshvideoCeuBuffer
+{
+  GstBuffer buffer;
+
+  GstshvideoCeu *src;
+  sh_ceu *ceu;
+  gint index;
+};
+
+/** Get gst-sh-mobile-ceu object type
+    @return object type
+*/
+
+GType gst_shvideo_ceu_get_type (void);
+
+/** Get the type of the CEU capture buffers
+    @return buffer type
+*/
+
+GType gst_shvideo_ceu_buffer_get_type (void);
+
+/** Initialize shvideoceu class plugin event handler
+    @param g_class Gclass
+    @param data user data pointer, unused in the function
+*/
+
+static void gst_shvideo_ceu_init_class (gpointer g_class, gpointer data);
+
+/** Initialize the CEU source element class details and pad templates
+    @param klass Gstreamer element class
+*/
+
+static void gst_shvideo_ceu_base_init (gpointer klass);
+
+/** Initialize the class for the CEU source
+    @param klass Gstreamer SH CEU source class
+*/
+
+static void gst_shvideo_ceu_class_init (GstshvideoCeuClass *klass);
+
+/** Initialize the CEU source
+    @param shvideoceu Gstreamer SH CEU source element
+    @param gklass Gstreamer SH CEU source class
+*/
+
+static void gst_shvideo_ceu_init (GstshvideoCeu *shvideoceu,
+				  GstshvideoCeuClass *gklass);
+
+/** Finalize the CEU source
+    @param object Gstreamer element
+*/
+
+static void gst_shvideo_ceu_finalize (GObject * object);
+
+/** The function will set the device name of the camera
+    @param object The object where to get Gstreamer SH CEU source object
+    @param prop_id The property id
+    @param value The device name if prop_id is PROP_DEVICE
+    @param pspec not used in fuction
+*/
+
+static void gst_shvideo_ceu_set_property (GObject *object,
+					  guint prop_id, const GValue *value,
+					  GParamSpec * pspec);
+
+/** The function will return the device name of the camera
+    @param object The object where to get Gstreamer SH CEU source object
+    @param prop_id The property id
+    @param value The device name if prop_id is PROP_DEVICE
+    @param pspec not used in fuction
+*/
+
+static void gst_shvideo_ceu_get_property (GObject * object, guint prop_id,
+					  GValue * value, GParamSpec * pspec);
+
+/** Returns the caps of the source. The size is fixed once the device
+    has been opened
+    @param src Gstreamer base source
+    @return the caps, the caller owns the reference
+*/
+
+static GstCaps *gst_shvideo_ceu_get_caps (GstBaseSrc * src);
+
+/** Fixates the caps to the default capture size and frame rate
+    @param src Gstreamer base source
+    @param caps The caps to fixate
+*/
+
+static void gst_shvideo_ceu_fixate (GstBaseSrc * src, GstCaps * caps);
+
+/** Opens the camera with the negotiated size
+    @param src Gstreamer base source
+    @param caps The negotiated caps
+    @return returns true if the camera can capture NV12 in the size, else false
+*/
+
+static gboolean gst_shvideo_ceu_set_caps (GstBaseSrc * src, GstCaps * caps);
+
+/** Stops capturing and closes the camera once all the buffers are back
+    @param src Gstreamer base source
+    @return TRUE
+*/
+
+static gboolean gst_shvideo_ceu_stop (GstBaseSrc * src);
+
+/** Makes a blocking create return
+    @param src Gstreamer base source
+    @return TRUE
+*/
+
+static gboolean gst_shvideo_ceu_unlock (GstBaseSrc * src);
+
+/** Clears the flushing state set by unlock
+    @param src Gstreamer base source
+    @return TRUE
+*/
+
+static gboolean gst_shvideo_ceu_unlock_stop (GstBaseSrc * src);
+
+/** Answers the latency query of the live source
+    @param src Gstreamer base source
+    @param query Gstreamer query
+    @return TRUE if the query was answered
+*/
+
+static gboolean gst_shvideo_ceu_query (GstBaseSrc * src, GstQuery * query);
+
+/** Waits for the next captured frame and wraps the capture memory into
+    a buffer timestamped with the capture time
+    @param src Gstreamer push source
+    @param buffer The new buffer
+    @return returns GST_FLOW_OK if a frame was captured
+*/
+
+static GstFlowReturn gst_shvideo_ceu_create (GstPushSrc * src,
+					     GstBuffer ** buffer);
+
+/** Starts capturing, into the VEU memory if the filter downstream
+    allocates its input there
+    @param shvideoceu CEU source object
+*/
+
+static void gst_shvideo_ceu_start_capturing (GstshvideoCeu * shvideoceu);
+
+/** Stops capturing and gives back the buffers imported from the VEU
+    memory. The mutex must be held
+    @param shvideoceu CEU source object
+*/
+
+static void gst_shvideo_ceu_stop_capturing (GstshvideoCeu * shvideoceu);
+
+/** Allocates a capture buffer from downstream if it is in the VEU memory
+    @param shvideoceu CEU source object
+    @return the buffer, or NULL if downstream gave no VEU memory
+*/
+
+static GstBuffer *gst_shvideo_ceu_alloc_import (GstshvideoCeu * shvideoceu);
+
+/** Gives the driver a buffer in the VEU memory for every capture buffer
+    it has none for
+    @param shvideoceu CEU source object
+    @return the number of capture buffers the driver holds
+*/
+
+static guint gst_shvideo_ceu_refill (GstshvideoCeu * shvideoceu);
+
+/** Closes the camera if capturing has stopped and no buffer is in use.
+    The mutex must be held
+    @param shvideoceu CEU source object
+*/
+
+static void gst_shvideo_ceu_close_device (GstshvideoCeu * shvideoceu);
+
+/** Gives the capture buffer back to the driver
+    @param buffer CEU capture buffer
+*/
+
+static void gst_shvideo_ceu_buffer_finalize (GstshvideoCeuBuffer * buffer);
+
+/** Initialize the CEU capture buffer class
+    @param g_class Gclass
+    @param data user data pointer, unused in the function
+*/
+
+static void gst_shvideo_ceu_buffer_class_init (gpointer g_class,
+					       gpointer data);
+
+/** Initialize the CEU source plugin
+    @param plugin Gstreamer plugin
+    @return returns true if the plugin initialized and registered gst-sh-mobile-ceu, else false
+*/
+
+gboolean gst_shvideo_ceu_plugin_init (GstPlugin *plugin);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,149 @@
+/**
+ * gst-sh-mobile copy statistics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOCOPYSTATS_H
+#define  GSTSHVIDEOCOPYSTATS_H
+
+#include <gst/gst.h>
+#include <pthread.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Accounting of the bytes the elements copy and the buffers they
+ * allocate, built in with configure --enable-copy-stats. Without it the
+ * macros expand to nothing. The totals are read with the bytes-copied and
+ * buffers-allocated properties, the amounts of every second are logged
+ * at the INFO level
+ */
+
+#ifdef SHVIDEO_COPY_STATS
+
+typedef struct _GstshvideoCopyStats GstshvideoCopyStats;
+
+struct _GstshvideoCopyStats
+{
+  pthread_mutex_t mutex;
+
+  guint64 bytes_copied;
+  guint64 buffers_allocated;
+
+  /* The second being counted, and the last one counted */
+  GstClockTime second_start;
+  guint64 second_bytes;
+  guint64 second_buffers;
+  guint64 last_second_bytes;
+  guint64 last_second_buffers;
+};
+
+/** Initializes the accounting
+    @param stats The accounting
+*/
+
+static inline void
+gst_shvideo_copy_stats_init (GstshvideoCopyStats * stats)
+{
+  pthread_mutex_init(&stats->mutex, NULL);
+  stats->bytes_copied = 0;
+  stats->buffers_allocated = 0;
+  stats->second_start = GST_CLOCK_TIME_NONE;
+  stats->second_bytes = 0;
+  stats->second_buffers = 0;
+  stats->last_second_bytes = 0;
+  stats->last_second_buffers = 0;
+}
+
+/** Adds copied bytes and allocated buffers
+    @param stats The accounting
+    @param bytes Bytes copied
+    @param buffers Buffers allocated
+    @return TRUE when a second ended, its amounts are in last_second_*
+*/
+
+static inline gboolean
+gst_shvideo_copy_stats_add (GstshvideoCopyStats * stats, guint64 bytes,
+			    guint buffers)
+{
+  GstClockTime now = gst_util_get_timestamp();
+  gboolean second_ended = FALSE;
+
+  pthread_mutex_lock(&stats->mutex);
+  stats->bytes_copied += bytes;
+  stats->buffers_allocated += buffers;
+
+  if(!GST_CLOCK_TIME_IS_VALID(stats->second_start))
+  {
+    stats->second_start = now;
+  }
+  else if(now - stats->second_start >= GST_SECOND)
+  {
+    stats->last_second_bytes = stats->second_bytes;
+    stats->last_second_buffers = stats->second_buffers;
+    stats->second_bytes = 0;
+    stats->second_buffers = 0;
+    stats->second_start = now;
+    second_ended = TRUE;
+  }
+  stats->second_bytes += bytes;
+  stats->second_buffers += buffers;
+  pthread_mutex_unlock(&stats->mutex);
+
+  return second_ended;
+}
+
+/** Reads the totals
+    @param stats The accounting
+    @param bytes Bytes copied
+    @param buffers Buffers allocated
+*/
+
+static inline void
+gst_shvideo_copy_stats_get (GstshvideoCopyStats * stats, guint64 * bytes,
+			    guint64 * buffers)
+{
+  pthread_mutex_lock(&stats->mutex);
+  *bytes = stats->bytes_copied;
+  *buffers = stats->buffers_allocated;
+  pthread_mutex_unlock(&stats->mutex);
+}
+
+#define GST_SHVIDEO_COPY_STATS_INIT(stats) \
+  gst_shvideo_copy_stats_init(&(stats))
+
+#define GST_SHVIDEO_COPY_STATS_ADD(obj, stats, bytes, buffers)		\
+  G_STMT_START {							\
+    if(gst_shvideo_copy_stats_add(&(stats), (bytes), (buffers)))	\
+    {									\
+      GST_INFO_OBJECT(obj, "%" G_GUINT64_FORMAT " bytes copied and %"	\
+		      G_GUINT64_FORMAT " buffers allocated per second",	\
+		      (stats).last_second_bytes,			\
+		      (stats).last_second_buffers);			\
+    }									\
+  } G_STMT_END
+
+#else
+
+#define GST_SHVIDEO_COPY_STATS_INIT(stats) G_STMT_START { } G_STMT_END
+#define GST_SHVIDEO_COPY_STATS_ADD(obj, stats, bytes, buffers) \
+  G_STMT_START { } G_STMT_END
+
+#endif
+
+G_END_DECLS
+#endif
@@ -57,9 +57,7 @@ static GstStaticPadTemplate sink_factory =
 					    "video/x-h264,"
 					    "width  = (int) [48, 720],"
 					    "height = (int) [48, 576],"
-					    "framerate = (fraction) [0, 25],"
-					    "variant = (string) itu,"
-					    "h264version = (string) h264"
+					    "framerate = (fraction) [0, 25]"
 					    "; "
 					    "video/x-divx,"
 					    "width  = (int) [48, 720],"
@@ -75,9 +73,7 @@ static GstStaticPadTemplate sink_factory =
 					    "video/x-h264,"
 					    "width  = (int) [48, 720],"
 					    "height = (int) [48, 480],"
-					    "framerate = (fraction) [0, 30],"
-					    "variant = (string) itu,"
-					    "h264version = (string) h264"
+					    "framerate = (fraction) [0, 30]"
 					    ";"
 					    "video/x-divx,"
 					    "width  = (int) [48, 720],"
@@ -94,14 +90,21 @@ static GstStaticPadTemplate sink_factory =
 			   );
 
 static GstElementClass *parent_class = NULL;
-vidix_capability_t sh_capability;
-vidix_playback_t sh_vidix;
+
+// The task thread comes from a pool and goes back to it
+static GstTaskThreadCallbacks gst_shvideodec_thread_callbacks = {
+  (void (*) (GstTask *, GThread *, gpointer)) gst_shvideodec_enter_thread,
+  (void (*) (GstTask *, GThread *, gpointer)) gst_shvideodec_leave_thread
+};
 
 GST_DEBUG_CATEGORY_STATIC (gst_sh_mobile_debug);
 #define GST_CAT_DEFAULT gst_sh_mobile_debug
 
 #define DEFAULT_MAX_SIZE 0
 
+// Input buffers queued to the decoder thread at most
+#define SHVIDEODEC_RING_SLOTS 64
+
 /**
  * Define decoder properties
  */
@@ -110,6 +113,23 @@ enum
 {
   PROP_0,
   PROP_MAX_BUFFER_SIZE,
+  PROP_DST_X,
+  PROP_DST_Y,
+  PROP_DST_WIDTH,
+  PROP_DST_HEIGHT,
+  PROP_KEEP_ASPECT,
+  PROP_CLEAR_BACKGROUND,
+  PROP_AVERAGE_LATENCY,
+  PROP_MAX_LATENCY,
+  // In the order of the offsets in gstshvideosched.h
+  PROP_SCHED_POLICY,
+  PROP_SCHED_PRIORITY,
+  PROP_SCHED_NICE,
+  PROP_SCHED_CPU_MASK,
+#ifdef SHVIDEO_COPY_STATS
+  PROP_BYTES_COPIED,
+  PROP_BUFFERS_ALLOCATED,
+#endif
   PROP_LAST
 };
 
@@ -171,12 +191,47 @@ gst_shvideodec_dispose (GObject * object)
 
   GST_LOG_OBJECT(dec,"%s called\n",__FUNCTION__);  
 
+  if (dec->task != NULL)
+  {
+    gst_shvideodec_stop_task(dec);
+  }
+  // The last frame may still be converted from the VPU memory
+  if (dec->veu != NULL)
+  {
+    sh_veu_wait(dec->veu);
+  }
   if (dec->decoder != NULL) 
   {
     GST_DEBUG_OBJECT (dec, "close decoder object %p", dec->decoder);
     shcodecs_decoder_close (dec->decoder);
+    dec->decoder = NULL;
+  }
+  if (dec->veu != NULL)
+  {
+    unsigned long jobs;
+    unsigned long long avg_wait, avg_latency, max_latency;
+
+    sh_veu_get_latency(dec->veu, &jobs, &avg_wait,
+		       &avg_latency, &max_latency);
+    GST_DEBUG_OBJECT(dec, "%lu VEU jobs, waited %llu us, latency %llu us "
+		     "(max %llu us)", jobs, avg_wait, avg_latency,
+		     max_latency);
+    sh_veu_destroy();
+    g_free(dec->veu);
+    dec->veu = NULL;
   }
-  sh_veu_destroy();
+  if (dec->ring != NULL)
+  {
+    GstBuffer *buffer;
+
+    while(gst_shvideo_ring_try_pop(dec->ring, &buffer))
+    {
+      gst_buffer_unref(buffer);
+    }
+    gst_shvideo_ring_free(dec->ring);
+    dec->ring = NULL;
+  }
+  gst_shvideo_parse_clear(&dec->parse);
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
@@ -202,7 +257,76 @@ gst_shvideodec_class_init (GstshvideodecClass * klass)
                            0, G_MAXUINT, DEFAULT_MAX_SIZE,
 			   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_DST_X,
+      g_param_spec_int ("dst-x", "Destination X",
+			"Left edge of the video area on the screen",
+			0, G_MAXINT, 0,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DST_Y,
+      g_param_spec_int ("dst-y", "Destination Y",
+			"Top edge of the video area on the screen",
+			0, G_MAXINT, 0,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DST_WIDTH,
+      g_param_spec_int ("dst-width", "Destination width",
+			"Width of the video area (0=screen width)",
+			0, G_MAXINT, 0,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DST_HEIGHT,
+      g_param_spec_int ("dst-height", "Destination height",
+			"Height of the video area (0=screen height)",
+			0, G_MAXINT, 0,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_KEEP_ASPECT,
+      g_param_spec_boolean ("keep-aspect", "Keep aspect ratio",
+			    "Letterbox the video instead of stretching it "
+			    "over the video area",
+			    FALSE,
+			    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CLEAR_BACKGROUND,
+      g_param_spec_boolean ("clear-background", "Clear background",
+			    "Paint the video area around the video black, "
+			    "off leaves the framebuffer contents as they are",
+			    TRUE,
+			    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AVERAGE_LATENCY,
+      g_param_spec_uint64 ("average-latency", "Average VEU latency",
+			   "Average time in microseconds from queuing a frame "
+			   "to the VEU to the end of its conversion",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Maximum VEU latency",
+			   "Longest time in microseconds from queuing a frame "
+			   "to the VEU to the end of its conversion",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  gst_shvideo_sched_install_properties (gobject_class, PROP_SCHED_POLICY);
+
+#ifdef SHVIDEO_COPY_STATS
+  g_object_class_install_property (gobject_class, PROP_BYTES_COPIED,
+      g_param_spec_uint64 ("bytes-copied", "Bytes copied",
+			   "Bytes of the frames copied by the decoder",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUFFERS_ALLOCATED,
+      g_param_spec_uint64 ("buffers-allocated", "Buffers allocated",
+			   "Buffers allocated by the decoder",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+#endif
+
   gstelement_class->change_state = gst_shvideodec_change_state;
+  gstelement_class->send_event = gst_shvideodec_send_event;
   gstelement_class->set_clock = gst_shvideodec_set_clock;
 }
 
@@ -227,17 +351,43 @@ gst_shvideodec_init (Gstshvideodec * dec, GstshvideodecClass * gklass)
   dec->decoder = NULL;
   dec->waiting_for_first_frame = TRUE;
 
-  dec->buffer = NULL;
   dec->buffer_size = DEFAULT_MAX_SIZE;
+  dec->ring = gst_shvideo_ring_new(SHVIDEODEC_RING_SLOTS, sizeof(GstBuffer *),
+				   dec->buffer_size);
+  // The format is set with the caps
+  gst_shvideo_parse_init(&dec->parse, SHCodecs_Format_H264);
+
+  dec->dst_x = 0;
+  dec->dst_y = 0;
+  dec->dst_width = 0;
+  dec->dst_height = 0;
+  dec->keep_aspect = FALSE;
+  dec->clear_background = TRUE;
+  dec->area_x = 0;
+  dec->area_y = 0;
+  dec->area_width = 0;
+  dec->area_height = 0;
+  dec->par_numerator = 1;
+  dec->par_denominator = 1;
+  dec->geometry_changed = FALSE;
+  dec->veu = NULL;
 
-  dec->running = TRUE;  
   dec->paused = TRUE;
+  dec->eos = FALSE;
+  dec->flushing = FALSE;
+  dec->need_preroll = FALSE;
+  dec->have_frame = FALSE;
+  dec->step_remaining = 0;
+
+  dec->task = NULL;
+  g_static_rec_mutex_init(&dec->task_lock);
+  gst_shvideo_sched_init(&dec->sched);
+  dec->sched_saved = NULL;
 
   pthread_mutex_init(&dec->mutex,NULL);
-  pthread_mutex_init(&dec->cond_mutex,NULL);
-  pthread_cond_init(&dec->thread_condition,NULL);
   pthread_mutex_init(&dec->pause_mutex,NULL);
   pthread_cond_init(&dec->pause_condition,NULL);
+  GST_SHVIDEO_COPY_STATS_INIT(dec->copy_stats);
 }
 
 
@@ -252,6 +402,44 @@ gst_shvideodec_set_property (GObject * object, guint prop_id,
     case PROP_MAX_BUFFER_SIZE:
     {
       dec->buffer_size = g_value_get_uint (value) * 1024; // Kilobytes we use
+      gst_shvideo_ring_set_max_weight(dec->ring, dec->buffer_size);
+      break;
+    }
+    case PROP_DST_X:
+    case PROP_DST_Y:
+    case PROP_DST_WIDTH:
+    case PROP_DST_HEIGHT:
+    case PROP_KEEP_ASPECT:
+    {
+      // Moved between two frames by the decoded callback
+      pthread_mutex_lock(&dec->mutex);
+      if(prop_id == PROP_DST_X)
+        dec->dst_x = g_value_get_int (value);
+      else if(prop_id == PROP_DST_Y)
+        dec->dst_y = g_value_get_int (value);
+      else if(prop_id == PROP_DST_WIDTH)
+        dec->dst_width = g_value_get_int (value);
+      else if(prop_id == PROP_DST_HEIGHT)
+        dec->dst_height = g_value_get_int (value);
+      else
+        dec->keep_aspect = g_value_get_boolean (value);
+      dec->geometry_changed = TRUE;
+      pthread_mutex_unlock(&dec->mutex);
+      break;
+    }
+    case PROP_CLEAR_BACKGROUND:
+    {
+      dec->clear_background = g_value_get_boolean (value);
+      break;
+    }
+    case PROP_SCHED_POLICY:
+    case PROP_SCHED_PRIORITY:
+    case PROP_SCHED_NICE:
+    case PROP_SCHED_CPU_MASK:
+    {
+      // Applied when the decoder task starts
+      gst_shvideo_sched_set_property (&dec->sched,
+				      prop_id - PROP_SCHED_POLICY, value);
       break;
     }
     default:
@@ -275,11 +463,145 @@ gst_shvideodec_get_property (GObject * object, guint prop_id,
       g_value_set_uint(value,dec->buffer_size/1024); // In kilo bytes      
       break;
     }
+    case PROP_DST_X:
+    {
+      g_value_set_int(value,dec->dst_x);
+      break;
+    }
+    case PROP_DST_Y:
+    {
+      g_value_set_int(value,dec->dst_y);
+      break;
+    }
+    case PROP_DST_WIDTH:
+    {
+      g_value_set_int(value,dec->dst_width);
+      break;
+    }
+    case PROP_DST_HEIGHT:
+    {
+      g_value_set_int(value,dec->dst_height);
+      break;
+    }
+    case PROP_KEEP_ASPECT:
+    {
+      g_value_set_boolean(value,dec->keep_aspect);
+      break;
+    }
+    case PROP_CLEAR_BACKGROUND:
+    {
+      g_value_set_boolean(value,dec->clear_background);
+      break;
+    }
+    case PROP_SCHED_POLICY:
+    case PROP_SCHED_PRIORITY:
+    case PROP_SCHED_NICE:
+    case PROP_SCHED_CPU_MASK:
+    {
+      gst_shvideo_sched_get_property (&dec->sched,
+				      prop_id - PROP_SCHED_POLICY, value);
+      break;
+    }
+    case PROP_AVERAGE_LATENCY:
+    case PROP_MAX_LATENCY:
+    {
+      unsigned long jobs = 0;
+      unsigned long long avg_wait = 0, avg_latency = 0, max_latency = 0;
+
+      if(dec->veu != NULL)
+      {
+	sh_veu_get_latency(dec->veu, &jobs, &avg_wait,
+			   &avg_latency, &max_latency);
+      }
+      g_value_set_uint64(value, prop_id == PROP_AVERAGE_LATENCY ?
+			 avg_latency : max_latency);
+      break;
+    }
+#ifdef SHVIDEO_COPY_STATS
+    case PROP_BYTES_COPIED:
+    case PROP_BUFFERS_ALLOCATED:
+    {
+      guint64 bytes, buffers;
+
+      gst_shvideo_copy_stats_get(&dec->copy_stats, &bytes, &buffers);
+      g_value_set_uint64(value, prop_id == PROP_BYTES_COPIED ?
+			 bytes : buffers);
+      break;
+    }
+#endif
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
 }
 
+static void
+gst_shvideodec_place_video (Gstshvideodec * dec)
+{
+  vidix_playback_t *info = &dec->veu->info;
+  gint area_x, area_y, area_w, area_h, w, h;
+
+  area_x = MIN(dec->dst_x, (gint) fbi.width - 16);
+  area_y = MIN(dec->dst_y, (gint) fbi.height - 16);
+  area_w = dec->dst_width ? dec->dst_width : (gint) fbi.width - area_x;
+  area_h = dec->dst_height ? dec->dst_height : (gint) fbi.height - area_y;
+
+  w = area_w;
+  h = area_h;
+  if(dec->keep_aspect)
+  {
+    // Fit the display aspect ratio of the video in the area
+    w = gst_util_uint64_scale_int(area_h,
+				  dec->width * dec->par_numerator,
+				  dec->height * dec->par_denominator);
+    if(w > area_w)
+    {
+      w = area_w;
+      h = gst_util_uint64_scale_int(area_w,
+				    dec->height * dec->par_denominator,
+				    dec->width * dec->par_numerator);
+    }
+  }
+
+  // The VEU writes the framebuffer in 4 pixel columns
+  info->dest.w = MAX(w & ~3, 16);
+  info->dest.h = MAX(h, 16);
+  info->dest.x = (area_x + (area_w - (gint) info->dest.w) / 2) & ~3;
+  info->dest.y = area_y + (area_h - (gint) info->dest.h) / 2;
+
+  dec->area_x = area_x;
+  dec->area_y = area_y;
+  dec->area_width = area_w;
+  dec->area_height = area_h;
+
+  GST_DEBUG_OBJECT(dec,"Video at %dx%d+%d+%d in area %dx%d+%d+%d",
+		   info->dest.w, info->dest.h,
+		   info->dest.x, info->dest.y,
+		   area_w, area_h, area_x, area_y);
+}
+
+static void
+gst_shvideodec_clear_around (Gstshvideodec * dec, gint x, gint y,
+			     gint w, gint h)
+{
+  vidix_playback_t *info = &dec->veu->info;
+  gint x0, y0, x1, y1;
+
+  // The video rectangle clipped to the cleared one
+  x0 = CLAMP((gint) info->dest.x, x, x + w);
+  x1 = CLAMP((gint) (info->dest.x + info->dest.w), x, x + w);
+  y0 = CLAMP((gint) info->dest.y, y, y + h);
+  y1 = CLAMP((gint) (info->dest.y + info->dest.h), y, y + h);
+
+  if(y0 > y)
+    sh_veu_clear_rect("/dev/fb0", &fbi, x, y, w, y0 - y);
+  if(y + h > y1)
+    sh_veu_clear_rect("/dev/fb0", &fbi, x, y1, w, y + h - y1);
+  if(x0 > x && y1 > y0)
+    sh_veu_clear_rect("/dev/fb0", &fbi, x, y0, x0 - x, y1 - y0);
+  if(x + w > x1 && y1 > y0)
+    sh_veu_clear_rect("/dev/fb0", &fbi, x1, y0, x + w - x1, y1 - y0);
+}
+
 static gboolean            
 gst_shvideodec_set_clock (GstElement *element, GstClock *clock)
 {
@@ -311,26 +633,113 @@ gst_shvideodec_change_state (GstElement *element, GstStateChange transition)
 
   switch (transition) 
   {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    {
+      // A new stream, also after the previous one ended
+      gst_shvideo_ring_reset(dec->ring);
+      gst_shvideo_parse_reset(&dec->parse);
+      dec->playback_timestamp = 0;
+      dec->playback_played = 0;
+      dec->eos = FALSE;
+      dec->flushing = FALSE;
+      dec->waiting_for_first_frame = TRUE;
+      dec->step_remaining = 0;
+
+      /* Posted before the pads are activated, the decoder may commit
+         the preroll as soon as data flows */
+      gst_element_post_message(element,
+			       gst_message_new_async_start(GST_OBJECT(dec),
+							   FALSE));
+      pthread_mutex_lock( &dec->pause_mutex );
+      dec->paused = TRUE;
+      dec->need_preroll = TRUE;
+      pthread_mutex_unlock( &dec->pause_mutex );
+      break;
+    }
     case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
     {
       GST_DEBUG_OBJECT(dec,"Resume playing");
-      dec->paused = FALSE;
       pthread_mutex_lock( &dec->pause_mutex );
+      dec->paused = FALSE;
+      dec->step_remaining = 0;
+      // The frame times start again from the next frame
+      dec->waiting_for_first_frame = TRUE;
       pthread_cond_signal( &dec->pause_condition);
       pthread_mutex_unlock( &dec->pause_mutex );
       break;
     }
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+    {
+      // Doesn't wait for the queued buffers to be decoded
+      gst_shvideodec_stop_task(dec);
+      break;
+    }
+    default:
+    {
+      break;
+    }
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) 
+  {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    {
+      // Done once the first frame is on the screen
+      if(ret != GST_STATE_CHANGE_FAILURE)
+      {
+	ret = GST_STATE_CHANGE_ASYNC;
+      }
+      else
+      {
+	pthread_mutex_lock( &dec->pause_mutex );
+	dec->need_preroll = FALSE;
+	pthread_mutex_unlock( &dec->pause_mutex );
+      }
+      break;
+    }
     case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
     {
+      /* The decoder stops before it shows the next frame. If there was
+         no frame yet, the first one is shown and completes the change */
       GST_DEBUG_OBJECT(dec,"Pause playing");
+      pthread_mutex_lock( &dec->pause_mutex );
       dec->paused = TRUE;
+      if(!dec->have_frame && ret != GST_STATE_CHANGE_FAILURE)
+      {
+	dec->need_preroll = TRUE;
+	gst_element_post_message(element,
+				 gst_message_new_async_start(GST_OBJECT(dec),
+							     FALSE));
+	ret = GST_STATE_CHANGE_ASYNC;
+      }
+      pthread_mutex_unlock( &dec->pause_mutex );
+      break;
+    }
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+    {
+      dec->need_preroll = FALSE;
+      dec->have_frame = FALSE;
+
+      /* The next stream opens a new decoder, its caps are set again
+         even if they are the same */
+      if(dec->veu)
+      {
+	sh_veu_wait(dec->veu);
+      }
+      if(dec->decoder)
+      {
+	GST_DEBUG_OBJECT(dec,"close decoder object %p", dec->decoder);
+	shcodecs_decoder_close(dec->decoder);
+	dec->decoder = NULL;
+      }
+      dec->caps_set = FALSE;
+      gst_pad_set_caps(dec->sinkpad, NULL);
       break;
     }
     default:
     {
-      ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
-      if (ret == GST_STATE_CHANGE_FAILURE)
-        return ret;
       break;
     }
   }
@@ -342,7 +751,7 @@ static gboolean
 gst_shvideodec_sink_event (GstPad * pad, GstEvent * event)
 {
   Gstshvideodec *dec = (Gstshvideodec *) (GST_OBJECT_PARENT (pad));
-  gboolean ret=TRUE;
+  gboolean ret=TRUE, lost;
 
   GST_DEBUG_OBJECT(dec,"%s called event %i",__FUNCTION__,GST_EVENT_TYPE(event));
 
@@ -351,18 +760,54 @@ gst_shvideodec_sink_event (GstPad * pad, GstEvent * event)
     case GST_EVENT_EOS:
     {
       GST_DEBUG_OBJECT (dec, "EOS gst event");
-      dec->running = FALSE;
-      if(dec->dec_thread)
+      /* The decoder task decodes the queued buffers, finalizes the
+         stream and posts EOS once the last frame is shown */
+      dec->eos = TRUE;
+      gst_shvideo_ring_close(dec->ring);
+      if(!dec->task || gst_task_get_state(dec->task) != GST_TASK_STARTED)
       {
-        pthread_join(dec->dec_thread,NULL);
-        // Decode the rest of the buffer
+        gst_element_post_message((GstElement*)dec,gst_message_new_buffering((GstObject*)dec,100));      
+        gst_shvideodec_start_task(dec);
       }
-      else
+      gst_event_unref(event);
+      break;
+    }
+    case GST_EVENT_FLUSH_START:
+    {
+      // Releases the chain and the decoder, e.g. for a seek
+      GST_DEBUG_OBJECT (dec, "Flush start");
+      gst_shvideodec_stop_task(dec);
+      gst_event_unref(event);
+      break;
+    }
+    case GST_EVENT_FLUSH_STOP:
+    {
+      GST_DEBUG_OBJECT (dec, "Flush stop");
+      gst_shvideo_ring_reset(dec->ring);
+      gst_shvideo_parse_reset(&dec->parse);
+      dec->eos = FALSE;
+      dec->playback_timestamp = 0;
+      dec->playback_played = 0;
+
+      pthread_mutex_lock( &dec->pause_mutex );
+      dec->flushing = FALSE;
+      dec->waiting_for_first_frame = TRUE;
+      dec->have_frame = FALSE;
+      dec->step_remaining = 0;
+      lost = dec->paused && !dec->need_preroll;
+      pthread_mutex_unlock( &dec->pause_mutex );
+
+      /* In PAUSED the first frame after the seek is shown again. The
+         frame comes after this event, once the state is lost */
+      if(lost)
       {
-        gst_element_post_message((GstElement*)dec,gst_message_new_buffering((GstObject*)dec,100));      
+	gst_element_lost_state(GST_ELEMENT(dec));
+	pthread_mutex_lock( &dec->pause_mutex );
+	dec->need_preroll = dec->paused;
+	pthread_cond_signal( &dec->pause_condition);
+	pthread_mutex_unlock( &dec->pause_mutex );
       }
-      gst_shvideodec_decode(dec);
-      gst_element_post_message((GstElement*)dec,gst_message_new_eos((GstObject*)dec));
+      gst_event_unref(event);
       break;
     }
     default:
@@ -380,15 +825,12 @@ gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps)
 {
   GstStructure *structure = NULL;
   Gstshvideodec *dec = (Gstshvideodec *) (GST_OBJECT_PARENT (pad));
+  vidix_capability_t sh_capability;
+  const GValue *value;
+  GstBuffer *codec_data;
 
   GST_LOG_OBJECT(dec,"%s called",__FUNCTION__);
 
-  if (dec->decoder!=NULL) 
-  {
-    GST_DEBUG_OBJECT(dec,"%s: Decoder already opened",__FUNCTION__);
-    return FALSE;
-  }
-
   structure = gst_caps_get_structure (caps, 0);
 
   if (!strcmp (gst_structure_get_name (structure), "video/x-h264")) 
@@ -413,6 +855,25 @@ gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps)
       return FALSE;
     }
   }
+  gst_shvideo_parse_clear(&dec->parse);
+  gst_shvideo_parse_init(&dec->parse, dec->format);
+
+  // The parameter sets of MP4 and Matroska are in the caps
+  value = gst_structure_get_value (structure, "codec_data");
+  if (value && G_VALUE_TYPE (value) == GST_TYPE_BUFFER)
+  {
+    codec_data = gst_value_get_buffer (value);
+    if(!gst_shvideo_parse_set_codec_data(&dec->parse,
+					 GST_BUFFER_DATA(codec_data),
+					 GST_BUFFER_SIZE(codec_data)))
+    {
+      GST_DEBUG_OBJECT(dec,"%s failed (invalid codec_data)",__FUNCTION__);
+      return FALSE;
+    }
+    GST_DEBUG_OBJECT(dec,"codec_data of %d bytes, NAL length size %u",
+		     GST_BUFFER_SIZE(codec_data),
+		     dec->parse.nal_length_size);
+  }
 
   if(!gst_structure_get_fraction (structure, "framerate", 
 				  &dec->fps_numerator, 
@@ -422,10 +883,36 @@ gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps)
     return FALSE;
   }
 
+  if(!gst_structure_get_fraction (structure, "pixel-aspect-ratio",
+				  &dec->par_numerator,
+				  &dec->par_denominator))
+  {
+    dec->par_numerator = 1;
+    dec->par_denominator = 1;
+  }
+
   if (gst_structure_get_int (structure, "width",  &dec->width)
       && gst_structure_get_int (structure, "height", &dec->height)) 
   {
     GST_DEBUG_OBJECT(dec,"%s initializing decoder %dx%d",__FUNCTION__,dec->width,dec->height);
+    if(dec->decoder)
+    {
+      /* New caps in the stream. The decoder thread uses the decoder,
+         the units queued with the old caps are dropped */
+      GST_DEBUG_OBJECT(dec,"%s: reopening the decoder",__FUNCTION__);
+      gst_shvideodec_stop_task(dec);
+      gst_shvideo_ring_reset(dec->ring);
+      pthread_mutex_lock( &dec->pause_mutex );
+      dec->flushing = FALSE;
+      pthread_mutex_unlock( &dec->pause_mutex );
+
+      // Not while the VEU still converts a frame from its memory
+      if(dec->veu)
+      {
+	sh_veu_wait(dec->veu);
+      }
+      shcodecs_decoder_close(dec->decoder);
+    }
     dec->decoder=shcodecs_decoder_init(dec->width,dec->height,dec->format);
   } 
   else 
@@ -447,12 +934,19 @@ gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps)
   /* Use physical addresses for playback */
   shcodecs_decoder_set_use_physical(dec->decoder,1);
 
-  /* Let's try to init video output. First we probe, then init */  
-  if (sh_veu_probe(0,0)<0) 
+  /* Let's try to init video output. First we probe, then init. The
+     stream has its own VEU context, the VEU is shared with the other
+     decoders and, through the arbiter lock, the VEU filters. The probe
+     is matched by the destroy on close */
+  if (!dec->veu)
   {
-    GST_ELEMENT_ERROR((GstElement*)dec,CORE,FAILED,("Error on SH VEU probe."), 
-       ("%s failed (Error on SH VEU probe)",__FUNCTION__));
-    return FALSE;
+    if (sh_veu_probe(0,0)<0) 
+    {
+      GST_ELEMENT_ERROR((GstElement*)dec,CORE,FAILED,("Error on SH VEU probe."), 
+	 ("%s failed (Error on SH VEU probe)",__FUNCTION__));
+      return FALSE;
+    }
+    dec->veu = g_new0(struct sh_veu_context, 1);
   }
 
   if (sh_veu_init()<0) 
@@ -469,31 +963,30 @@ gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps)
     return FALSE;
   }
 
-  /* let's config playback */
-  if (get_fb_info("/dev/fb0", &fbi)<0) 
+  /* let's config playback, the probe has read the frame buffer info */
+  dec->veu->info.src.w = dec->width;
+  dec->veu->info.src.h = dec->height;
+  pthread_mutex_lock(&dec->mutex);
+  gst_shvideodec_place_video(dec);
+  dec->geometry_changed = FALSE;
+  pthread_mutex_unlock(&dec->mutex);
+  dec->veu->info.num_frames=1;
+  dec->veu->info.capability = sh_capability.flags;
+  dec->veu->info.fourcc=IMGFMT_NV12;
+
+  if (sh_veu_config_context(dec->veu,&dec->veu->info)<0) 
   {
-    GST_ELEMENT_ERROR((GstElement*)dec,CORE,FAILED,("Error on getting frame buffer info."), 
-       ("%s failed (Error on getting frame buffer info.)",__FUNCTION__));
+    GST_ELEMENT_ERROR((GstElement*)dec,CORE,FAILED,("Error on SH VEU config playback."), 
+       ("%s failed (Error on SH VEU config playback)",__FUNCTION__));
     return FALSE;
   }
 
-  memset(&sh_vidix,0,sizeof(vidix_playback_t));
-
-  sh_vidix.src.w = dec->width;
-  sh_vidix.src.h = dec->height;
-  sh_vidix.dest.x = dec->dst_x;
-  sh_vidix.dest.y = dec->dst_y;
-  sh_vidix.dest.w = fbi.width;
-  sh_vidix.dest.h = fbi.height;
-  sh_vidix.num_frames=1;
-  sh_vidix.capability = sh_capability.flags;
-  sh_vidix.fourcc=IMGFMT_NV12;
-
-  if (sh_veu_config_playback(&sh_vidix)<0) 
+  // Only the letterbox is cleared, the last picture of the previous clip
+  // stays on the screen until the first new one replaces it
+  if (dec->clear_background)
   {
-    GST_ELEMENT_ERROR((GstElement*)dec,CORE,FAILED,("Error on SH VEU config playback."), 
-       ("%s failed (Error on SH VEU config playback)",__FUNCTION__));
-    return FALSE;
+    gst_shvideodec_clear_around(dec, dec->area_x, dec->area_y,
+				dec->area_width, dec->area_height);
   }
 
   shcodecs_decoder_set_decoded_callback(dec->decoder,
@@ -511,6 +1004,7 @@ gst_shvideodec_chain (GstPad * pad, GstBuffer * inbuffer)
 {
   Gstshvideodec *dec = (Gstshvideodec *) (GST_OBJECT_PARENT (pad));
   GstFlowReturn ret = GST_FLOW_OK;
+  guint size;
   gint percent;
 
   if(!dec->caps_set)
@@ -521,142 +1015,298 @@ gst_shvideodec_chain (GstPad * pad, GstBuffer * inbuffer)
 
   GST_LOG_OBJECT(dec,"%s called",__FUNCTION__);
 
-  
-  if(dec->buffer &&
-     GST_BUFFER_SIZE(dec->buffer) + GST_BUFFER_SIZE(inbuffer) > dec->buffer_size)
+  if(dec->flushing)
   {
-    if(!dec->dec_thread)
-    {
-      GST_DEBUG_OBJECT(dec,"Pre-buffering complete. The new frame doesn't fit");    
-      gst_element_post_message((GstElement*)dec,gst_message_new_buffering((GstObject*)dec,100));      
-      /* We'll have to launch the decoder in 
-         a separate thread to keep the pipeline running */
-      pthread_create( &dec->dec_thread, NULL, gst_shvideodec_decode, dec);
-    }
-    else
-    {
-      GST_DEBUG_OBJECT(dec,"Buffer full, waiting");    
-      pthread_mutex_lock( &dec->cond_mutex );
-      pthread_cond_wait( &dec->thread_condition, &dec->cond_mutex );
-      pthread_mutex_unlock( &dec->cond_mutex );
-      GST_DEBUG_OBJECT(dec,"Got signal");
-    }    
+    gst_buffer_unref(inbuffer);
+    return GST_FLOW_WRONG_STATE;
   }
 
-  pthread_mutex_lock( &dec->mutex );
-  if(!dec->buffer)
-  {
-    GST_DEBUG_OBJECT(dec,"First frame in buffer. Size %d timestamp: %llu duration: %llu",
-		   GST_BUFFER_SIZE(inbuffer),
-		   GST_TIME_AS_MSECONDS(GST_BUFFER_TIMESTAMP (inbuffer)),
-		   GST_TIME_AS_MSECONDS(GST_BUFFER_DURATION (inbuffer)));
+  size = GST_BUFFER_SIZE(inbuffer);
 
-    dec->buffer_timestamp = GST_BUFFER_TIMESTAMP (inbuffer);
-    dec->buffer_frames = 1;
-    dec->buffer = inbuffer;
-  }  
-  else
+  GST_LOG_OBJECT(dec,"Buffer size %d timestamp: %llu duration: %llu",
+		 size,
+		 GST_TIME_AS_MSECONDS(GST_BUFFER_TIMESTAMP (inbuffer)),
+		 GST_TIME_AS_MSECONDS(GST_BUFFER_DURATION (inbuffer)));
+
+  if(!dec->task && gst_shvideo_ring_is_full(dec->ring, size))
   {
-    GST_LOG_OBJECT(dec,"Buffer size %d timestamp: %llu duration: %llu",
-		   GST_BUFFER_SIZE(inbuffer),
-		   GST_TIME_AS_MSECONDS(GST_BUFFER_TIMESTAMP (inbuffer)),
-		   GST_TIME_AS_MSECONDS(GST_BUFFER_DURATION (inbuffer)));
+    GST_DEBUG_OBJECT(dec,"Pre-buffering complete. The new frame doesn't fit");    
+    gst_element_post_message((GstElement*)dec,gst_message_new_buffering((GstObject*)dec,100));      
+    /* We'll have to launch the decoder in 
+       a separate thread to keep the pipeline running */
+    gst_shvideodec_start_task(dec);
+  }
 
-    dec->buffer = gst_buffer_join(dec->buffer,inbuffer);
-    dec->buffer_frames++;
-    GST_LOG_OBJECT(dec,"Buffer added. Now storing %d bytes",GST_BUFFER_SIZE(dec->buffer));        
+  // Waits only while the ring is full, wakes the decoder only if it waits
+  if(!gst_shvideo_ring_push(dec->ring, &inbuffer, size))
+  {
+    GST_DEBUG_OBJECT(dec,"Input after the end of the stream or flushing");
+    gst_buffer_unref(inbuffer);
+    return dec->flushing ? GST_FLOW_WRONG_STATE : GST_FLOW_UNEXPECTED;
   }
-  pthread_mutex_unlock( &dec->mutex );
 
-  if(!dec->dec_thread)
+  if(!dec->task)
   {
-    if(!dec->buffer_size || (GST_BUFFER_SIZE(dec->buffer) >= dec->buffer_size))
+    if(!dec->buffer_size ||
+       gst_shvideo_ring_get_weight(dec->ring) >= dec->buffer_size)
     {
       GST_DEBUG_OBJECT(dec,"Pre-buffering complete");    
       // Let's start decoding as soon as possible
-      pthread_create( &dec->dec_thread, NULL, gst_shvideodec_decode, dec);
+      gst_shvideodec_start_task(dec);
     } 
     else
     {
       //Send buffering message.
-      percent = GST_BUFFER_SIZE(dec->buffer) * 100 / dec->buffer_size;
+      percent = gst_shvideo_ring_get_weight(dec->ring) * 100 / dec->buffer_size;
       GST_LOG_OBJECT(dec,"Pre-buffering %d",percent);    
       gst_element_post_message((GstElement*)dec,gst_message_new_buffering((GstObject*)dec,percent));      
     }
   }
 
-  // If the decoder was waiting for data.
-  pthread_mutex_lock( &dec->cond_mutex );
-  pthread_cond_signal( &dec->thread_condition);
-  pthread_mutex_unlock( &dec->cond_mutex );
-
   return ret;
 }
 
-void *
-gst_shvideodec_decode (void *data)
+static void
+gst_shvideodec_decode_loop (Gstshvideodec * dec)
 {
-  int used_bytes;
   GstBuffer* buffer;
+  const guint8 *unit;
+  guint size;
+  GstClockTime timestamp;
+  gboolean commit;
 
-  Gstshvideodec *dec = (Gstshvideodec *)data;
-
-  GST_LOG_OBJECT(dec,"%s called\n",__FUNCTION__);
-
-  do
+  // Waits for data, the ring is closed at the end of the stream or to stop
+  if(!gst_shvideo_ring_pop(dec->ring, &buffer))
   {
-    if(!dec->buffer)
+    if(dec->eos && !dec->flushing)
     {
-      GST_DEBUG_OBJECT(dec,"Waiting for data.");        
-      pthread_mutex_lock( &dec->cond_mutex );
-      pthread_cond_wait( &dec->thread_condition, &dec->cond_mutex );
-      pthread_mutex_unlock( &dec->cond_mutex );
-      GST_DEBUG_OBJECT(dec,"Got signal");        
+      // No decoder before the caps, e.g. for an empty stream
+      if(dec->decoder)
+      {
+	// The last unit ends with the stream
+	if(gst_shvideo_parse_drain(&dec->parse, &unit, &size, &timestamp))
+	{
+	  gst_shvideodec_decode_unit(dec, unit, size, timestamp);
+	}
+	GST_DEBUG_OBJECT(dec,"We are done, calling finalize.");
+	shcodecs_decoder_finalize(dec->decoder);
+	GST_DEBUG_OBJECT(dec,"Stream finalized. Total decoded %d frames.",
+			 shcodecs_decoder_get_frame_count(dec->decoder));
+      }
+      // A stream without a frame completes the preroll too
+      pthread_mutex_lock( &dec->pause_mutex );
+      commit = dec->need_preroll;
+      dec->need_preroll = FALSE;
+      pthread_mutex_unlock( &dec->pause_mutex );
+      if(commit)
+      {
+	gst_shvideodec_commit_preroll(dec);
+      }
+      gst_element_post_message((GstElement*)dec,gst_message_new_eos((GstObject*)dec));
     }
+    gst_task_pause(dec->task);
+    return;
+  }
 
-    pthread_mutex_lock(&dec->mutex);
-    buffer = dec->buffer;
-    dec->buffer = NULL; 
-    dec->playback_timestamp = dec->buffer_timestamp;
-    dec->playback_frames = dec->buffer_frames;
-    pthread_mutex_unlock(&dec->mutex); 
+  if(dec->flushing)
+  {
+    gst_buffer_unref(buffer);
+    return;
+  }
 
-    // If the other thread was waiting for buffer to be consumed
-    pthread_mutex_lock( &dec->cond_mutex );
-    pthread_cond_signal( &dec->thread_condition);
-    pthread_mutex_unlock( &dec->cond_mutex );
+  GST_DEBUG_OBJECT(dec,"Input buffer size: %d",GST_BUFFER_SIZE (buffer));
 
-    GST_DEBUG_OBJECT(dec,"Input buffer size: %d frames %d",
-		   GST_BUFFER_SIZE (buffer), dec->playback_frames);
+  // The unit may go on in the next buffer, the data is kept until then
+  GST_SHVIDEO_COPY_STATS_ADD(dec, dec->copy_stats, GST_BUFFER_SIZE(buffer), 0);
+  if(!gst_shvideo_parse_push(&dec->parse, GST_BUFFER_DATA(buffer),
+			     GST_BUFFER_SIZE(buffer),
+			     GST_BUFFER_TIMESTAMP(buffer)))
+  {
+    GST_WARNING_OBJECT(dec,"Truncated NAL unit in a buffer of %d bytes",
+		       GST_BUFFER_SIZE(buffer));
+  }
+  gst_buffer_unref(buffer);
 
+  while(!dec->flushing &&
+	gst_shvideo_parse_pop(&dec->parse, &unit, &size, &timestamp))
+  {
+    gst_shvideodec_decode_unit(dec, unit, size, timestamp);
+  }
+}
+
+static void
+gst_shvideodec_decode_unit (Gstshvideodec * dec, const guint8 * unit,
+			    guint size, GstClockTime timestamp)
+{
+  int used_bytes;
+
+  // The units without a timestamp follow the last one at the frame rate
+  if(GST_CLOCK_TIME_IS_VALID(timestamp))
+  {
+    dec->playback_timestamp = timestamp;
     dec->playback_played = 0;
+  }
+
+  // The decoder returns after each frame, the rest of the unit follows
+  while(size > 0 && !dec->flushing)
+  {
+    // The decoded callback tells the time the frame took
+    dec->unit_start = gst_util_get_timestamp();
 
-    used_bytes = shcodecs_decode(dec->decoder,
-		    GST_BUFFER_DATA (buffer),
-		    GST_BUFFER_SIZE (buffer));
+    used_bytes = shcodecs_decode(dec->decoder, (unsigned char *) unit, size);
 
-    GST_DEBUG_OBJECT(dec,"Used: %d decoded, %d frames, total %d frames",
-		   used_bytes, dec->playback_played, shcodecs_decoder_get_frame_count(dec->decoder));
+    GST_LOG_OBJECT(dec,"%d of %u bytes at %" GST_TIME_FORMAT ", total %d frames",
+		   used_bytes, size, GST_TIME_ARGS(dec->playback_timestamp),
+		   shcodecs_decoder_get_frame_count(dec->decoder));
 
-    if(GST_BUFFER_SIZE(buffer) != used_bytes)
+    if(used_bytes <= 0)
     {    
-      GST_DEBUG_OBJECT(dec,"Skipped %d frames and %d bytes of data",
-		       dec->playback_frames-dec->playback_played,
-		       GST_BUFFER_SIZE(buffer)-used_bytes);
+      GST_DEBUG_OBJECT(dec,"Skipped %u bytes of the unit", size);
+      break;
     }
+    unit += used_bytes;
+    size -= MIN(size, (guint) used_bytes);
+  }
+}
 
-    if(!dec->running)
-    {
-      GST_DEBUG_OBJECT(dec,"We are done, calling finalize.");
-      shcodecs_decoder_finalize(dec->decoder);
-      GST_DEBUG_OBJECT(dec,"Stream finalized. Total decoded %d frames.",
-		       shcodecs_decoder_get_frame_count(dec->decoder));
-    }    
+static void
+gst_shvideodec_start_task (Gstshvideodec * dec)
+{
+  GST_LOG_OBJECT(dec,"%s called",__FUNCTION__);
+
+  if(!dec->task)
+  {
+    dec->task = gst_task_create((GstTaskFunction) gst_shvideodec_decode_loop,
+				dec);
+    gst_task_set_lock(dec->task, &dec->task_lock);
+    gst_task_set_thread_callbacks(dec->task, &gst_shvideodec_thread_callbacks,
+				  dec, NULL);
+  }
+  gst_task_start(dec->task);
+}
+
+static void
+gst_shvideodec_stop_task (Gstshvideodec * dec)
+{
+  GstBuffer *buffer;
+
+  GST_LOG_OBJECT(dec,"%s called",__FUNCTION__);
+
+  // Wakes the task waiting for data or in the pause of the decoded callback
+  pthread_mutex_lock( &dec->pause_mutex );
+  dec->flushing = TRUE;
+  pthread_cond_signal( &dec->pause_condition);
+  pthread_mutex_unlock( &dec->pause_mutex );
+  gst_shvideo_ring_close(dec->ring);
+
+  if(dec->task)
+  {
+    gst_task_stop(dec->task);
+    gst_task_join(dec->task);
+    gst_object_unref(dec->task);
+    dec->task = NULL;
+  }
+
+  // The ring stays closed until the flush stops or the next start
+  while(gst_shvideo_ring_try_pop(dec->ring, &buffer))
+  {
     gst_buffer_unref(buffer);
-    buffer = NULL;
-  }while(dec->running);
+  }
+}
+
+static void
+gst_shvideodec_enter_thread (GstTask * task, GThread * thread,
+			     Gstshvideodec * dec)
+{
+  int err = gst_shvideo_sched_apply(&dec->sched, &dec->sched_saved);
+
+  if(err)
+  {
+    GST_WARNING_OBJECT(dec,"Cannot set the scheduling of the decoder thread: %s",
+		       g_strerror(err));
+  }
+  else
+  {
+    GST_DEBUG_OBJECT(dec,"Decoder thread policy %d priority %u nice %d "
+		     "CPUs 0x%x", dec->sched.policy, dec->sched.priority,
+		     dec->sched.nice, dec->sched.cpu_mask);
+  }
+}
+
+static void
+gst_shvideodec_leave_thread (GstTask * task, GThread * thread,
+			     Gstshvideodec * dec)
+{
+  if(dec->sched_saved)
+  {
+    gst_shvideo_sched_restore(dec->sched_saved);
+    dec->sched_saved = NULL;
+  }
+}
+
+static void
+gst_shvideodec_commit_preroll (Gstshvideodec * dec)
+{
+  GST_DEBUG_OBJECT(dec,"Prerolled");
+  gst_element_continue_state(GST_ELEMENT(dec), GST_STATE_CHANGE_SUCCESS);
+  gst_element_post_message(GST_ELEMENT(dec),
+			   gst_message_new_async_done(GST_OBJECT(dec)));
+}
+
+static GstMessage *
+gst_shvideodec_new_step_done (Gstshvideodec * dec)
+{
+  GstClockTime duration = GST_CLOCK_TIME_NONE;
+
+  if(dec->fps_numerator)
+  {
+    duration = gst_util_uint64_scale_int(dec->step_amount * GST_SECOND,
+					 dec->fps_denominator,
+					 dec->fps_numerator);
+  }
+
+  GST_DEBUG_OBJECT(dec,"Stepped %" G_GUINT64_FORMAT " frames",
+		   dec->step_amount);
+  return gst_message_new_step_done(GST_OBJECT(dec), GST_FORMAT_BUFFERS,
+				   dec->step_amount, dec->step_rate,
+				   dec->step_flush, dec->step_intermediate,
+				   duration, FALSE);
+}
+
+static gboolean
+gst_shvideodec_send_event (GstElement * element, GstEvent * event)
+{
+  Gstshvideodec *dec = (Gstshvideodec *) element;
+  GstFormat format;
+  guint64 amount;
+  gdouble rate;
+  gboolean flush, intermediate, ret = FALSE;
 
-  return NULL;
+  if(GST_EVENT_TYPE(event) != GST_EVENT_STEP)
+  {
+    return GST_ELEMENT_CLASS (parent_class)->send_event (element, event);
+  }
+
+  gst_event_parse_step(event, &format, &amount, &rate, &flush,
+		       &intermediate);
+
+  // Frames forward in PAUSED, a new step replaces the one going on
+  pthread_mutex_lock( &dec->pause_mutex );
+  if(format == GST_FORMAT_BUFFERS && rate > 0.0 && dec->paused)
+  {
+    GST_DEBUG_OBJECT(dec,"Step %" G_GUINT64_FORMAT " frames", amount);
+    dec->step_amount = amount;
+    dec->step_rate = rate;
+    dec->step_flush = flush;
+    dec->step_intermediate = intermediate;
+    dec->step_remaining = amount;
+    pthread_cond_signal( &dec->pause_condition);
+    ret = TRUE;
+  }
+  pthread_mutex_unlock( &dec->pause_mutex );
+
+  gst_event_unref(event);
+  return ret;
 }
 
 static int
@@ -668,23 +1318,71 @@ gst_shcodecs_decoded_callback (SHCodecs_Decoder * decoder,
   GstClockTime time_now;
   long long unsigned int time_diff, stamp_diff, sleep_time;
   Gstshvideodec *dec = (Gstshvideodec *) user_data;
-
-  if(dec->paused)
+  gint old_x, old_y, old_w, old_h;
+  gboolean show_paused, resync, commit;
+  GstMessage *step_done;
+
+  GST_LOG_OBJECT(dec,"Decoded in %" GST_TIME_FORMAT,
+		 GST_TIME_ARGS(gst_util_get_timestamp() - dec->unit_start));
+
+  /* In PAUSED the first frame is shown for the preroll and each step
+     shows the next ones, otherwise the decoder waits here. Leaving
+     PAUSED, a step and stopping end the wait */
+  pthread_mutex_lock( &dec->pause_mutex );
+  while(dec->paused && !dec->need_preroll && !dec->step_remaining &&
+	!dec->flushing)
   {
-    pthread_mutex_lock( &dec->pause_mutex );
     pthread_cond_wait( &dec->pause_condition, &dec->pause_mutex );
-    pthread_mutex_unlock( &dec->pause_mutex );
+  }
+  show_paused = dec->paused;
+  resync = dec->waiting_for_first_frame;
+  if(!show_paused)
+  {
+    dec->waiting_for_first_frame = FALSE;
+  }
+  pthread_mutex_unlock( &dec->pause_mutex );
+
+  // Stopping, the rest of the frames are not shown
+  if(dec->flushing)
+  {
+    return 1;
   }
 
+  /* The VEU converted the previous frame while this one was decoded.
+     Its job must end before the context is changed for this frame */
+  sh_veu_wait(dec->veu);
+
+  // Move the video between two frames when the area moved, the VEU is
+  // programmed for the new scaling with this frame
+  pthread_mutex_lock(&dec->mutex);
+  if(dec->geometry_changed)
+  {
+    old_x = dec->veu->info.dest.x;
+    old_y = dec->veu->info.dest.y;
+    old_w = dec->veu->info.dest.w;
+    old_h = dec->veu->info.dest.h;
+    gst_shvideodec_place_video(dec);
+    if(dec->clear_background)
+    {
+      gst_shvideodec_clear_around(dec, old_x, old_y, old_w, old_h);
+      gst_shvideodec_clear_around(dec, dec->area_x, dec->area_y,
+				  dec->area_width, dec->area_height);
+    }
+    dec->geometry_changed = FALSE;
+  }
+  pthread_mutex_unlock(&dec->mutex);
+
   // Zero copy: Set the playback address to VPU mem  
-  sh_vidix.offset.y=(unsigned)y_buf;
-  sh_vidix.offset.u=(unsigned)c_buf;
+  dec->veu->info.offset.y=(unsigned)y_buf;
+  dec->veu->info.offset.u=(unsigned)c_buf;
 
-  if (dec->waiting_for_first_frame)
+  // This frame is due now, the times of the next ones follow from it
+  if (resync && !show_paused)
   { 
     dec->start_time = gst_clock_get_time(dec->clock);
-    dec->first_timestamp = dec->playback_timestamp;
-    dec->waiting_for_first_frame = FALSE;
+    dec->first_timestamp = dec->playback_timestamp +
+      dec->playback_played * ( 1000 * dec->fps_denominator / dec->fps_numerator ) *
+      GST_MSECOND;
   }
 
   time_now = gst_clock_get_time(dec->clock);
@@ -715,7 +1413,7 @@ gst_shcodecs_decoded_callback (SHCodecs_Decoder * decoder,
   }
  
 
-  if(sleep_time)
+  if(sleep_time && !show_paused)
   {
     if(!dec->playback_played)
     {    
@@ -728,11 +1426,45 @@ gst_shcodecs_decoded_callback (SHCodecs_Decoder * decoder,
     usleep(sleep_time*1000);
   }  
 
-  // Blit and then wait.
-  sh_veu_blit(&sh_vidix, 0);
-  sh_veu_wait_irq(&sh_vidix);
+  /* Queued to the VEU, which may be converting for another stream. The
+     next frame is decoded meanwhile. In PAUSED the frame must be on the
+     screen before the preroll or the step completes */
+  sh_veu_start(dec->veu);
+  if(show_paused)
+  {
+    sh_veu_wait(dec->veu);
+  }
 
   dec->playback_played++;
+
+  pthread_mutex_lock( &dec->pause_mutex );
+  dec->have_frame = TRUE;
+  commit = FALSE;
+  step_done = NULL;
+  if(show_paused && !dec->flushing)
+  {
+    if(dec->need_preroll)
+    {
+      dec->need_preroll = FALSE;
+      commit = TRUE;
+    }
+    else if(dec->step_remaining && !--dec->step_remaining)
+    {
+      step_done = gst_shvideodec_new_step_done(dec);
+    }
+  }
+  pthread_mutex_unlock( &dec->pause_mutex );
+
+  // Posted without the mutex, a bus handler may pause or step again
+  if(commit)
+  {
+    gst_shvideodec_commit_preroll(dec);
+  }
+  else if(step_done)
+  {
+    gst_element_post_message(GST_ELEMENT(dec), step_done);
+  }
+
   return 1;
 }
 
@@ -31,6 +31,10 @@
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
+#include "gstshvideocopystats.h"
+#include "gstshvideoparse.h"
+#include "gstshvideoring.h"
+#include "gstshvideosched.h"
 #endif
 
 
@@ -48,6 +52,8 @@ G_BEGIN_DECLS
 typedef struct _Gstshvideodec Gstshvideodec;
 typedef struct _GstshvideodecClass GstshvideodecClass;
 
+struct sh_veu_context;
+
 #include <shcodecs/shcodecs_decoder.h>
 
 /**
@@ -78,17 +84,39 @@ struct _Gstshvideodec
   gint dst_height;
   gint dst_x;
   gint dst_y;
-
-  GstBuffer* buffer;
+  gboolean keep_aspect;
+  gboolean clear_background;
+  gint area_x;
+  gint area_y;
+  gint area_width;
+  gint area_height;
+  gint par_numerator;
+  gint par_denominator;
+  gboolean geometry_changed;
+  struct sh_veu_context *veu;
+
+  /* Input buffers queued to the decoder thread */
+  GstshvideoRing *ring;
   guint32 buffer_size;
-  GstClockTime buffer_timestamp;
-  gint buffer_frames;
 
-  gboolean running;
+  /* Splits the input into the units given to the decoder */
+  GstshvideoParse parse;
+  GstClockTime unit_start;
+
+  /* Under the pause mutex */
   gboolean paused;
+  gboolean need_preroll;
+  gboolean have_frame;
+  guint64 step_remaining;
+  guint64 step_amount;
+  gdouble step_rate;
+  gboolean step_flush;
+  gboolean step_intermediate;
+
+  gboolean eos;
+  gboolean flushing;
 
   GstClockTime playback_timestamp;
-  gint playback_frames;  
   gint playback_played;
 
   GstClock* clock;
@@ -96,12 +124,19 @@ struct _Gstshvideodec
   GstClockTime current_timestamp;
   GstClockTime start_time;
 
-  pthread_t dec_thread;
+  /* Decoder thread */
+  GstTask *task;
+  GStaticRecMutex task_lock;
+  GstshvideoSched sched;
+  GstshvideoSchedSaved *sched_saved;
+
   pthread_mutex_t mutex;
-  pthread_mutex_t cond_mutex;
-  pthread_cond_t  thread_condition;
   pthread_mutex_t pause_mutex;
   pthread_cond_t  pause_condition;
+
+#ifdef SHVIDEO_COPY_STATS
+  GstshvideoCopyStats copy_stats;
+#endif
 };
 
 /**
@@ -174,6 +209,26 @@ static void gst_shvideodec_set_property (GObject *object,
 static void gst_shvideodec_get_property (GObject * object, guint prop_id,
 					  GValue * value, GParamSpec * pspec);
 
+/** Places the video on the framebuffer. The area is the destination
+    rectangle or the whole screen, with keep-aspect the video is fitted
+    in its center and the rest of the area stays black
+    @param dec Gstreamer SH video decoder
+*/
+
+static void gst_shvideodec_place_video (Gstshvideodec * dec);
+
+/** Clears the part of a framebuffer rectangle that the video does not
+    cover, so the video itself never flashes black
+    @param dec Gstreamer SH video decoder
+    @param x Left edge of the rectangle
+    @param y Top edge of the rectangle
+    @param w Width of the rectangle
+    @param h Height of the rectangle
+*/
+
+static void gst_shvideodec_clear_around (Gstshvideodec * dec, gint x, gint y,
+					 gint w, gint h);
+
 /** Sets the clock for the element
     @param element GStreamer element
     @param clock the used clock. If NULL we use system clock
@@ -192,6 +247,32 @@ static GstStateChangeReturn gst_shvideodec_change_state (GstElement *element,
 							 GstStateChange transition);
 
 
+/** Handles the step events, frames are stepped forward in PAUSED. The
+    other events go to the parent class
+    @param element GStreamer element
+    @param event The event
+    @return TRUE if the event was handled
+*/
+
+static gboolean gst_shvideodec_send_event (GstElement * element,
+					   GstEvent * event);
+
+/** Completes the change to PAUSED once a frame is on the screen. The
+    caller clears need_preroll under the pause mutex and calls this
+    without it, the state change may go on into change_state
+    @param dec decoder object
+*/
+
+static void gst_shvideodec_commit_preroll (Gstshvideodec * dec);
+
+/** Makes the message of a finished step. The pause mutex must be held,
+    the caller posts the message without it
+    @param dec decoder object
+    @return the step-done message
+*/
+
+static GstMessage *gst_shvideodec_new_step_done (Gstshvideodec * dec);
+
 /** Event handler for decoder sink events
     @param pad Gstreamer sink pad
     @param event The Gstreamer event
@@ -216,11 +297,59 @@ static gboolean gst_shvideodec_setcaps (GstPad * pad, GstCaps * caps);
 
 static GstFlowReturn gst_shvideodec_chain (GstPad * pad, GstBuffer * inbuffer);
 
-/** The video input buffer decode function
-    @param data decoder object
+/** The decoder task function. Decodes the units completed by a buffer
+    queued by the chain function, once the ring is closed at the end of
+    the stream it decodes the last unit, finalizes the stream, posts EOS
+    and pauses the task
+    @param dec decoder object
+*/
+
+static void gst_shvideodec_decode_loop (Gstshvideodec * dec);
+
+/** Gives one access unit to the decoder
+    @param dec decoder object
+    @param unit The unit
+    @param size Size of the unit
+    @param timestamp Timestamp of the unit, or GST_CLOCK_TIME_NONE to
+    follow the previous unit
+*/
+
+static void gst_shvideodec_decode_unit (Gstshvideodec * dec,
+					const guint8 * unit, guint size,
+					GstClockTime timestamp);
+
+/** Starts the decoder task, creating it first if needed
+    @param dec decoder object
+*/
+
+static void gst_shvideodec_start_task (Gstshvideodec * dec);
+
+/** Stops the decoder task and releases the queued buffers. The frame
+    being decoded is not shown
+    @param dec decoder object
+*/
+
+static void gst_shvideodec_stop_task (Gstshvideodec * dec);
+
+/** Sets the scheduling of the task thread from the sched-policy,
+    priority, nice and cpu-mask properties when the task enters it
+    @param task The decoder task
+    @param thread The thread of the pool running the task
+    @param dec decoder object
+*/
+
+static void gst_shvideodec_enter_thread (GstTask * task, GThread * thread,
+					 Gstshvideodec * dec);
+
+/** Gives the thread back its scheduling when the task leaves it, the
+    pool may run other tasks in it
+    @param task The decoder task
+    @param thread The thread of the pool running the task
+    @param dec decoder object
 */
 
-void* gst_shvideodec_decode (void *data);
+static void gst_shvideodec_leave_thread (GstTask * task, GThread * thread,
+					 Gstshvideodec * dec);
 
 /** Initialize the decoder sink
     @param plugin Gstreamer plugin
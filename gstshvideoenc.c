@@ -36,6 +36,8 @@
 #include <string.h>
 #include <pthread.h>
 
+#include <linux/videodev2.h>
+
 #include <gst/gst.h>
 
 #include "gstshvideoenc.h"
@@ -91,9 +93,30 @@ enum
 {
   PROP_0,
   PROP_CNTL_FILE,
+  PROP_STATS_INTERVAL,
+  PROP_FRAMES_IN,
+  PROP_FRAMES_OUT,
+  PROP_FRAMES_SKIPPED,
+  PROP_LATENCY_AVG,
+  PROP_LATENCY_P99,
+  PROP_BITRATE,
+  PROP_BITRATE_AVG,
+  PROP_QUEUE_WAIT_AVG,
+  PROP_CEU_DEVICE,
+  // In the order of the offsets in gstshvideosched.h
+  PROP_SCHED_POLICY,
+  PROP_SCHED_PRIORITY,
+  PROP_SCHED_NICE,
+  PROP_SCHED_CPU_MASK,
+#ifdef SHVIDEO_COPY_STATS
+  PROP_BYTES_COPIED,
+  PROP_BUFFERS_ALLOCATED,
+#endif
   PROP_LAST
 };
 
+#define DEFAULT_STATS_INTERVAL 0
+
 static void
 gst_shvideo_enc_init_class (gpointer g_class, gpointer data)
 {
@@ -149,12 +172,19 @@ gst_shvideo_enc_dispose (GObject * object)
   GstshvideoEnc *shvideoenc = GST_SHVIDEOENC (object);
 
   if (shvideoenc->encoder!=NULL) {
-    shvideoenc->encoder= NULL;
+    gst_shvideo_enc_stop_encoder(shvideoenc);
+  }
+  if (shvideoenc->ring != NULL) {
+    gst_shvideo_enc_flush_frames(shvideoenc);
+    gst_shvideo_ring_free(shvideoenc->ring);
+    shvideoenc->ring = NULL;
   }
 
   pthread_mutex_destroy(&shvideoenc->mutex);
-  pthread_mutex_destroy(&shvideoenc->cond_mutex);
   pthread_cond_destroy(&shvideoenc->thread_condition);
+  g_free(shvideoenc->ceu_device);
+  shvideoenc->ceu_device = NULL;
+  pthread_mutex_destroy(&shvideoenc->stats_mutex);
 
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
@@ -172,6 +202,9 @@ gst_shvideo_enc_class_init (GstshvideoEncClass * klass)
   gobject_class->set_property = gst_shvideo_enc_set_property;
   gobject_class->get_property = gst_shvideo_enc_get_property;
 
+  gstelement_class->change_state = gst_shvideo_enc_change_state;
+  gstelement_class->send_event = gst_shvideo_enc_send_event;
+
   GST_DEBUG_CATEGORY_INIT (gst_sh_mobile_debug, "gst-sh-mobile-enc",
       0, "Encoder for H264/MPEG4 streams");
 
@@ -179,6 +212,82 @@ gst_shvideo_enc_class_init (GstshvideoEncClass * klass)
       g_param_spec_string ("cntl-file", "Control file location", 
 			"Location of the file including encoding parameters", 
 			   NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval ms", 
+			"Interval of the shvideoenc-stats element messages (ms, 0=disabled)", 
+			 0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+			 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES_IN,
+      g_param_spec_uint64 ("frames-in", "Frames in", 
+			"Number of raw frames received", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES_OUT,
+      g_param_spec_uint64 ("frames-out", "Frames out", 
+			"Number of encoded frames pushed", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES_SKIPPED,
+      g_param_spec_uint64 ("frames-skipped", "Frames skipped", 
+			"Number of frames skipped by the rate control", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_AVG,
+      g_param_spec_uint64 ("latency-avg", "Average encode latency us", 
+			"Average time from input to encoded output (us)", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_P99,
+      g_param_spec_uint64 ("latency-p99", "P99 encode latency us", 
+			"99th percentile of the encode latency of the last frames (us)", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE,
+      g_param_spec_uint ("bitrate", "Output bitrate bps", 
+			"Bitrate of the last encoded frame at the stream frame rate (bps)", 
+			 0, G_MAXUINT, 0,
+			 G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE_AVG,
+      g_param_spec_uint ("bitrate-avg", "Windowed output bitrate bps", 
+			"Output bitrate over the last full second (bps)", 
+			 0, G_MAXUINT, 0,
+			 G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_QUEUE_WAIT_AVG,
+      g_param_spec_uint64 ("queue-wait-avg", "Average input queue wait us", 
+			"Average time a frame waited for the encoder to take it (us)", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CEU_DEVICE,
+      g_param_spec_string ("ceu-device", "CEU device", 
+			"Capture from this CEU device in the encoder instead of the sink pad. "
+			"Size, frame rate and frame count come from the control file", 
+			   NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_shvideo_sched_install_properties (gobject_class, PROP_SCHED_POLICY);
+
+#ifdef SHVIDEO_COPY_STATS
+  g_object_class_install_property (gobject_class, PROP_BYTES_COPIED,
+      g_param_spec_uint64 ("bytes-copied", "Bytes copied", 
+			"Bytes of the frames copied by the encoder", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUFFERS_ALLOCATED,
+      g_param_spec_uint64 ("buffers-allocated", "Buffers allocated", 
+			"Buffers allocated by the encoder", 
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+#endif
 }
 
 static void
@@ -196,6 +305,10 @@ gst_shvideo_enc_init (GstshvideoEnc * shvideoenc,
   gst_element_add_pad (GST_ELEMENT (shvideoenc), shvideoenc->sinkpad);
 
   gst_pad_set_setcaps_function (shvideoenc->sinkpad, gst_shvideoenc_setcaps);
+  gst_pad_set_getcaps_function (shvideoenc->sinkpad, 
+				gst_shvideoenc_sink_getcaps);
+  gst_pad_set_acceptcaps_function (shvideoenc->sinkpad, 
+				   gst_shvideoenc_sink_acceptcaps);
   gst_pad_set_activate_function (shvideoenc->sinkpad, gst_shvideo_enc_activate);
   gst_pad_set_activatepull_function (shvideoenc->sinkpad,
       gst_shvideo_enc_activate_pull);
@@ -204,7 +317,8 @@ gst_shvideo_enc_init (GstshvideoEnc * shvideoenc,
   shvideoenc->srcpad =
       gst_pad_new_from_template (gst_element_class_get_pad_template (klass,
           "src"), "src");
-  gst_pad_use_fixed_caps (shvideoenc->srcpad);
+  gst_pad_set_getcaps_function (shvideoenc->srcpad, 
+				gst_shvideoenc_src_getcaps);
 
   gst_pad_set_query_function (shvideoenc->srcpad,
       GST_DEBUG_FUNCPTR (gst_shvideo_enc_src_query));
@@ -213,13 +327,22 @@ gst_shvideo_enc_init (GstshvideoEnc * shvideoenc,
 
   shvideoenc->encoder=NULL;
   shvideoenc->caps_set=FALSE;
+  shvideoenc->stop_encoder=FALSE;
+  shvideoenc->eos=FALSE;
+  shvideoenc->encoder_done=FALSE;
+  shvideoenc->eos_sent=FALSE;
+  shvideoenc->ceu_device = NULL;
+  shvideoenc->ceu_paused = FALSE;
+  gst_shvideo_sched_init(&shvideoenc->sched);
+  shvideoenc->ainfo.ceu = NULL;
   shvideoenc->enc_thread = 0;
-  shvideoenc->buffer_yuv = NULL;
-  shvideoenc->buffer_cbcr = NULL;
+  shvideoenc->ring = gst_shvideo_ring_new(SHVIDEOENC_INPUT_FRAMES,
+					  sizeof(GstshvideoEncFrame), 0);
 
   pthread_mutex_init(&shvideoenc->mutex,NULL);
-  pthread_mutex_init(&shvideoenc->cond_mutex,NULL);
   pthread_cond_init(&shvideoenc->thread_condition,NULL);
+  pthread_mutex_init(&shvideoenc->stats_mutex,NULL);
+  GST_SHVIDEO_COPY_STATS_INIT(shvideoenc->copy_stats);
 
   shvideoenc->format = SHCodecs_Format_NONE;
   shvideoenc->out_caps = NULL;
@@ -228,6 +351,11 @@ gst_shvideo_enc_init (GstshvideoEnc * shvideoenc,
   shvideoenc->fps_numerator = 0;
   shvideoenc->fps_denominator = 0;
   shvideoenc->frame_number = 0;
+  shvideoenc->frame_timestamp = GST_CLOCK_TIME_NONE;
+  shvideoenc->frame_duration = GST_CLOCK_TIME_NONE;
+
+  gst_shvideo_enc_stats_reset(shvideoenc);
+  shvideoenc->stats_interval = DEFAULT_STATS_INTERVAL * GST_MSECOND;
 }
 
 static void
@@ -243,6 +371,27 @@ gst_shvideo_enc_set_property (GObject * object, guint prop_id,
       strcpy(shvideoenc->ainfo.ctrl_file_name_buf,g_value_get_string(value));
       break;
     }
+    case PROP_STATS_INTERVAL:
+    {
+      shvideoenc->stats_interval = g_value_get_uint(value) * GST_MSECOND;
+      break;
+    }
+    case PROP_CEU_DEVICE:
+    {
+      g_free(shvideoenc->ceu_device);
+      shvideoenc->ceu_device = g_value_dup_string(value);
+      break;
+    }
+    case PROP_SCHED_POLICY:
+    case PROP_SCHED_PRIORITY:
+    case PROP_SCHED_NICE:
+    case PROP_SCHED_CPU_MASK:
+    {
+      // Applied when the encoder thread starts
+      gst_shvideo_sched_set_property (&shvideoenc->sched,
+				      prop_id - PROP_SCHED_POLICY, value);
+      break;
+    }
     default:
     {
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -264,6 +413,95 @@ gst_shvideo_enc_get_property (GObject * object, guint prop_id,
       g_value_set_string(value,shvideoenc->ainfo.ctrl_file_name_buf);      
       break;
     }
+    case PROP_STATS_INTERVAL:
+    {
+      g_value_set_uint(value,shvideoenc->stats_interval / GST_MSECOND);
+      break;
+    }
+    case PROP_CEU_DEVICE:
+    {
+      g_value_set_string(value,shvideoenc->ceu_device);
+      break;
+    }
+    case PROP_SCHED_POLICY:
+    case PROP_SCHED_PRIORITY:
+    case PROP_SCHED_NICE:
+    case PROP_SCHED_CPU_MASK:
+    {
+      gst_shvideo_sched_get_property (&shvideoenc->sched,
+				      prop_id - PROP_SCHED_POLICY, value);
+      break;
+    }
+    case PROP_FRAMES_IN:
+    {
+      // 64 bit counters, not read in one access on SH
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value,shvideoenc->frames_in);
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+    case PROP_FRAMES_OUT:
+    {
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value,shvideoenc->frames_out);
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+    case PROP_FRAMES_SKIPPED:
+    {
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value,shvideoenc->frames_skipped);
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+    case PROP_LATENCY_AVG:
+    {
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value, shvideoenc->latency_frames ?
+			 GST_TIME_AS_USECONDS(shvideoenc->latency_total /
+					      shvideoenc->latency_frames) : 0);
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+    case PROP_LATENCY_P99:
+    {
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value, GST_TIME_AS_USECONDS(
+			   gst_shvideo_enc_stats_latency_p99(shvideoenc)));
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+    case PROP_BITRATE:
+    {
+      g_value_set_uint(value,shvideoenc->bitrate);
+      break;
+    }
+    case PROP_BITRATE_AVG:
+    {
+      g_value_set_uint(value,shvideoenc->bitrate_avg);
+      break;
+    }
+    case PROP_QUEUE_WAIT_AVG:
+    {
+      pthread_mutex_lock(&shvideoenc->stats_mutex);
+      g_value_set_uint64(value, shvideoenc->queue_waits ?
+			 GST_TIME_AS_USECONDS(shvideoenc->queue_wait_total /
+					      shvideoenc->queue_waits) : 0);
+      pthread_mutex_unlock(&shvideoenc->stats_mutex);
+      break;
+    }
+#ifdef SHVIDEO_COPY_STATS
+    case PROP_BYTES_COPIED:
+    case PROP_BUFFERS_ALLOCATED:
+    {
+      guint64 bytes, buffers;
+
+      gst_shvideo_copy_stats_get(&shvideoenc->copy_stats, &bytes, &buffers);
+      g_value_set_uint64(value, prop_id == PROP_BYTES_COPIED ?
+			 bytes : buffers);
+      break;
+    }
+#endif
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -276,34 +514,261 @@ gst_shvideo_enc_sink_event (GstPad * pad, GstEvent * event)
 
   GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
 
+  if(GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+  {
+    // Let the encoder write out the frames it still has
+    gst_shvideo_enc_drain(enc);
+    return gst_shvideo_enc_push_eos(enc,event);
+  }
+  else if(GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP && enc->eos)
+  {
+    // A drained encoder is restarted for the new data
+    gst_shvideo_enc_stop_encoder(enc);
+    enc->frame_number = 0;
+  }
+
   return gst_pad_push_event(enc->srcpad,event);
 }
 
+static GstStateChangeReturn
+gst_shvideo_enc_change_state (GstElement *element, GstStateChange transition)
+{
+  GstStateChangeReturn ret;
+  GstshvideoEnc *enc = GST_SHVIDEOENC (element);
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+    {
+      if(enc->ceu_device)
+      {
+	pthread_mutex_lock(&enc->mutex);
+	enc->ceu_paused = FALSE;
+	pthread_cond_broadcast(&enc->thread_condition);
+	pthread_mutex_unlock(&enc->mutex);
+
+	if(!gst_shvideo_enc_ceu_start(enc))
+	{
+	  return GST_STATE_CHANGE_FAILURE;
+	}
+      }
+      break;
+    }
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+    {
+      // Release a chain waiting for the encoder so the pads can deactivate
+      pthread_mutex_lock(&enc->mutex);
+      enc->stop_encoder = TRUE;
+      pthread_cond_broadcast(&enc->thread_condition);
+      pthread_mutex_unlock(&enc->mutex);
+      gst_shvideo_ring_close(enc->ring);
+      break;
+    }
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+    {
+      // Like a live source, capture runs only in PLAYING
+      if(enc->ceu_device && ret == GST_STATE_CHANGE_SUCCESS)
+      {
+	ret = GST_STATE_CHANGE_NO_PREROLL;
+      }
+      break;
+    }
+    case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+    {
+      if(enc->ceu_device)
+      {
+	pthread_mutex_lock(&enc->mutex);
+	enc->ceu_paused = TRUE;
+	pthread_mutex_unlock(&enc->mutex);
+	if(ret == GST_STATE_CHANGE_SUCCESS)
+	{
+	  ret = GST_STATE_CHANGE_NO_PREROLL;
+	}
+      }
+      break;
+    }
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+    {
+      gst_shvideo_enc_stop_encoder(enc);
+      enc->frame_number = 0;
+      enc->offset = 0;
+      // The next stream starts its own statistics
+      gst_shvideo_enc_stats_reset(enc);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_shvideo_enc_send_event (GstElement *element, GstEvent *event)
+{
+  GstshvideoEnc *enc = GST_SHVIDEOENC (element);
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  /* When capturing there is no upstream to send EOS through the
+     sink pad. The encoder thread pushes EOS after the last frame */
+  if(enc->ceu_device && GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+  {
+    pthread_mutex_lock(&enc->mutex);
+    enc->eos = TRUE;
+    pthread_cond_broadcast(&enc->thread_condition);
+    pthread_mutex_unlock(&enc->mutex);
+    gst_event_unref(event);
+    return TRUE;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->send_event (element, event);
+}
+
+static gboolean
+gst_shvideo_enc_ceu_start(GstshvideoEnc *enc)
+{
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  // Resuming from PAUSED
+  if(enc->enc_thread)
+  {
+    return TRUE;
+  }
+
+  gst_shvideoenc_read_src_caps(enc);
+  gst_shvideo_enc_init_encoder(enc);
+  if(!gst_caps_is_any(enc->out_caps))
+  {
+    if(!gst_shvideoenc_set_src_caps(enc))
+    {
+      return FALSE;
+    }
+  }
+  enc->caps_set = TRUE;
+
+  enc->ainfo.ceu = sh_ceu_open(enc->ceu_device, enc->width, enc->height);
+  if(!enc->ainfo.ceu)
+  {
+    GST_ELEMENT_ERROR((GstElement*)enc, RESOURCE, OPEN_READ_WRITE,
+		      ("Could not open %s for %dx%d capture",
+		       enc->ceu_device, enc->width, enc->height), (NULL));
+    return FALSE;
+  }
+
+  if(sh_ceu_get_pixel_format(enc->ainfo.ceu) != V4L2_PIX_FMT_NV12)
+  {
+    GST_ELEMENT_ERROR((GstElement*)enc, RESOURCE, SETTINGS,
+		      ("%s does not capture NV12", enc->ceu_device), (NULL));
+    sh_ceu_close(enc->ainfo.ceu);
+    enc->ainfo.ceu = NULL;
+    return FALSE;
+  }
+
+  gst_pad_push_event(enc->srcpad,
+		     gst_event_new_new_segment(FALSE, 1.0, GST_FORMAT_TIME,
+					       0, -1, 0));
+
+  sh_ceu_start_capturing(enc->ainfo.ceu);
+  pthread_create( &enc->enc_thread, NULL, launch_encoder_thread, enc);
+
+  return TRUE;
+}
+
+static void
+gst_shvideo_enc_ceu_frame(sh_ceu *ceu, const unsigned char *frame_data,
+			  size_t length, void *user_data)
+{
+  GstshvideoEnc *enc = (GstshvideoEnc *)user_data;
+  GstClock *clock;
+  GstClockTime base_time = 0;
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  // Stamp the frame with the running time of the capture
+  GST_OBJECT_LOCK (enc);
+  clock = GST_ELEMENT_CLOCK (enc);
+  if(clock)
+  {
+    gst_object_ref(clock);
+    base_time = GST_ELEMENT_CAST (enc)->base_time;
+  }
+  GST_OBJECT_UNLOCK (enc);
+
+  enc->frame_timestamp = GST_CLOCK_TIME_NONE;
+  enc->frame_duration = GST_CLOCK_TIME_NONE;
+  if(clock)
+  {
+    enc->frame_timestamp = gst_clock_get_time(clock) - base_time;
+    gst_object_unref(clock);
+  }
+
+  pthread_mutex_lock(&enc->stats_mutex);
+  enc->frames_in++;
+  pthread_mutex_unlock(&enc->stats_mutex);
+  gst_shvideo_enc_stats_input(enc);
+
+  // The hardware reads the frame straight from the capture memory
+  shcodecs_encoder_input_provide(enc->encoder, (unsigned char *) frame_data,
+				 (unsigned char *) frame_data + 
+				 enc->width * enc->height);
+}
+
 static gboolean
 gst_shvideoenc_setcaps (GstPad * pad, GstCaps * caps)
 {
   gboolean ret;
   GstStructure *structure;
+  gint width, height, fps_numerator, fps_denominator;
   GstshvideoEnc *enc = 
     (GstshvideoEnc *) (GST_OBJECT_PARENT (pad));
 
-  enc->caps_set = FALSE;
   ret = TRUE;
 
   GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
 
   // get input size
   structure = gst_caps_get_structure (caps, 0);
-  ret = gst_structure_get_int (structure, "width", &enc->width);
-  ret &= gst_structure_get_int (structure, "height", &enc->height);
+  ret = gst_structure_get_int (structure, "width", &width);
+  ret &= gst_structure_get_int (structure, "height", &height);
   ret &= gst_structure_get_fraction (structure, "framerate", 
-				     &enc->fps_numerator, 
-				     &enc->fps_denominator);
+				     &fps_numerator, 
+				     &fps_denominator);
 
   if(!ret) {
 	return ret;
   }
 
+  if(enc->encoder)
+  {
+    if(enc->caps_set && width == enc->width && height == enc->height &&
+       fps_numerator == enc->fps_numerator &&
+       fps_denominator == enc->fps_denominator)
+    {
+      GST_DEBUG_OBJECT(enc,"Caps unchanged, reusing the encoder");
+      return TRUE;
+    }
+
+    GST_DEBUG_OBJECT(enc,"Caps changed from %dx%d to %dx%d, "
+		     "re-initialising the encoder",
+		     enc->width, enc->height, width, height);
+    gst_shvideo_enc_stop_encoder(enc);
+  }
+
+  enc->caps_set = FALSE;
+  enc->width = width;
+  enc->height = height;
+  enc->fps_numerator = fps_numerator;
+  enc->fps_denominator = fps_denominator;
+
   gst_shvideoenc_read_src_caps(enc);
   gst_shvideo_enc_init_encoder(enc);
 
@@ -319,25 +784,152 @@ gst_shvideoenc_setcaps (GstPad * pad, GstCaps * caps)
   return ret;
 }
 
+static GstCaps *
+gst_shvideoenc_sink_getcaps (GstPad * pad)
+{
+  GstCaps *caps, *peer_caps, *size_caps;
+  GstStructure *structure, *peer_structure;
+  const GValue *value;
+  guint i;
+  GstshvideoEnc *enc = 
+    (GstshvideoEnc *) (GST_OBJECT_PARENT (pad));
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  caps = gst_caps_copy (gst_pad_get_pad_template_caps (pad));
+
+  // The sizes and frame rates downstream can take limit the input
+  peer_caps = gst_pad_peer_get_caps (enc->srcpad);
+  if(!peer_caps)
+  {
+    return caps;
+  }
+  if(gst_caps_is_any(peer_caps))
+  {
+    gst_caps_unref(peer_caps);
+    return caps;
+  }
+
+  size_caps = gst_caps_new_empty ();
+  for(i = 0; i < gst_caps_get_size (peer_caps); i++)
+  {
+    peer_structure = gst_caps_get_structure (peer_caps, i);
+    structure = gst_structure_new ("video/x-raw-yuv", "format", 
+				   GST_TYPE_FOURCC, 
+				   GST_MAKE_FOURCC ('N', 'V', '1', '2'), NULL);
+
+    if((value = gst_structure_get_value (peer_structure, "width")))
+    {
+      gst_structure_set_value (structure, "width", value);
+    }
+    if((value = gst_structure_get_value (peer_structure, "height")))
+    {
+      gst_structure_set_value (structure, "height", value);
+    }
+    if((value = gst_structure_get_value (peer_structure, "framerate")))
+    {
+      gst_structure_set_value (structure, "framerate", value);
+    }
+    gst_caps_append_structure (size_caps, structure);
+  }
+  gst_caps_unref(peer_caps);
+
+  peer_caps = gst_caps_intersect (caps, size_caps);
+  gst_caps_unref(caps);
+  gst_caps_unref(size_caps);
+
+  return peer_caps;
+}
+
+static gboolean
+gst_shvideoenc_sink_acceptcaps (GstPad * pad, GstCaps * caps)
+{
+  GstCaps *allowed, *intersection;
+  gboolean ret;
+  GstshvideoEnc *enc = 
+    (GstshvideoEnc *) (GST_OBJECT_PARENT (pad));
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  allowed = gst_shvideoenc_sink_getcaps (pad);
+  intersection = gst_caps_intersect (allowed, caps);
+  ret = !gst_caps_is_empty (intersection);
+  gst_caps_unref(intersection);
+  gst_caps_unref(allowed);
+
+  return ret;
+}
+
+static GstCaps *
+gst_shvideoenc_src_getcaps (GstPad * pad)
+{
+  GstCaps *caps;
+  GstStructure *structure;
+  guint i;
+  GstshvideoEnc *enc = 
+    (GstshvideoEnc *) (GST_OBJECT_PARENT (pad));
+
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  caps = gst_caps_copy (gst_pad_get_pad_template_caps (pad));
+
+  // The output follows the size and frame rate of the input
+  for(i = 0; i < gst_caps_get_size (caps); i++)
+  {
+    structure = gst_caps_get_structure (caps, i);
+    if(enc->width && enc->height)
+    {
+      gst_structure_set (structure, "width", G_TYPE_INT, enc->width,
+			 "height", G_TYPE_INT, enc->height, NULL);
+    }
+    if(enc->fps_denominator)
+    {
+      gst_structure_set (structure, "framerate", GST_TYPE_FRACTION, 
+			 enc->fps_numerator, enc->fps_denominator, NULL);
+    }
+  }
+
+  return caps;
+}
+
 void
 gst_shvideoenc_read_src_caps(GstshvideoEnc * shvideoenc)
 {
   GstStructure *structure;
+  guint i;
 
   GST_LOG_OBJECT(shvideoenc,"%s called",__FUNCTION__);
 
-  // get the caps of the next element in chain
-  shvideoenc->out_caps = gst_pad_peer_get_caps(shvideoenc->srcpad);
+  shvideoenc->format = SHCodecs_Format_NONE;
+  if(shvideoenc->out_caps)
+  {
+    gst_caps_unref(shvideoenc->out_caps);
+  }
+
+  // get the caps both we and the next element in chain can handle
+  shvideoenc->out_caps = gst_pad_get_allowed_caps(shvideoenc->srcpad);
+  if(!shvideoenc->out_caps)
+  {
+    // Not linked, any format is ok
+    shvideoenc->out_caps = gst_caps_new_any();
+    return;
+  }
   
-  // Any format is ok too
+  // Any format is ok too, then the control file decides
   if(!gst_caps_is_any(shvideoenc->out_caps))
   {
-    structure = gst_caps_get_structure (shvideoenc->out_caps, 0);
-    if (!strcmp (gst_structure_get_name (structure), "video/mpeg")) {
-      shvideoenc->format = SHCodecs_Format_MPEG4;
-    }
-    else if (!strcmp (gst_structure_get_name (structure), "video/x-h264")) {
-      shvideoenc->format = SHCodecs_Format_H264;
+    // Take the first format in the order of preference of the peer
+    for(i = 0; i < gst_caps_get_size (shvideoenc->out_caps); i++)
+    {
+      structure = gst_caps_get_structure (shvideoenc->out_caps, i);
+      if (!strcmp (gst_structure_get_name (structure), "video/mpeg")) {
+	shvideoenc->format = SHCodecs_Format_MPEG4;
+	break;
+      }
+      else if (!strcmp (gst_structure_get_name (structure), "video/x-h264")) {
+	shvideoenc->format = SHCodecs_Format_H264;
+	break;
+      }
     }
   }
 }
@@ -371,6 +963,7 @@ gst_shvideoenc_set_src_caps(GstshvideoEnc * shvideoenc)
   {
     GST_ELEMENT_ERROR((GstElement*)shvideoenc,CORE,NEGOTIATION,
 		      ("Format undefined."), (NULL));
+    return FALSE;
   }
 
   if(!gst_pad_set_caps(shvideoenc->srcpad,caps))
@@ -379,12 +972,6 @@ gst_shvideoenc_set_src_caps(GstshvideoEnc * shvideoenc)
 		      ("Source pad not linked."), (NULL));
     ret = FALSE;
   }
-  if(!gst_pad_set_caps(gst_pad_get_peer(shvideoenc->srcpad),caps))
-  {
-    GST_ELEMENT_ERROR((GstElement*)shvideoenc,CORE,NEGOTIATION,
-		      ("Source pad not linked."), (NULL));
-    ret = FALSE;
-  }
   gst_caps_unref(caps);
   return ret;
 }
@@ -440,25 +1027,73 @@ gst_shvideo_enc_init_encoder(GstshvideoEnc * shvideoenc)
 		      ("Error reading control file."), (NULL));
   }
 
-  if(shvideoenc->fps_numerator && shvideoenc->fps_denominator)
-  {
-    shcodecs_encoder_set_frame_rate(shvideoenc->encoder,
-				  (shvideoenc->fps_numerator/shvideoenc->fps_denominator*10));
-  }
   shcodecs_encoder_set_xpic_size(shvideoenc->encoder,shvideoenc->width);
   shcodecs_encoder_set_ypic_size(shvideoenc->encoder,shvideoenc->height);
 
-  shcodecs_encoder_set_frame_no_increment(shvideoenc->encoder,
-      shcodecs_encoder_get_frame_num_resolution(shvideoenc->encoder) /
-      (shcodecs_encoder_get_frame_rate(shvideoenc->encoder) / 10)); 
+  gst_shvideo_enc_set_frame_rate(shvideoenc);
 
-  GST_DEBUG_OBJECT(shvideoenc,"Encoder init: %ldx%ld %ldfps format:%ld",
+  GST_DEBUG_OBJECT(shvideoenc,"Encoder init: %ldx%ld %ld.%ldfps (%ld/%ld) format:%ld",
 		   shcodecs_encoder_get_xpic_size(shvideoenc->encoder),
 		   shcodecs_encoder_get_ypic_size(shvideoenc->encoder),
 		   shcodecs_encoder_get_frame_rate(shvideoenc->encoder)/10,
+		   shcodecs_encoder_get_frame_rate(shvideoenc->encoder)%10,
+		   shcodecs_encoder_get_frame_num_resolution(shvideoenc->encoder),
+		   shcodecs_encoder_get_frame_no_increment(shvideoenc->encoder),
 		   shcodecs_encoder_get_stream_type(shvideoenc->encoder)); 
 }
 
+void
+gst_shvideo_enc_set_frame_rate(GstshvideoEnc * shvideoenc)
+{
+  gint gcd, resolution, increment;
+  glong frame_rate;
+
+  if(!shvideoenc->fps_numerator || !shvideoenc->fps_denominator)
+  {
+    /* Variable frame rate: keep the frame rate and the time base of the
+       control file, frame_no_increment follows the buffer durations */
+    frame_rate = shcodecs_encoder_get_frame_rate(shvideoenc->encoder);
+    resolution = shcodecs_encoder_get_frame_num_resolution(shvideoenc->encoder);
+    if(frame_rate >= 10)
+    {
+      shcodecs_encoder_set_frame_no_increment(shvideoenc->encoder,
+	  (resolution * 10 + frame_rate / 2) / frame_rate);
+    }
+    return;
+  }
+
+  gcd = shvideoenc->fps_numerator;
+  increment = shvideoenc->fps_denominator;
+  while(increment)
+  {
+    resolution = gcd % increment;
+    gcd = increment;
+    increment = resolution;
+  }
+  resolution = shvideoenc->fps_numerator / gcd;
+  increment = shvideoenc->fps_denominator / gcd;
+
+  /* The time base must fit in the 16 bit vop_time_increment_resolution */
+  if(resolution > SHVIDEOENC_MAX_FRAME_NUM_RESOLUTION)
+  {
+    increment = ((gint64) increment * SHVIDEOENC_MAX_FRAME_NUM_RESOLUTION +
+		 resolution / 2) / resolution;
+    resolution = SHVIDEOENC_MAX_FRAME_NUM_RESOLUTION;
+    if(!increment)
+    {
+      increment = 1;
+    }
+  }
+
+  /* frame_rate is given in 0.1 fps units */
+  frame_rate = ((gint64) shvideoenc->fps_numerator * 10 +
+		shvideoenc->fps_denominator / 2) / shvideoenc->fps_denominator;
+
+  shcodecs_encoder_set_frame_rate(shvideoenc->encoder, frame_rate);
+  shcodecs_encoder_set_frame_num_resolution(shvideoenc->encoder, resolution);
+  shcodecs_encoder_set_frame_no_increment(shvideoenc->encoder, increment);
+}
+
 static gboolean
 gst_shvideo_enc_activate (GstPad * pad)
 {
@@ -483,10 +1118,20 @@ gst_shvideo_enc_chain (GstPad * pad, GstBuffer * buffer)
   gint yuv_size, cbcr_size, i, j;
   guint8* cr_ptr; 
   guint8* cb_ptr;
+  GstBuffer* buffer_yuv;
+  GstBuffer* buffer_cbcr;
+  GstshvideoEncFrame frame;
   GstshvideoEnc *enc = (GstshvideoEnc *) (GST_OBJECT_PARENT (pad));  
 
   GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
 
+  if(enc->eos)
+  {
+    GST_DEBUG_OBJECT (enc, "Encoder already drained");
+    gst_buffer_unref(buffer);
+    return GST_FLOW_UNEXPECTED;
+  }
+
   if(!enc->caps_set)
   {
     gst_shvideoenc_read_src_caps(enc);
@@ -495,61 +1140,65 @@ gst_shvideo_enc_chain (GstPad * pad, GstBuffer * buffer)
     {
       if(!gst_shvideoenc_set_src_caps(enc))
       {
+	gst_buffer_unref(buffer);
 	return GST_FLOW_UNEXPECTED;
       }
     }
     enc->caps_set = TRUE;
   }
 
-  /* If buffers are not empty we'll have to 
-     wait until encoder has consumed data */
-  if(enc->buffer_yuv && enc->buffer_cbcr)
-  {
-    pthread_mutex_lock( &enc->cond_mutex );
-    pthread_cond_wait( &enc->thread_condition, &enc->cond_mutex );
-    pthread_mutex_unlock( &enc->cond_mutex );
-  }
-
-  // Lock mutex while handling the buffers
-  pthread_mutex_lock(&enc->mutex);
   yuv_size = enc->width*enc->height;
   cbcr_size = enc->width*enc->height/2;
 
   // Check that we have got enough data
   if(GST_BUFFER_SIZE(buffer) != yuv_size + cbcr_size)
   {
-    GST_DEBUG_OBJECT (enc, "Not enough data");
-    // If we can't continue we can issue EOS
-    gst_pad_push_event(enc->srcpad,gst_event_new_eos ());
+    GST_WARNING_OBJECT (enc, "Frame size %d, expected %d. Dropping",
+			GST_BUFFER_SIZE(buffer), yuv_size + cbcr_size);
+    gst_buffer_unref(buffer);
     return GST_FLOW_OK;
   }  
 
-  enc->buffer_yuv = gst_buffer_new_and_alloc (yuv_size);
-  enc->buffer_cbcr = gst_buffer_new_and_alloc (cbcr_size);
-
-  memcpy(GST_BUFFER_DATA(enc->buffer_yuv),GST_BUFFER_DATA(buffer),yuv_size);
-
+  /* The next frame is prepared while the encoder 
+     is still working with the previous one */
   if(enc->ainfo.yuv_CbCr_format == 0)
   {
+    buffer_yuv = gst_buffer_new_and_alloc (yuv_size);
+    buffer_cbcr = gst_buffer_new_and_alloc (cbcr_size);
+
+    memcpy(GST_BUFFER_DATA(buffer_yuv),GST_BUFFER_DATA(buffer),yuv_size);
+
     cb_ptr = GST_BUFFER_DATA(buffer)+yuv_size;
     cr_ptr = GST_BUFFER_DATA(buffer)+yuv_size+(cbcr_size/2);
 
     for(i=0,j=0;i<cbcr_size;i+=2,j++)
     {
-      GST_BUFFER_DATA(enc->buffer_cbcr)[i]=cb_ptr[j];
-      GST_BUFFER_DATA(enc->buffer_cbcr)[i+1]=cr_ptr[j];
+      GST_BUFFER_DATA(buffer_cbcr)[i]=cb_ptr[j];
+      GST_BUFFER_DATA(buffer_cbcr)[i+1]=cr_ptr[j];
     }
+    GST_SHVIDEO_COPY_STATS_ADD(enc, enc->copy_stats,
+			       yuv_size + cbcr_size, 2);
   }
   else
   {
-    memcpy(GST_BUFFER_DATA(enc->buffer_cbcr),GST_BUFFER_DATA(buffer)+yuv_size,
-	 cbcr_size);
+    /* NV12 planes are given to the encoder in place,
+       e.g. straight from the capture memory of the camera */
+    buffer_yuv = gst_buffer_create_sub (buffer, 0, yuv_size);
+    buffer_cbcr = gst_buffer_create_sub (buffer, yuv_size, cbcr_size);
   }
 
-  // Buffers are ready to be read
-  pthread_mutex_unlock(&enc->mutex);
-
+  frame.buffer_yuv = buffer_yuv;
+  frame.buffer_cbcr = buffer_cbcr;
+  frame.timestamp = GST_BUFFER_TIMESTAMP(buffer);
+  frame.duration = GST_BUFFER_DURATION(buffer);
   gst_buffer_unref(buffer);
+
+  if(!gst_shvideo_enc_queue_frame(enc, &frame))
+  {
+    gst_buffer_unref(buffer_yuv);
+    gst_buffer_unref(buffer_cbcr);
+    return enc->encoder_done ? GST_FLOW_UNEXPECTED : GST_FLOW_WRONG_STATE;
+  }
   
   if(!enc->enc_thread)
   {
@@ -586,7 +1235,10 @@ gst_shvideo_enc_loop (GstshvideoEnc *enc)
   gint yuv_size, cbcr_size, i, j;
   guint8* cb_ptr; 
   guint8* cr_ptr; 
+  GstBuffer* buffer_yuv;
+  GstBuffer* buffer_cbcr;
   GstBuffer* tmp;
+  GstshvideoEncFrame frame;
 
   GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
 
@@ -605,76 +1257,75 @@ gst_shvideo_enc_loop (GstshvideoEnc *enc)
     enc->caps_set = TRUE;
   }
 
-  /* If buffers are not empty we'll have to 
-     wait until encoder has consumed data */
-  if(enc->buffer_yuv && enc->buffer_cbcr)
-  {
-    pthread_mutex_lock( &enc->cond_mutex );
-    pthread_cond_wait( &enc->thread_condition, &enc->cond_mutex );
-    pthread_mutex_unlock( &enc->cond_mutex );
-  }
-
-  // Lock mutex while handling the buffers
-  pthread_mutex_lock(&enc->mutex);
   yuv_size = enc->width*enc->height;
   cbcr_size = enc->width*enc->height/2;
 
   ret = gst_pad_pull_range (enc->sinkpad, enc->offset,
-      yuv_size, &enc->buffer_yuv);
+      yuv_size, &buffer_yuv);
 
   if (ret != GST_FLOW_OK) {
     GST_DEBUG_OBJECT (enc, "pull_range failed: %s", gst_flow_get_name (ret));
-    gst_pad_pause_task (enc->sinkpad);
-    return;
+    goto pause;
   }
-  else if(GST_BUFFER_SIZE(enc->buffer_yuv) != yuv_size)
+  else if(GST_BUFFER_SIZE(buffer_yuv) != yuv_size)
   {
     GST_DEBUG_OBJECT (enc, "Not enough data");
-    gst_pad_pause_task (enc->sinkpad);
-    gst_pad_push_event(enc->srcpad,gst_event_new_eos ());
-    return;
+    gst_buffer_unref(buffer_yuv);
+    ret = GST_FLOW_UNEXPECTED;
+    goto pause;
   }  
 
-  enc->offset += yuv_size;
-
-  ret = gst_pad_pull_range (enc->sinkpad, enc->offset,
+  ret = gst_pad_pull_range (enc->sinkpad, enc->offset + yuv_size,
       cbcr_size, &tmp);
 
   if (ret != GST_FLOW_OK) {
     GST_DEBUG_OBJECT (enc, "pull_range failed: %s", gst_flow_get_name (ret));
-    gst_pad_pause_task (enc->sinkpad);
-    return;
+    gst_buffer_unref(buffer_yuv);
+    goto pause;
   }  
   else if(GST_BUFFER_SIZE(tmp) != cbcr_size)
   {
     GST_DEBUG_OBJECT (enc, "Not enough data");
-    gst_pad_pause_task (enc->sinkpad);
-    gst_pad_push_event(enc->srcpad,gst_event_new_eos ());
-    return;
+    gst_buffer_unref(buffer_yuv);
+    gst_buffer_unref(tmp);
+    ret = GST_FLOW_UNEXPECTED;
+    goto pause;
   }  
 
-  enc->offset += cbcr_size;
+  enc->offset += yuv_size + cbcr_size;
 
   if(enc->ainfo.yuv_CbCr_format == 0)
   {
     cb_ptr = GST_BUFFER_DATA(tmp);
     cr_ptr = GST_BUFFER_DATA(tmp)+(cbcr_size/2);
-    enc->buffer_cbcr = gst_buffer_new_and_alloc(cbcr_size);
+    buffer_cbcr = gst_buffer_new_and_alloc(cbcr_size);
 
     for(i=0,j=0;i<cbcr_size;i+=2,j++)
     {
-      GST_BUFFER_DATA(enc->buffer_cbcr)[i]=cb_ptr[j];
-      GST_BUFFER_DATA(enc->buffer_cbcr)[i+1]=cr_ptr[j];
+      GST_BUFFER_DATA(buffer_cbcr)[i]=cb_ptr[j];
+      GST_BUFFER_DATA(buffer_cbcr)[i+1]=cr_ptr[j];
     }
+    GST_SHVIDEO_COPY_STATS_ADD(enc, enc->copy_stats, cbcr_size, 1);
     
     gst_buffer_unref(tmp);
   }
   else
   {
-    enc->buffer_cbcr = tmp;
+    buffer_cbcr = tmp;
   }
 
-  pthread_mutex_unlock(&enc->mutex);
+  frame.buffer_yuv = buffer_yuv;
+  frame.buffer_cbcr = buffer_cbcr;
+  frame.timestamp = GST_CLOCK_TIME_NONE;
+  frame.duration = GST_CLOCK_TIME_NONE;
+
+  if(!gst_shvideo_enc_queue_frame(enc, &frame))
+  {
+    gst_buffer_unref(buffer_yuv);
+    gst_buffer_unref(buffer_cbcr);
+    ret = enc->encoder_done ? GST_FLOW_UNEXPECTED : GST_FLOW_WRONG_STATE;
+    goto pause;
+  }
   
   if(!enc->enc_thread)
   {
@@ -682,6 +1333,143 @@ gst_shvideo_enc_loop (GstshvideoEnc *enc)
        a separate thread to keep the pipeline running */
     pthread_create( &enc->enc_thread, NULL, launch_encoder_thread, enc);
   }
+  return;
+
+pause:
+  GST_DEBUG_OBJECT (enc, "pausing task: %s", gst_flow_get_name (ret));
+  gst_pad_pause_task (enc->sinkpad);
+
+  // End of file, drain the encoder before the EOS
+  if(ret == GST_FLOW_UNEXPECTED)
+  {
+    gst_shvideo_enc_drain(enc);
+    gst_shvideo_enc_push_eos(enc,NULL);
+  }
+}
+
+void
+gst_shvideo_enc_stop_encoder(GstshvideoEnc * shvideoenc)
+{
+  GST_LOG_OBJECT(shvideoenc,"%s called",__FUNCTION__);
+
+  if(shvideoenc->enc_thread)
+  {
+    // The encoder stops once it has taken the pending frame
+    pthread_mutex_lock(&shvideoenc->mutex);
+    shvideoenc->stop_encoder = TRUE;
+    pthread_cond_broadcast(&shvideoenc->thread_condition);
+    pthread_mutex_unlock(&shvideoenc->mutex);
+    gst_shvideo_ring_close(shvideoenc->ring);
+
+    pthread_join(shvideoenc->enc_thread, NULL);
+    shvideoenc->enc_thread = 0;
+  }
+
+  if(shvideoenc->encoder)
+  {
+    shcodecs_encoder_close(shvideoenc->encoder);
+    shvideoenc->encoder = NULL;
+  }
+
+  if(shvideoenc->ainfo.ceu)
+  {
+    sh_ceu_stop_capturing(shvideoenc->ainfo.ceu);
+    sh_ceu_close(shvideoenc->ainfo.ceu);
+    shvideoenc->ainfo.ceu = NULL;
+  }
+
+  gst_shvideo_enc_flush_frames(shvideoenc);
+
+  shvideoenc->stop_encoder = FALSE;
+  shvideoenc->eos = FALSE;
+  shvideoenc->encoder_done = FALSE;
+  shvideoenc->eos_sent = FALSE;
+  shvideoenc->caps_set = FALSE;
+}
+
+static gboolean
+gst_shvideo_enc_queue_frame(GstshvideoEnc *enc, GstshvideoEncFrame *frame)
+{
+  GstClockTime wait_start = GST_CLOCK_TIME_NONE;
+
+  /* If the queue is full we'll have to 
+     wait until encoder has consumed data */
+  if(gst_shvideo_ring_is_full(enc->ring, 0))
+  {
+    wait_start = gst_util_get_timestamp();
+  }
+
+  // Closed when the encoder finishes or is stopped
+  if(!gst_shvideo_ring_push(enc->ring, frame, 0))
+  {
+    return FALSE;
+  }
+
+  if(GST_CLOCK_TIME_IS_VALID(wait_start))
+  {
+    gst_shvideo_enc_stats_queue_wait(enc, wait_start);
+  }
+  pthread_mutex_lock(&enc->stats_mutex);
+  enc->frames_in++;
+  pthread_mutex_unlock(&enc->stats_mutex);
+
+  return TRUE;
+}
+
+static void
+gst_shvideo_enc_flush_frames(GstshvideoEnc *enc)
+{
+  GstshvideoEncFrame frame;
+
+  while(gst_shvideo_ring_try_pop(enc->ring, &frame))
+  {
+    gst_buffer_unref(frame.buffer_yuv);
+    gst_buffer_unref(frame.buffer_cbcr);
+  }
+  gst_shvideo_ring_reset(enc->ring);
+}
+
+static void
+gst_shvideo_enc_drain(GstshvideoEnc *enc)
+{
+  GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
+
+  // Also without an encoder, the data after the end is refused
+  if(!enc->enc_thread)
+  {
+    enc->eos = TRUE;
+    return;
+  }
+
+  // The encoder takes the pending frame and then sees the end of input
+  pthread_mutex_lock(&enc->mutex);
+  enc->eos = TRUE;
+  pthread_cond_broadcast(&enc->thread_condition);
+  pthread_mutex_unlock(&enc->mutex);
+  gst_shvideo_ring_close(enc->ring);
+
+  pthread_join(enc->enc_thread, NULL);
+  enc->enc_thread = 0;
+
+  GST_DEBUG_OBJECT(enc,"Encoder drained, %lld frames out",
+		   (long long) enc->frames_out);
+}
+
+static gboolean
+gst_shvideo_enc_push_eos(GstshvideoEnc *enc, GstEvent *event)
+{
+  if(enc->eos_sent)
+  {
+    if(event)
+    {
+      gst_event_unref(event);
+    }
+    return TRUE;
+  }
+
+  enc->eos_sent = TRUE;
+  return gst_pad_push_event(enc->srcpad,
+			    event ? event : gst_event_new_eos ());
 }
 
 void *
@@ -692,18 +1480,31 @@ launch_encoder_thread(void *data)
 
   GST_LOG_OBJECT(enc,"%s called",__FUNCTION__);
 
+  // The thread is private and ends with the encoder, nothing to restore
+  ret = gst_shvideo_sched_apply(&enc->sched, NULL);
+  if(ret)
+  {
+    GST_WARNING_OBJECT(enc,"Cannot set the scheduling of the encoder thread: %s",
+		       g_strerror(ret));
+  }
+
   ret = shcodecs_encoder_run(enc->encoder);
 
   GST_DEBUG_OBJECT (enc,"shcodecs_encoder_run returned %d\n",ret);
 
-  // We can stop waiting if encoding has ended
-  pthread_mutex_lock( &enc->cond_mutex );
-  pthread_cond_signal( &enc->thread_condition);
-  pthread_mutex_unlock( &enc->cond_mutex );
+  /* All the output has been written, the EOS is pushed by 
+     the streaming thread once it has joined this thread */
+  pthread_mutex_lock(&enc->mutex);
+  enc->encoder_done = TRUE;
+  pthread_cond_broadcast(&enc->thread_condition);
+  pthread_mutex_unlock(&enc->mutex);
+  gst_shvideo_ring_close(enc->ring);
 
-  // Calling stop task won't do any harm if we are in push mode
-  gst_pad_stop_task (enc->sinkpad);
-  gst_pad_push_event(enc->srcpad,gst_event_new_eos ());
+  // When capturing this thread is the streaming thread
+  if(enc->ainfo.ceu && !enc->stop_encoder)
+  {
+    gst_shvideo_enc_push_eos(enc,NULL);
+  }
 
   return NULL;
 }
@@ -712,31 +1513,67 @@ static int
 gst_shvideo_enc_get_input(SHCodecs_Encoder * encoder, void *user_data)
 {
   GstshvideoEnc *shvideoenc = (GstshvideoEnc *)user_data;
+  GstshvideoEncFrame frame;
   gint ret=0;
 
   GST_LOG_OBJECT(shvideoenc,"%s called",__FUNCTION__);
 
-  // Lock mutex while reading the buffer  
-  pthread_mutex_lock(&shvideoenc->mutex); 
-  if(shvideoenc->buffer_yuv && shvideoenc->buffer_cbcr)
+  if(shvideoenc->ainfo.ceu)
   {
+    pthread_mutex_lock(&shvideoenc->mutex); 
+    while(shvideoenc->ceu_paused && !shvideoenc->eos && 
+	  !shvideoenc->stop_encoder)
+    {
+      pthread_cond_wait(&shvideoenc->thread_condition, &shvideoenc->mutex);
+    }
+    if(shvideoenc->eos || shvideoenc->stop_encoder)
+    {
+      pthread_mutex_unlock(&shvideoenc->mutex);
+      GST_DEBUG_OBJECT(shvideoenc,"End of capture");
+      return 1;
+    }
+    pthread_mutex_unlock(&shvideoenc->mutex);
+
+    sh_ceu_capture_frame(shvideoenc->ainfo.ceu, gst_shvideo_enc_ceu_frame,
+			 shvideoenc);
+    return 0;
+  }
+
+  // Wait for the next frame, the queue is closed at the end of the stream
+  if(gst_shvideo_ring_pop(shvideoenc->ring, &frame))
+  {
+    shvideoenc->frame_timestamp = frame.timestamp;
+    shvideoenc->frame_duration = frame.duration;
+
+    /* Variable frame rate: advance the time base by the frame duration */
+    if(!shvideoenc->fps_numerator &&
+       GST_CLOCK_TIME_IS_VALID(shvideoenc->frame_duration))
+    {
+      shcodecs_encoder_set_frame_no_increment(encoder,
+	MAX(1, gst_util_uint64_scale(shvideoenc->frame_duration + GST_SECOND / 
+				     shcodecs_encoder_get_frame_num_resolution(encoder) / 2,
+				     shcodecs_encoder_get_frame_num_resolution(encoder),
+				     GST_SECOND)));
+    }
+
     ret = shcodecs_encoder_input_provide(encoder, 
-					 GST_BUFFER_DATA(shvideoenc->buffer_yuv),
-					 GST_BUFFER_DATA(shvideoenc->buffer_cbcr));
+					 GST_BUFFER_DATA(frame.buffer_yuv),
+					 GST_BUFFER_DATA(frame.buffer_cbcr));
 
-    gst_buffer_unref(shvideoenc->buffer_yuv);
-    shvideoenc->buffer_yuv = NULL;
-    gst_buffer_unref(shvideoenc->buffer_cbcr);
-    shvideoenc->buffer_cbcr = NULL;  
+    gst_buffer_unref(frame.buffer_yuv);
+    gst_buffer_unref(frame.buffer_cbcr);
 
-    // Signal the main thread that buffers are read
-    pthread_mutex_lock( &shvideoenc->cond_mutex );
-    pthread_cond_signal( &shvideoenc->thread_condition);
-    pthread_mutex_unlock( &shvideoenc->cond_mutex );
+    gst_shvideo_enc_stats_input(shvideoenc);
+  }
+  else
+  {
+    /* No more input, the encoder finishes 
+       the frames it has and returns */
+    GST_DEBUG_OBJECT(shvideoenc,"End of input");
+    ret = 1;
   }
-  pthread_mutex_unlock(&shvideoenc->mutex);
 
-  return 0;
+  return ret;
 }
 
 static int 
@@ -751,13 +1588,47 @@ gst_shvideo_enc_write_output(SHCodecs_Encoder * encoder,
 
   if(length)
   {
+    // A picture may come in several calls, they share its timestamp
+    if(gst_shvideo_enc_stats_output(enc, length))
+    {
+      enc->frame_number++;
+    }
+
     buf = gst_buffer_new();
     gst_buffer_set_data(buf, data, length);
+    GST_SHVIDEO_COPY_STATS_ADD(enc, enc->copy_stats, 0, 1);
+    gst_buffer_set_caps(buf, GST_PAD_CAPS(enc->srcpad));
 
-    GST_BUFFER_DURATION(buf) = enc->fps_denominator*1000*GST_MSECOND/enc->fps_numerator;
-    GST_BUFFER_TIMESTAMP(buf) = enc->frame_number*GST_BUFFER_DURATION(buf);
-    enc->frame_number++;
+    if(GST_CLOCK_TIME_IS_VALID(enc->frame_duration))
+    {
+      GST_BUFFER_DURATION(buf) = enc->frame_duration;
+    }
+    else if(enc->fps_numerator)
+    {
+      GST_BUFFER_DURATION(buf) = gst_util_uint64_scale_int(GST_SECOND,
+							   enc->fps_denominator,
+							   enc->fps_numerator);
+    }
+    else
+    {
+      GST_BUFFER_DURATION(buf) = GST_CLOCK_TIME_NONE;
+    }
 
+    if(GST_CLOCK_TIME_IS_VALID(enc->frame_timestamp))
+    {
+      GST_BUFFER_TIMESTAMP(buf) = enc->frame_timestamp;
+    }
+    else if(enc->fps_numerator)
+    {
+      // Data before the first picture, e.g. a header, goes with it
+      GST_BUFFER_TIMESTAMP(buf) =
+	gst_util_uint64_scale_int(MAX(enc->frame_number - 1, 0) * GST_SECOND,
+				  enc->fps_denominator, enc->fps_numerator);
+    }
+    else
+    {
+      GST_BUFFER_TIMESTAMP(buf) = GST_CLOCK_TIME_NONE;
+    }
     ret = gst_pad_push (enc->srcpad, buf);
 
     if (ret != GST_FLOW_OK) {
@@ -768,6 +1639,177 @@ gst_shvideo_enc_write_output(SHCodecs_Encoder * encoder,
   return 0;
 }
 
+static void
+gst_shvideo_enc_stats_queue_wait(GstshvideoEnc *enc, GstClockTime wait_start)
+{
+  pthread_mutex_lock(&enc->stats_mutex);
+  enc->queue_wait_total += gst_util_get_timestamp() - wait_start;
+  enc->queue_waits++;
+  pthread_mutex_unlock(&enc->stats_mutex);
+}
+
+static void
+gst_shvideo_enc_stats_input(GstshvideoEnc *enc)
+{
+  pthread_mutex_lock(&enc->stats_mutex);
+  /* The hardware asks for the next frame only after it has finished
+     the previous one, so a frame still without output was skipped */
+  if(enc->output_pending)
+  {
+    enc->frames_skipped++;
+  }
+  enc->output_pending = TRUE;
+  enc->input_time = gst_util_get_timestamp();
+  pthread_mutex_unlock(&enc->stats_mutex);
+}
+
+static void
+gst_shvideo_enc_stats_reset(GstshvideoEnc *enc)
+{
+  pthread_mutex_lock(&enc->stats_mutex);
+  enc->frames_in = 0;
+  enc->frames_out = 0;
+  enc->frames_skipped = 0;
+  enc->bytes_out = 0;
+  enc->picture_bytes = 0;
+  enc->output_pending = FALSE;
+  enc->input_time = GST_CLOCK_TIME_NONE;
+  enc->latency_count = 0;
+  enc->latency_frames = 0;
+  enc->latency_total = 0;
+  enc->queue_wait_total = 0;
+  enc->queue_waits = 0;
+  enc->bitrate = 0;
+  enc->bitrate_avg = 0;
+  enc->window_bytes = 0;
+  enc->window_start = GST_CLOCK_TIME_NONE;
+  enc->stats_posted = GST_CLOCK_TIME_NONE;
+  pthread_mutex_unlock(&enc->stats_mutex);
+}
+
+static gboolean
+gst_shvideo_enc_stats_output(GstshvideoEnc *enc, gint length)
+{
+  GstClockTime now, latency;
+  GstStructure *structure = NULL;
+  gboolean new_picture;
+
+  now = gst_util_get_timestamp();
+
+  pthread_mutex_lock(&enc->stats_mutex);
+  enc->bytes_out += length;
+
+  // The first output after an input starts the picture of that input
+  new_picture = enc->output_pending;
+  if(new_picture)
+  {
+    latency = now - enc->input_time;
+    enc->latency[enc->latency_count % SHVIDEOENC_STATS_WINDOW] = latency;
+    enc->latency_count++;
+    enc->latency_frames++;
+    enc->latency_total += latency;
+    enc->output_pending = FALSE;
+    enc->frames_out++;
+    enc->picture_bytes = 0;
+  }
+  enc->picture_bytes += length;
+
+  if(GST_CLOCK_TIME_IS_VALID(enc->frame_duration) && enc->frame_duration)
+  {
+    enc->bitrate = (guint) gst_util_uint64_scale(enc->picture_bytes * 8,
+						  GST_SECOND,
+						  enc->frame_duration);
+  }
+  else if(enc->fps_denominator)
+  {
+    enc->bitrate = (guint) gst_util_uint64_scale_int(enc->picture_bytes * 8, 
+						      enc->fps_numerator,
+						      enc->fps_denominator);
+  }
+
+  if(!GST_CLOCK_TIME_IS_VALID(enc->window_start))
+  {
+    enc->window_start = now;
+  }
+  enc->window_bytes += length;
+  if(now - enc->window_start >= GST_SECOND)
+  {
+    enc->bitrate_avg = (guint) gst_util_uint64_scale(enc->window_bytes * 8,
+						      GST_SECOND,
+						      now - enc->window_start);
+    enc->window_bytes = 0;
+    enc->window_start = now;
+  }
+  pthread_mutex_unlock(&enc->stats_mutex);
+
+  if(enc->stats_interval)
+  {
+    if(!GST_CLOCK_TIME_IS_VALID(enc->stats_posted) ||
+       now - enc->stats_posted >= enc->stats_interval)
+    {
+      enc->stats_posted = now;
+      structure = gst_shvideo_enc_stats_structure(enc);
+      gst_element_post_message((GstElement*)enc,
+			       gst_message_new_element((GstObject*)enc,
+						       structure));
+    }
+  }
+
+  return new_picture;
+}
+
+static int
+gst_shvideo_enc_compare_latency(const void *a, const void *b)
+{
+  GstClockTime la = *(const GstClockTime *)a;
+  GstClockTime lb = *(const GstClockTime *)b;
+
+  return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static GstClockTime
+gst_shvideo_enc_stats_latency_p99(GstshvideoEnc *enc)
+{
+  GstClockTime sorted[SHVIDEOENC_STATS_WINDOW];
+  guint count;
+
+  count = MIN(enc->latency_count, SHVIDEOENC_STATS_WINDOW);
+  if(!count)
+  {
+    return 0;
+  }
+
+  memcpy(sorted, enc->latency, count * sizeof(GstClockTime));
+  qsort(sorted, count, sizeof(GstClockTime), gst_shvideo_enc_compare_latency);
+
+  return sorted[(count * 99) / 100];
+}
+
+static GstStructure *
+gst_shvideo_enc_stats_structure(GstshvideoEnc *enc)
+{
+  GstStructure *structure;
+
+  pthread_mutex_lock(&enc->stats_mutex);
+  structure = gst_structure_new("shvideoenc-stats",
+    "frames-in", G_TYPE_UINT64, enc->frames_in,
+    "frames-out", G_TYPE_UINT64, enc->frames_out,
+    "frames-skipped", G_TYPE_UINT64, enc->frames_skipped,
+    "bytes-out", G_TYPE_UINT64, enc->bytes_out,
+    "latency-avg", G_TYPE_UINT64, enc->latency_frames ?
+      GST_TIME_AS_USECONDS(enc->latency_total / enc->latency_frames) : 0,
+    "latency-p99", G_TYPE_UINT64,
+      GST_TIME_AS_USECONDS(gst_shvideo_enc_stats_latency_p99(enc)),
+    "bitrate", G_TYPE_UINT, enc->bitrate,
+    "bitrate-avg", G_TYPE_UINT, enc->bitrate_avg,
+    "queue-wait-avg", G_TYPE_UINT64, enc->queue_waits ?
+      GST_TIME_AS_USECONDS(enc->queue_wait_total / enc->queue_waits) : 0,
+    NULL);
+  pthread_mutex_unlock(&enc->stats_mutex);
+
+  return structure;
+}
+
 static gboolean
 gst_shvideo_enc_src_query (GstPad * pad, GstQuery * query)
 {
@@ -29,6 +29,9 @@
 #include <pthread.h>
 
 #include "cntlfile/ControlFileUtil.h"
+#include "gstshvideocopystats.h"
+#include "gstshvideoring.h"
+#include "gstshvideosched.h"
 
 G_BEGIN_DECLS
 #define GST_TYPE_SHVIDEOENC \
@@ -44,6 +47,39 @@ G_BEGIN_DECLS
 typedef struct _GstshvideoEnc GstshvideoEnc;
 typedef struct _GstshvideoEncClass GstshvideoEncClass;
 
+/**
+ * Number of latency samples kept for the percentile calculation
+ */
+
+#define SHVIDEOENC_STATS_WINDOW 1024
+
+/**
+ * Number of frames queued to the encoder thread. The next frame is
+ * prepared while the encoder is still working with the previous one
+ */
+
+#define SHVIDEOENC_INPUT_FRAMES 1
+
+/**
+ * A frame queued to the encoder thread
+ */
+
+typedef struct _GstshvideoEncFrame GstshvideoEncFrame;
+
+struct _GstshvideoEncFrame
+{
+  GstBuffer *buffer_yuv;
+  GstBuffer *buffer_cbcr;
+  GstClockTime timestamp;
+  GstClockTime duration;
+};
+
+/**
+ * Largest time base the MPEG-4 VOP time increment can express
+ */
+
+#define SHVIDEOENC_MAX_FRAME_NUM_RESOLUTION 65535
+
 /**
  * Define Gstreamer SH Video Encoder structure
  */
@@ -52,8 +88,9 @@ struct _GstshvideoEnc
 {
   GstElement element;
   GstPad *sinkpad, *srcpad;
-  GstBuffer *buffer_yuv;
-  GstBuffer *buffer_cbcr;
+
+  /* Frames queued to the encoder thread */
+  GstshvideoRing *ring;
 
   gint offset;
   SHCodecs_Format format;  
@@ -67,13 +104,51 @@ struct _GstshvideoEnc
   
   GstCaps* out_caps;
   gboolean caps_set;
+  gboolean stop_encoder;
+  gboolean eos;
+  gboolean encoder_done;
+  gboolean eos_sent;
   glong frame_number;
+
+  /* Direct capture from the CEU in the input callback */
+  gchar *ceu_device;
+  gboolean ceu_paused;
+
+  /* Scheduling of the encoder thread */
+  GstshvideoSched sched;
+
   GstClockTime timestamp_offset;
+  GstClockTime frame_timestamp;
+  GstClockTime frame_duration;
 
   pthread_t enc_thread;
   pthread_mutex_t mutex;
-  pthread_mutex_t cond_mutex;
   pthread_cond_t  thread_condition;
+
+  /* Statistics */
+  pthread_mutex_t stats_mutex;
+  guint64 frames_in;
+  guint64 frames_out;
+  guint64 frames_skipped;
+  guint64 bytes_out;
+  guint64 picture_bytes;
+  gboolean output_pending;
+  GstClockTime input_time;
+  GstClockTime latency[SHVIDEOENC_STATS_WINDOW];
+  guint latency_count;
+  guint64 latency_frames;
+  GstClockTime latency_total;
+  GstClockTime queue_wait_total;
+  guint64 queue_waits;
+  guint bitrate;
+  guint bitrate_avg;
+  guint64 window_bytes;
+  GstClockTime window_start;
+  GstClockTime stats_interval;
+  GstClockTime stats_posted;
+#ifdef SHVIDEO_COPY_STATS
+  GstshvideoCopyStats copy_stats;
+#endif
 };
 
 /**
@@ -116,6 +191,16 @@ static void gst_shvideo_enc_dispose (GObject * object);
 
 static void gst_shvideo_enc_class_init (GstshvideoEncClass *klass);
 
+/** Stops the encoder when the element goes to the READY state so
+    that the element can be used for the next stream
+    @param element Gstreamer SH video encoder
+    @param transition The state transition
+    @return the result of the state change
+*/
+
+static GstStateChangeReturn
+gst_shvideo_enc_change_state (GstElement *element, GstStateChange transition);
+
 /** Initialize the encoder
     @param shvideoenc Gstreamer SH video element
     @param gklass Gstreamer SH video encode class
@@ -124,7 +209,8 @@ static void gst_shvideo_enc_class_init (GstshvideoEncClass *klass);
 static void gst_shvideo_enc_init (GstshvideoEnc *shvideoenc,
 				  GstshvideoEncClass *gklass);
 
-/** Event handler for encoder sink events
+/** Event handler for encoder sink events. EOS is forwarded only
+    after the encoder has been drained
     @param pad Gstreamer sink pad
     @param event The Gstreamer event
     @return returns true if the event can be handled, else false
@@ -140,6 +226,30 @@ static gboolean gst_shvideo_enc_sink_event (GstPad * pad, GstEvent * event);
 
 static gboolean gst_shvideoenc_setcaps (GstPad * pad, GstCaps * caps);
 
+/** Returns the caps the encoder sink pad accepts: the template caps limited
+    to the sizes and frame rates accepted by the peer of the source pad
+    @param pad Gstreamer sink pad
+    @return the caps, the caller owns the reference
+*/
+
+static GstCaps *gst_shvideoenc_sink_getcaps (GstPad * pad);
+
+/** Checks that the caps can be encoded and the result linked downstream
+    @param pad Gstreamer sink pad
+    @param caps The capabilities of the data to encode
+    @return returns true if the caps are accepted, else false
+*/
+
+static gboolean gst_shvideoenc_sink_acceptcaps (GstPad * pad, GstCaps * caps);
+
+/** Returns the caps the encoder source pad can produce. Size and frame
+    rate are fixed to the ones of the sink pad once known
+    @param pad Gstreamer source pad
+    @return the caps, the caller owns the reference
+*/
+
+static GstCaps *gst_shvideoenc_src_getcaps (GstPad * pad);
+
 /** Initialize the encoder plugin 
     @param plugin Gstreamer plugin
     @return returns true if the plugin initialized and registered gst-sh-mobile-enc, else false
@@ -197,13 +307,66 @@ static void gst_shvideo_enc_set_property (GObject *object,
 static void gst_shvideo_enc_get_property (GObject * object, guint prop_id,
 					  GValue * value, GParamSpec * pspec);
 
-/** The encoder sink event handler and calls sink pad push event
-    @param pad Gstreamer sink pad
-    @param event Event information
-    @returns Returns the value of gst_pad_push_event()
+/** Queues a frame to the encoder thread, waits while the queue is full
+    @param enc encoder object
+    @param frame the frame, the encoder thread releases its buffers
+    @return TRUE if queued, FALSE if the encoder has finished or is
+    being stopped
 */
 
-static gboolean gst_shvideo_enc_sink_event (GstPad * pad, GstEvent * event);
+static gboolean gst_shvideo_enc_queue_frame(GstshvideoEnc *enc,
+					    GstshvideoEncFrame *frame);
+
+/** Releases the frames left in the queue and opens the queue again. The
+    encoder thread must not be running
+    @param enc encoder object
+*/
+
+static void gst_shvideo_enc_flush_frames(GstshvideoEnc *enc);
+
+/** Signals the end of input to the encoder and waits until the
+    encoder has written out all the pending frames
+    @param enc encoder object
+*/
+
+static void gst_shvideo_enc_drain(GstshvideoEnc *enc);
+
+/** Pushes EOS downstream unless it has already been sent for the
+    current stream
+    @param enc encoder object
+    @param event EOS event to push, or NULL to create a new one
+    @return Returns the value of gst_pad_push_event()
+*/
+
+static gboolean gst_shvideo_enc_push_eos(GstshvideoEnc *enc, GstEvent *event);
+
+/** Handles EOS sent to the element when it captures from the CEU
+    @param element Gstreamer SH video encoder
+    @param event The Gstreamer event
+    @return returns true if the event was handled, else false
+*/
+
+static gboolean gst_shvideo_enc_send_event (GstElement *element,
+					    GstEvent *event);
+
+/** Initializes the encoder from the control file, opens the CEU and
+    launches the encoder thread that captures in the input callback
+    @param enc encoder object
+    @return TRUE if capturing started, otherwise FALSE
+*/
+
+static gboolean gst_shvideo_enc_ceu_start(GstshvideoEnc *enc);
+
+/** Capture callback giving the CEU capture memory to the encoder
+    @param ceu CEU capture device
+    @param frame_data the captured NV12 frame
+    @param length size of the frame
+    @param user_data Gstreamer SH encoder object
+*/
+
+static void gst_shvideo_enc_ceu_frame(sh_ceu *ceu,
+				      const unsigned char *frame_data,
+				      size_t length, void *user_data);
 
 /** Initializes the SH Hardware encoder
     @param shvideoenc encoder object
@@ -211,6 +374,13 @@ static gboolean gst_shvideo_enc_sink_event (GstPad * pad, GstEvent * event);
 
 void gst_shvideo_enc_init_encoder(GstshvideoEnc * shvideoenc);
 
+/** Maps the negotiated frame rate fraction to the encoder frame rate,
+    frame_num_resolution and frame_no_increment
+    @param shvideoenc encoder object
+*/
+
+void gst_shvideo_enc_set_frame_rate(GstshvideoEnc * shvideoenc);
+
 /** Gstreamer source pad query 
     @param pad Gstreamer source pad
     @param query Gsteamer query
@@ -219,7 +389,8 @@ void gst_shvideo_enc_init_encoder(GstshvideoEnc * shvideoenc);
 
 static gboolean gst_shvideo_enc_src_query (GstPad * pad, GstQuery * query);
 
-/** Reads the capabilities of the peer element behind source pad
+/** Reads the capabilities allowed by the source pad and its peer and
+    chooses the output format in the order of preference of the peer
     @param shvideoenc encoder object
 */
 
@@ -251,6 +422,66 @@ static int gst_shvideo_enc_get_input(SHCodecs_Encoder * encoder, void *user_data
 static int gst_shvideo_enc_write_output(SHCodecs_Encoder * encoder,
 					unsigned char *data, int length, void *user_data);
 
+/** Records the time the chain waited for the encoder to consume a frame
+    @param enc encoder object
+    @param wait_start the time the wait started
+*/
+
+static void gst_shvideo_enc_stats_queue_wait(GstshvideoEnc *enc,
+					     GstClockTime wait_start);
+
+/** Updates the statistics when a frame has been given to the hardware
+    @param enc encoder object
+*/
+
+static void gst_shvideo_enc_stats_input(GstshvideoEnc *enc);
+
+/** Clears the statistics for a new stream
+    @param enc encoder object
+*/
+
+static void gst_shvideo_enc_stats_reset(GstshvideoEnc *enc);
+
+/** Updates the statistics when the hardware has produced encoded data
+    and posts the statistics message if the interval has elapsed. A
+    picture may be written in several parts, it is counted once
+    @param enc encoder object
+    @param length size of the encoded data
+    @return TRUE if the data starts a new picture
+*/
+
+static gboolean gst_shvideo_enc_stats_output(GstshvideoEnc *enc, gint length);
+
+/** qsort comparison function for latency samples
+    @param a pointer to the first GstClockTime
+    @param b pointer to the second GstClockTime
+    @return negative, zero or positive like strcmp
+*/
+
+static int gst_shvideo_enc_compare_latency(const void *a, const void *b);
+
+/** Calculates the p99 encode latency of the last frames
+    @param enc encoder object, stats_mutex must be held
+    @return the latency in nanoseconds
+*/
+
+static GstClockTime gst_shvideo_enc_stats_latency_p99(GstshvideoEnc *enc);
+
+/** Creates a structure of the current statistics
+    @param enc encoder object
+    @return statistics structure to be posted in an element message
+*/
+
+static GstStructure *gst_shvideo_enc_stats_structure(GstshvideoEnc *enc);
+
+/** Stops the encoder thread after the pending frame and closes the
+    encoder so that it can be initialized again with new caps or for
+    a new stream
+    @param shvideoenc encoder object
+*/
+
+void gst_shvideo_enc_stop_encoder(GstshvideoEnc * shvideoenc);
+
 /** Launches the encoder in an own thread
     @param data encoder object
 */
@@ -0,0 +1,373 @@
+/**
+ * gst-sh-mobile access unit parser
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#include <string.h>
+
+#include "gstshvideoparse.h"
+
+typedef struct
+{
+  guint offset;
+  GstClockTime timestamp;
+} GstshvideoParseStamp;
+
+static const guint8 gst_shvideo_parse_start_code[] = { 0, 0, 0, 1 };
+
+/** Adds data after the collected data
+    @param parse The parser
+    @param data The data
+    @param size Size of the data
+*/
+
+static void
+gst_shvideo_parse_append (GstshvideoParse * parse, const guint8 * data,
+			  guint size)
+{
+  if(parse->size + size > parse->alloc)
+  {
+    parse->alloc = MAX(parse->size + size, parse->alloc * 2);
+    parse->data = g_realloc(parse->data, parse->alloc);
+  }
+
+  memcpy(parse->data + parse->size, data, size);
+  parse->size += size;
+}
+
+/** Adds NAL units with lengths, a start code replaces each length
+    @param parse The parser
+    @param data The NAL units
+    @param size Size of the data
+    @return FALSE if a length went past the end of the data
+*/
+
+static gboolean
+gst_shvideo_parse_append_nals (GstshvideoParse * parse, const guint8 * data,
+			       guint size)
+{
+  guint nal_size, i;
+
+  while(size)
+  {
+    if(size < parse->nal_length_size)
+    {
+      return FALSE;
+    }
+    for(nal_size = 0, i = 0; i < parse->nal_length_size; i++)
+    {
+      nal_size = nal_size << 8 | data[i];
+    }
+    data += parse->nal_length_size;
+    size -= parse->nal_length_size;
+
+    if(nal_size > size)
+    {
+      return FALSE;
+    }
+    gst_shvideo_parse_append(parse, gst_shvideo_parse_start_code,
+			     sizeof(gst_shvideo_parse_start_code));
+    gst_shvideo_parse_append(parse, data, nal_size);
+    data += nal_size;
+    size -= nal_size;
+  }
+  return TRUE;
+}
+
+/** Tells if a start code begins a new unit, and notes the pictures
+    @param parse The parser
+    @param code The start code, followed by at least two bytes
+    @return TRUE if the unit collected ends before the start code
+*/
+
+static gboolean
+gst_shvideo_parse_is_boundary (GstshvideoParse * parse, const guint8 * code)
+{
+  gboolean boundary;
+
+  if(parse->format == SHCodecs_Format_H264)
+  {
+    guint type = code[3] & 0x1f;
+    // first_mb_in_slice 0 is coded as the single bit 1
+    gboolean slice = type == 1 || type == 5;
+    gboolean first_slice = slice && (code[4] & 0x80);
+
+    boundary = parse->picture &&
+      (first_slice || type == 6 || type == 7 || type == 8 || type == 9 ||
+       (type >= 14 && type <= 18));
+    if(boundary)
+    {
+      parse->picture = FALSE;
+    }
+    if(slice)
+    {
+      parse->picture = TRUE;
+    }
+    return boundary;
+  }
+
+  // Nothing but the picture data follows a VOP header
+  boundary = parse->picture;
+  parse->picture = code[3] == 0xb6;
+  return boundary;
+}
+
+/** Takes the unit before end off the collected data
+    @param parse The parser
+    @param end End of the unit
+    @param unit Set to the data of the unit
+    @param size Set to the size of the unit
+    @param timestamp Set to the timestamp of the unit
+*/
+
+static void
+gst_shvideo_parse_take (GstshvideoParse * parse, guint end,
+			const guint8 ** unit, guint * size,
+			GstClockTime * timestamp)
+{
+  GstshvideoParseStamp *stamp;
+
+  /* The buffers starting inside the unit don't start a unit, their
+     timestamps are dropped */
+  *timestamp = GST_CLOCK_TIME_NONE;
+  while(parse->stamps->len)
+  {
+    stamp = &g_array_index(parse->stamps, GstshvideoParseStamp, 0);
+    if(stamp->offset >= end)
+    {
+      break;
+    }
+    if(stamp->offset <= parse->start)
+    {
+      *timestamp = stamp->timestamp;
+    }
+    g_array_remove_index(parse->stamps, 0);
+  }
+
+  *unit = parse->data + parse->start;
+  *size = end - parse->start;
+  parse->start = end;
+}
+
+void
+gst_shvideo_parse_init (GstshvideoParse * parse, SHCodecs_Format format)
+{
+  memset(parse, 0, sizeof(GstshvideoParse));
+  parse->format = format;
+  parse->stamps = g_array_new(FALSE, FALSE, sizeof(GstshvideoParseStamp));
+}
+
+void
+gst_shvideo_parse_clear (GstshvideoParse * parse)
+{
+  g_free(parse->data);
+  g_free(parse->header);
+  if(parse->stamps)
+  {
+    g_array_free(parse->stamps, TRUE);
+  }
+  memset(parse, 0, sizeof(GstshvideoParse));
+}
+
+gboolean
+gst_shvideo_parse_set_codec_data (GstshvideoParse * parse,
+				  const guint8 * data, guint size)
+{
+  guint8 *header;
+  guint header_size = 0, count, nal_size, pos, set, i;
+
+  g_free(parse->header);
+  parse->header = NULL;
+  parse->header_size = 0;
+  parse->header_pending = FALSE;
+  parse->nal_length_size = 0;
+
+  if(!size)
+  {
+    return TRUE;
+  }
+
+  // Already with start codes, e.g. the VOL of MPEG-4
+  if(parse->format != SHCodecs_Format_H264 || data[0] != 1)
+  {
+    parse->header = g_memdup(data, size);
+    parse->header_size = size;
+    parse->header_pending = TRUE;
+    return TRUE;
+  }
+
+  // avcC: version, profile, compatibility, level, length size, SPS count
+  if(size < 7 || (data[4] & 3) == 2)
+  {
+    return FALSE;
+  }
+
+  // A start code takes at most twice the place of a 2 byte length
+  header = g_malloc(size * 2);
+  count = data[5] & 0x1f;
+  pos = 6;
+  for(set = 0; set < 2; set++)
+  {
+    for(i = 0; i < count; i++)
+    {
+      if(pos + 2 > size)
+      {
+	goto invalid;
+      }
+      nal_size = data[pos] << 8 | data[pos + 1];
+      pos += 2;
+      if(pos + nal_size > size)
+      {
+	goto invalid;
+      }
+      memcpy(header + header_size, gst_shvideo_parse_start_code,
+	     sizeof(gst_shvideo_parse_start_code));
+      header_size += sizeof(gst_shvideo_parse_start_code);
+      memcpy(header + header_size, data + pos, nal_size);
+      header_size += nal_size;
+      pos += nal_size;
+    }
+
+    // The PPS count follows the SPSs
+    if(!set)
+    {
+      if(pos >= size)
+      {
+	goto invalid;
+      }
+      count = data[pos++];
+    }
+  }
+
+  parse->nal_length_size = (data[4] & 3) + 1;
+  parse->header = header;
+  parse->header_size = header_size;
+  parse->header_pending = TRUE;
+  return TRUE;
+
+ invalid:
+  g_free(header);
+  return FALSE;
+}
+
+void
+gst_shvideo_parse_reset (GstshvideoParse * parse)
+{
+  parse->header_pending = parse->header != NULL;
+  parse->size = 0;
+  parse->start = 0;
+  parse->scan = 0;
+  parse->picture = FALSE;
+  g_array_set_size(parse->stamps, 0);
+}
+
+gboolean
+gst_shvideo_parse_push (GstshvideoParse * parse, const guint8 * data,
+			guint size, GstClockTime timestamp)
+{
+  GstshvideoParseStamp stamp;
+  guint i;
+
+  // The units given are dropped only now, they were valid until here
+  if(parse->start)
+  {
+    parse->size -= parse->start;
+    parse->scan -= parse->start;
+    memmove(parse->data, parse->data + parse->start, parse->size);
+    for(i = 0; i < parse->stamps->len; i++)
+    {
+      g_array_index(parse->stamps, GstshvideoParseStamp, i).offset -=
+	parse->start;
+    }
+    parse->start = 0;
+  }
+
+  // The headers start the unit of the input
+  if(GST_CLOCK_TIME_IS_VALID(timestamp))
+  {
+    stamp.offset = parse->size;
+    stamp.timestamp = timestamp;
+    g_array_append_val(parse->stamps, stamp);
+  }
+
+  if(parse->header_pending)
+  {
+    gst_shvideo_parse_append(parse, parse->header, parse->header_size);
+    parse->header_pending = FALSE;
+  }
+
+  if(parse->nal_length_size)
+  {
+    return gst_shvideo_parse_append_nals(parse, data, size);
+  }
+  gst_shvideo_parse_append(parse, data, size);
+  return TRUE;
+}
+
+gboolean
+gst_shvideo_parse_pop (GstshvideoParse * parse, const guint8 ** unit,
+		       guint * size, GstClockTime * timestamp)
+{
+  const guint8 *data = parse->data;
+  guint i;
+
+  // A start code and the two bytes telling the type of the unit
+  for(i = MAX(parse->scan, parse->start); i + 5 <= parse->size; i++)
+  {
+    if(data[i + 2] > 1)
+    {
+      i += 2;
+      continue;
+    }
+    if(data[i] || data[i + 1] || data[i + 2] != 1)
+    {
+      continue;
+    }
+
+    // The start code already counts for the new unit
+    if(gst_shvideo_parse_is_boundary(parse, data + i))
+    {
+      parse->scan = i + 3;
+      // The zero byte of a four byte start code goes with the next unit
+      if(i > parse->start && !data[i - 1])
+      {
+	i--;
+      }
+      gst_shvideo_parse_take(parse, i, unit, size, timestamp);
+      return TRUE;
+    }
+    i += 2;
+  }
+
+  parse->scan = i;
+  return FALSE;
+}
+
+gboolean
+gst_shvideo_parse_drain (GstshvideoParse * parse, const guint8 ** unit,
+			 guint * size, GstClockTime * timestamp)
+{
+  if(parse->start == parse->size)
+  {
+    return FALSE;
+  }
+
+  gst_shvideo_parse_take(parse, parse->size, unit, size, timestamp);
+  parse->scan = parse->size;
+  parse->picture = FALSE;
+  return TRUE;
+}
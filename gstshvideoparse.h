@@ -0,0 +1,144 @@
+/**
+ * gst-sh-mobile access unit parser
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOPARSE_H
+#define  GSTSHVIDEOPARSE_H
+
+#include <gst/gst.h>
+#include <shcodecs/shcodecs_decoder.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Splits an H.264 byte stream or an MPEG-4 elementary stream into access
+ * units, the data of one picture. The input buffers are collected and a
+ * unit is given when the start code of the next one is found, so a unit
+ * may span buffers and a buffer may hold many units.
+ *
+ * An H.264 unit ends before an access unit delimiter, SEI, SPS, PPS or a
+ * slice with first_mb_in_slice 0 following a slice. An MPEG-4 unit ends
+ * at the first start code after a VOP.
+ *
+ * A unit gets the timestamp of the input buffer starting at or before it
+ * and not given to an earlier unit, else GST_CLOCK_TIME_NONE.
+ *
+ * H.264 from MP4 or Matroska has the length of each NAL unit before it
+ * instead of a start code, and the SPS and PPS in the codec_data of the
+ * caps. With the codec_data set, the lengths are changed to start codes
+ * as the input is collected. The parameter sets, or the headers in the
+ * codec_data of other streams, go before the first input and again after
+ * a reset.
+ */
+
+typedef struct _GstshvideoParse GstshvideoParse;
+
+struct _GstshvideoParse
+{
+  SHCodecs_Format format;
+
+  /* Collected input, the units given are before start */
+  guint8 *data;
+  guint alloc;
+  guint size;
+  guint start;
+
+  /* Where the search for the end of the unit goes on */
+  guint scan;
+  /* The unit has a slice or a VOP */
+  gboolean picture;
+
+  /* Offsets and timestamps of the input buffers */
+  GArray *stamps;
+
+  /* Bytes of the NAL unit lengths, 0 for a byte stream */
+  guint nal_length_size;
+  /* Headers from the codec_data, with start codes */
+  guint8 *header;
+  guint header_size;
+  gboolean header_pending;
+};
+
+/** Sets up an empty parser
+    @param parse The parser
+    @param format Format of the stream
+*/
+
+void gst_shvideo_parse_init (GstshvideoParse * parse, SHCodecs_Format format);
+
+/** Releases the memory of the parser
+    @param parse The parser
+*/
+
+void gst_shvideo_parse_clear (GstshvideoParse * parse);
+
+/** Sets the codec_data of the caps. For H.264 in the avcC format the
+    input has NAL unit lengths from now on
+    @param parse The parser
+    @param data The codec_data
+    @param size Size of the codec_data
+    @return FALSE if the avcC codec_data is invalid
+*/
+
+gboolean gst_shvideo_parse_set_codec_data (GstshvideoParse * parse,
+					   const guint8 * data, guint size);
+
+/** Drops the collected data, e.g. for a seek
+    @param parse The parser
+*/
+
+void gst_shvideo_parse_reset (GstshvideoParse * parse);
+
+/** Adds input. The unit last given is no longer valid
+    @param parse The parser
+    @param data The input
+    @param size Size of the input
+    @param timestamp Timestamp of the input, or GST_CLOCK_TIME_NONE
+    @return FALSE if a NAL unit length went past the end of the input,
+    the rest of the input is dropped
+*/
+
+gboolean gst_shvideo_parse_push (GstshvideoParse * parse,
+				 const guint8 * data, guint size,
+				 GstClockTime timestamp);
+
+/** Gives the next complete unit. It stays valid until the next push
+    @param parse The parser
+    @param unit Set to the data of the unit
+    @param size Set to the size of the unit
+    @param timestamp Set to the timestamp of the unit
+    @return TRUE if a unit was given, FALSE if more input is needed
+*/
+
+gboolean gst_shvideo_parse_pop (GstshvideoParse * parse, const guint8 ** unit,
+				guint * size, GstClockTime * timestamp);
+
+/** Gives the rest of the data as the last unit, at the end of the stream
+    @param parse The parser
+    @param unit Set to the data of the unit
+    @param size Set to the size of the unit
+    @param timestamp Set to the timestamp of the unit
+    @return TRUE if a unit was given, FALSE if there was no data
+*/
+
+gboolean gst_shvideo_parse_drain (GstshvideoParse * parse,
+				  const guint8 ** unit, guint * size,
+				  GstClockTime * timestamp);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,225 @@
+/**
+ * gst-sh-mobile single producer, single consumer ring
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "gstshvideoring.h"
+
+#ifndef FUTEX_PRIVATE_FLAG
+#define FUTEX_WAIT_PRIVATE FUTEX_WAIT
+#define FUTEX_WAKE_PRIVATE FUTEX_WAKE
+#endif
+
+/** Tells if the ring has room for an item or is closed
+    @param ring The ring
+    @param weight Weight of the item
+    @return TRUE if a push would not wait
+*/
+
+static gboolean
+gst_shvideo_ring_can_push (GstshvideoRing * ring, guint weight)
+{
+  guint count = ring->head - (guint) g_atomic_int_get((volatile gint *) &ring->tail);
+
+  if(g_atomic_int_get(&ring->closed))
+  {
+    return TRUE;
+  }
+  if(count == ring->slots)
+  {
+    return FALSE;
+  }
+  return !ring->max_weight || !count ||
+    (guint) g_atomic_int_get(&ring->weight) + weight <= ring->max_weight;
+}
+
+/** Tells if the ring has an item or is closed
+    @param ring The ring
+    @param weight not used
+    @return TRUE if a pop would not wait
+*/
+
+static gboolean
+gst_shvideo_ring_can_pop (GstshvideoRing * ring, guint weight)
+{
+  return (guint) g_atomic_int_get((volatile gint *) &ring->head) != ring->tail ||
+    g_atomic_int_get(&ring->closed);
+}
+
+/** Sleeps until the other side wakes this one up. The flag is raised
+    before the condition is checked again, so a wake up is not lost
+    @param ring The ring
+    @param parked Futex word of this side
+    @param ready The condition waited for
+    @param weight Weight given to the condition
+*/
+
+static void
+gst_shvideo_ring_park (GstshvideoRing * ring, volatile gint * parked,
+		       gboolean (*ready) (GstshvideoRing *, guint),
+		       guint weight)
+{
+  g_atomic_int_compare_and_exchange(parked, 0, 1);
+  if(!ready(ring, weight))
+  {
+    // Returns at once if the other side cleared the flag already
+    syscall(SYS_futex, parked, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+  }
+  g_atomic_int_set(parked, 0);
+}
+
+/** Wakes up the other side if it sleeps
+    @param parked Futex word of the other side
+*/
+
+static void
+gst_shvideo_ring_unpark (volatile gint * parked)
+{
+  if(g_atomic_int_compare_and_exchange(parked, 1, 0))
+  {
+    syscall(SYS_futex, parked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+GstshvideoRing *
+gst_shvideo_ring_new (guint slots, gsize item_size, guint max_weight)
+{
+  GstshvideoRing *ring = g_new0(GstshvideoRing, 1);
+
+  ring->slots = 1;
+  while(ring->slots < slots)
+  {
+    ring->slots <<= 1;
+  }
+  ring->item_size = item_size;
+  ring->max_weight = max_weight;
+  ring->items = g_malloc(ring->slots * item_size);
+  ring->weights = g_new0(guint, ring->slots);
+
+  return ring;
+}
+
+void
+gst_shvideo_ring_free (GstshvideoRing * ring)
+{
+  g_free(ring->items);
+  g_free(ring->weights);
+  g_free(ring);
+}
+
+void
+gst_shvideo_ring_set_max_weight (GstshvideoRing * ring, guint max_weight)
+{
+  ring->max_weight = max_weight;
+}
+
+gboolean
+gst_shvideo_ring_push (GstshvideoRing * ring, gconstpointer item,
+		       guint weight)
+{
+  guint slot;
+
+  // The loop also covers the wake ups by someone else
+  while(!gst_shvideo_ring_can_push(ring, weight))
+  {
+    gst_shvideo_ring_park(ring, &ring->producer_parked,
+			  gst_shvideo_ring_can_push, weight);
+  }
+  if(g_atomic_int_get(&ring->closed))
+  {
+    return FALSE;
+  }
+
+  slot = ring->head & (ring->slots - 1);
+  memcpy(ring->items + slot * ring->item_size, item, ring->item_size);
+  ring->weights[slot] = weight;
+  g_atomic_int_add(&ring->weight, weight);
+
+  // Publishes the item, a full barrier before the flag is read
+  g_atomic_int_add((volatile gint *) &ring->head, 1);
+  gst_shvideo_ring_unpark(&ring->consumer_parked);
+
+  return TRUE;
+}
+
+gboolean
+gst_shvideo_ring_is_full (GstshvideoRing * ring, guint weight)
+{
+  return !gst_shvideo_ring_can_push(ring, weight);
+}
+
+gboolean
+gst_shvideo_ring_pop (GstshvideoRing * ring, gpointer item)
+{
+  while(!gst_shvideo_ring_can_pop(ring, 0))
+  {
+    gst_shvideo_ring_park(ring, &ring->consumer_parked,
+			  gst_shvideo_ring_can_pop, 0);
+  }
+  return gst_shvideo_ring_try_pop(ring, item);
+}
+
+gboolean
+gst_shvideo_ring_try_pop (GstshvideoRing * ring, gpointer item)
+{
+  guint slot;
+
+  if((guint) g_atomic_int_get((volatile gint *) &ring->head) == ring->tail)
+  {
+    return FALSE;
+  }
+
+  slot = ring->tail & (ring->slots - 1);
+  memcpy(item, ring->items + slot * ring->item_size, ring->item_size);
+  g_atomic_int_add(&ring->weight, -(gint) ring->weights[slot]);
+
+  // Frees the slot, a full barrier before the flag is read
+  g_atomic_int_add((volatile gint *) &ring->tail, 1);
+  gst_shvideo_ring_unpark(&ring->producer_parked);
+
+  return TRUE;
+}
+
+guint
+gst_shvideo_ring_get_weight (GstshvideoRing * ring)
+{
+  return g_atomic_int_get(&ring->weight);
+}
+
+void
+gst_shvideo_ring_close (GstshvideoRing * ring)
+{
+  g_atomic_int_compare_and_exchange(&ring->closed, 0, 1);
+  gst_shvideo_ring_unpark(&ring->producer_parked);
+  gst_shvideo_ring_unpark(&ring->consumer_parked);
+}
+
+void
+gst_shvideo_ring_reset (GstshvideoRing * ring)
+{
+  ring->head = 0;
+  ring->tail = 0;
+  ring->weight = 0;
+  ring->closed = 0;
+  ring->producer_parked = 0;
+  ring->consumer_parked = 0;
+}
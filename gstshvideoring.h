@@ -0,0 +1,141 @@
+/**
+ * gst-sh-mobile single producer, single consumer ring
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEORING_H
+#define  GSTSHVIDEORING_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Hands items from the streaming thread to the codec thread, or back.
+ * One thread pushes and one thread pops, the indexes are atomic and a
+ * side sleeps on a futex only when the ring is full or empty. The other
+ * side makes the wake up system call only when it sees it sleeping.
+ *
+ * An item may have a weight, e.g. its size in bytes. The ring is full
+ * when all the slots are used or when the weight of the queued items
+ * would go over the limit, except that one item always fits.
+ */
+
+typedef struct _GstshvideoRing GstshvideoRing;
+
+struct _GstshvideoRing
+{
+  guint8 *items;
+  guint *weights;
+  gsize item_size;
+  guint slots;
+  guint max_weight;
+
+  /* Written by the producer */
+  volatile guint head;
+  /* Written by the consumer */
+  volatile guint tail;
+  volatile gint weight;
+  volatile gint closed;
+
+  /* Futex words, 1 while the side sleeps */
+  volatile gint producer_parked;
+  volatile gint consumer_parked;
+};
+
+/** Creates a ring
+    @param slots Number of items the ring holds, rounded up to a power of 2
+    @param item_size Size of an item, the items are copied into the ring
+    @param max_weight Limit of the weight of the queued items, 0 for none
+    @return the ring
+*/
+
+GstshvideoRing *gst_shvideo_ring_new (guint slots, gsize item_size,
+				      guint max_weight);
+
+/** Frees a ring, the items still in it are not released
+    @param ring The ring
+*/
+
+void gst_shvideo_ring_free (GstshvideoRing * ring);
+
+/** Sets the limit of the weight of the queued items, the next push
+    waits for the new limit
+    @param ring The ring
+    @param max_weight The limit, 0 for none
+*/
+
+void gst_shvideo_ring_set_max_weight (GstshvideoRing * ring, guint max_weight);
+
+/** Queues an item, waits while the ring is full
+    @param ring The ring
+    @param item The item, copied into the ring
+    @param weight Weight of the item
+    @return TRUE if queued, FALSE if the ring was closed
+*/
+
+gboolean gst_shvideo_ring_push (GstshvideoRing * ring, gconstpointer item,
+				guint weight);
+
+/** Tells if pushing an item would wait. Only the producer may call this
+    @param ring The ring
+    @param weight Weight of the item
+    @return TRUE if the ring is full for the item
+*/
+
+gboolean gst_shvideo_ring_is_full (GstshvideoRing * ring, guint weight);
+
+/** Takes the oldest item, waits while the ring is empty. A closed ring
+    still gives the items queued before it was closed
+    @param ring The ring
+    @param item Filled with the item
+    @return TRUE if an item was taken, FALSE if the ring is empty and closed
+*/
+
+gboolean gst_shvideo_ring_pop (GstshvideoRing * ring, gpointer item);
+
+/** Takes the oldest item without waiting
+    @param ring The ring
+    @param item Filled with the item
+    @return TRUE if an item was taken, FALSE if the ring is empty
+*/
+
+gboolean gst_shvideo_ring_try_pop (GstshvideoRing * ring, gpointer item);
+
+/** Gives the weight of the queued items
+    @param ring The ring
+    @return the weight
+*/
+
+guint gst_shvideo_ring_get_weight (GstshvideoRing * ring);
+
+/** Closes the ring, the pushes fail and the pops fail once the ring is
+    empty. Wakes up both sides
+    @param ring The ring
+*/
+
+void gst_shvideo_ring_close (GstshvideoRing * ring);
+
+/** Empties and opens the ring. Neither side may be using the ring, the
+    caller releases the items with gst_shvideo_ring_try_pop first
+    @param ring The ring
+*/
+
+void gst_shvideo_ring_reset (GstshvideoRing * ring);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,282 @@
+/**
+ * gst-sh-mobile codec thread scheduling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "gstshvideosched.h"
+
+struct _GstshvideoSchedSaved
+{
+  int policy;
+  struct sched_param param;
+  gboolean policy_saved;
+  int nice;
+  gboolean nice_saved;
+  cpu_set_t cpus;
+  gboolean cpus_saved;
+};
+
+static const GEnumValue gst_shvideo_sched_policies[] = {
+  {GST_SHVIDEO_SCHED_OTHER, "Normal time sharing (SCHED_OTHER)", "other"},
+  {GST_SHVIDEO_SCHED_FIFO, "Real-time first in, first out (SCHED_FIFO)",
+   "fifo"},
+  {GST_SHVIDEO_SCHED_RR, "Real-time round robin (SCHED_RR)", "rr"},
+  {0, NULL, NULL}
+};
+
+GType
+gst_shvideo_sched_policy_get_type (void)
+{
+  static GType policy_type = 0;
+
+  if (!policy_type)
+  {
+    // Registered by whichever of the decoder and encoder is loaded first
+    policy_type = g_type_from_name ("GstshvideoSchedPolicy");
+    if (!policy_type)
+    {
+      policy_type = g_enum_register_static ("GstshvideoSchedPolicy",
+					    gst_shvideo_sched_policies);
+    }
+  }
+  return policy_type;
+}
+
+void
+gst_shvideo_sched_init (GstshvideoSched * sched)
+{
+  sched->policy = GST_SHVIDEO_SCHED_OTHER;
+  sched->priority = 0;
+  sched->nice = 0;
+  sched->cpu_mask = 0;
+  sched->policy_set = FALSE;
+  sched->nice_set = FALSE;
+}
+
+void
+gst_shvideo_sched_install_properties (GObjectClass * gobject_class,
+				      guint first_prop_id)
+{
+  g_object_class_install_property (gobject_class,
+      first_prop_id + GST_SHVIDEO_SCHED_PROP_POLICY,
+      g_param_spec_enum ("sched-policy", "Scheduling policy",
+			 "Scheduling policy of the codec thread",
+			 gst_shvideo_sched_policy_get_type (),
+			 GST_SHVIDEO_SCHED_OTHER,
+			 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      first_prop_id + GST_SHVIDEO_SCHED_PROP_PRIORITY,
+      g_param_spec_uint ("priority", "Real-time priority",
+			 "Real-time priority of the codec thread, 0 for the "
+			 "normal scheduling. Selects fifo with the other "
+			 "policy",
+			 0, 99, 0,
+			 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      first_prop_id + GST_SHVIDEO_SCHED_PROP_NICE,
+      g_param_spec_int ("nice", "Nice level",
+			"Nice level of the codec thread with the normal "
+			"scheduling",
+			-20, 19, 0,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+      first_prop_id + GST_SHVIDEO_SCHED_PROP_CPU_MASK,
+      g_param_spec_uint ("cpu-mask", "CPU affinity mask",
+			 "CPUs the codec thread may run on, bit 0 for "
+			 "CPU 0. 0 leaves the affinity as it is",
+			 0, G_MAXUINT, 0,
+			 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+void
+gst_shvideo_sched_set_property (GstshvideoSched * sched, guint offset,
+				const GValue * value)
+{
+  switch (offset)
+  {
+    case GST_SHVIDEO_SCHED_PROP_POLICY:
+    {
+      sched->policy = g_value_get_enum (value);
+      sched->policy_set = TRUE;
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_PRIORITY:
+    {
+      sched->priority = g_value_get_uint (value);
+      sched->policy_set = TRUE;
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_NICE:
+    {
+      sched->nice = g_value_get_int (value);
+      sched->nice_set = TRUE;
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_CPU_MASK:
+    {
+      sched->cpu_mask = g_value_get_uint (value);
+      break;
+    }
+    default:
+    {
+      break;
+    }
+  }
+}
+
+void
+gst_shvideo_sched_get_property (const GstshvideoSched * sched, guint offset,
+				GValue * value)
+{
+  switch (offset)
+  {
+    case GST_SHVIDEO_SCHED_PROP_POLICY:
+    {
+      g_value_set_enum (value, sched->policy);
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_PRIORITY:
+    {
+      g_value_set_uint (value, sched->priority);
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_NICE:
+    {
+      g_value_set_int (value, sched->nice);
+      break;
+    }
+    case GST_SHVIDEO_SCHED_PROP_CPU_MASK:
+    {
+      g_value_set_uint (value, sched->cpu_mask);
+      break;
+    }
+    default:
+    {
+      break;
+    }
+  }
+}
+
+int
+gst_shvideo_sched_apply (const GstshvideoSched * sched,
+			 GstshvideoSchedSaved ** saved)
+{
+  struct sched_param param;
+  cpu_set_t cpus;
+  int policy, cpu, err, ret = 0;
+
+  if (saved)
+  {
+    *saved = g_new0 (GstshvideoSchedSaved, 1);
+    (*saved)->policy_saved = sched->policy_set &&
+      !pthread_getschedparam(pthread_self(), &(*saved)->policy,
+			     &(*saved)->param);
+    if (sched->nice_set)
+    {
+      // -1 is also a valid level, errno tells the failure
+      errno = 0;
+      (*saved)->nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+      (*saved)->nice_saved = !errno;
+    }
+    (*saved)->cpus_saved = sched->cpu_mask &&
+      !pthread_getaffinity_np(pthread_self(), sizeof((*saved)->cpus),
+			      &(*saved)->cpus);
+  }
+
+  switch (sched->policy)
+  {
+    case GST_SHVIDEO_SCHED_FIFO:
+      policy = SCHED_FIFO;
+      break;
+    case GST_SHVIDEO_SCHED_RR:
+      policy = SCHED_RR;
+      break;
+    default:
+      policy = sched->priority ? SCHED_FIFO : SCHED_OTHER;
+      break;
+  }
+
+  // Else the thread keeps the policy it inherited
+  if (sched->policy_set)
+  {
+    // The real-time policies need a priority of at least 1
+    param.sched_priority = policy == SCHED_OTHER ? 0 :
+      MAX(1, sched->priority);
+    err = pthread_setschedparam(pthread_self(), policy, &param);
+    if (err)
+    {
+      ret = err;
+    }
+  }
+
+  if (sched->nice_set && (!sched->policy_set || policy == SCHED_OTHER) &&
+      setpriority(PRIO_PROCESS, syscall(SYS_gettid), sched->nice) && !ret)
+  {
+    ret = errno;
+  }
+
+  if (sched->cpu_mask)
+  {
+    CPU_ZERO(&cpus);
+    for (cpu = 0; cpu < 32; cpu++)
+    {
+      if (sched->cpu_mask & (1u << cpu))
+      {
+	CPU_SET(cpu, &cpus);
+      }
+    }
+    err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err && !ret)
+    {
+      ret = err;
+    }
+  }
+
+  return ret;
+}
+
+void
+gst_shvideo_sched_restore (GstshvideoSchedSaved * saved)
+{
+  if (saved->policy_saved)
+  {
+    pthread_setschedparam(pthread_self(), saved->policy, &saved->param);
+  }
+  if (saved->nice_saved)
+  {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), saved->nice);
+  }
+  if (saved->cpus_saved)
+  {
+    pthread_setaffinity_np(pthread_self(), sizeof(saved->cpus), &saved->cpus);
+  }
+  g_free (saved);
+}
@@ -0,0 +1,139 @@
+/**
+ * gst-sh-mobile codec thread scheduling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOSCHED_H
+#define  GSTSHVIDEOSCHED_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Scheduling of a codec thread: policy, real-time priority, nice level
+ * and the CPUs the thread may run on. The decoder and the encoder
+ * expose it as the sched-policy, priority, nice and cpu-mask properties
+ * and apply it when their thread starts
+ */
+
+typedef enum
+{
+  GST_SHVIDEO_SCHED_OTHER,
+  GST_SHVIDEO_SCHED_FIFO,
+  GST_SHVIDEO_SCHED_RR
+} GstshvideoSchedPolicy;
+
+typedef struct _GstshvideoSched GstshvideoSched;
+
+struct _GstshvideoSched
+{
+  GstshvideoSchedPolicy policy;
+  guint priority;
+  gint nice;
+  guint cpu_mask;
+
+  // Only what was set is changed
+  gboolean policy_set;
+  gboolean nice_set;
+};
+
+/**
+ * How a thread was scheduled before gst_shvideo_sched_apply changed it
+ */
+
+typedef struct _GstshvideoSchedSaved GstshvideoSchedSaved;
+
+/**
+ * Offsets of the properties from the first property id given to
+ * gst_shvideo_sched_install_properties
+ */
+
+enum
+{
+  GST_SHVIDEO_SCHED_PROP_POLICY,
+  GST_SHVIDEO_SCHED_PROP_PRIORITY,
+  GST_SHVIDEO_SCHED_PROP_NICE,
+  GST_SHVIDEO_SCHED_PROP_CPU_MASK,
+  GST_SHVIDEO_SCHED_PROP_COUNT
+};
+
+/** Gives the type of the policy property. The type is shared by the
+    decoder and the encoder plugins
+    @return the enum type
+*/
+
+GType gst_shvideo_sched_policy_get_type (void);
+
+/** Sets the defaults, the thread is left as it was created
+    @param sched The scheduling
+*/
+
+void gst_shvideo_sched_init (GstshvideoSched * sched);
+
+/** Installs the sched-policy, priority, nice and cpu-mask properties
+    @param gobject_class Class of the element
+    @param first_prop_id Id of the sched-policy property, the others
+    follow it
+*/
+
+void gst_shvideo_sched_install_properties (GObjectClass * gobject_class,
+					   guint first_prop_id);
+
+/** Sets one of the scheduling properties
+    @param sched The scheduling
+    @param offset Offset of the property from the first property id
+    @param value The value
+*/
+
+void gst_shvideo_sched_set_property (GstshvideoSched * sched, guint offset,
+				     const GValue * value);
+
+/** Gives one of the scheduling properties
+    @param sched The scheduling
+    @param offset Offset of the property from the first property id
+    @param value Set to the value
+*/
+
+void gst_shvideo_sched_get_property (const GstshvideoSched * sched,
+				     guint offset, GValue * value);
+
+/** Applies the scheduling to the calling thread. The policy is changed
+    only when the policy or the priority was set, a priority with the
+    other policy selects SCHED_FIFO. The nice level is changed only when
+    it was set and the policy is not made real-time, the CPUs only when
+    the mask is not 0
+    @param sched The scheduling
+    @param saved If not NULL, set to how the thread was scheduled before,
+    to be given to gst_shvideo_sched_restore by the same thread
+    @return 0 on success, else the errno of the first step that failed.
+    The later steps are still tried
+*/
+
+int gst_shvideo_sched_apply (const GstshvideoSched * sched,
+			     GstshvideoSchedSaved ** saved);
+
+/** Gives the calling thread back the scheduling it had before
+    gst_shvideo_sched_apply. A thread of a pool is then left as the pool
+    expects it
+    @param saved The saved scheduling, freed
+*/
+
+void gst_shvideo_sched_restore (GstshvideoSchedSaved * saved);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,409 @@
+/**
+ * gst-sh-mobile-simulcast
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/gst.h>
+
+#include "gstshvideosimulcast.h"
+
+/**
+ * Define capatibilities for the sink factory
+ */
+
+static GstStaticPadTemplate sink_factory =
+  GST_STATIC_PAD_TEMPLATE ("sink",
+			   GST_PAD_SINK,
+			   GST_PAD_ALWAYS,
+			   GST_STATIC_CAPS ("video/x-raw-yuv, "
+					    "format = (fourcc) NV12,"
+					    "width = (int) [16, 2560],"
+					    "height = (int) [16, 1920],"
+					    "framerate = (fraction) [0, 30]")
+			   );
+
+/**
+ * Define capatibilities for the source factory
+ */
+
+static GstStaticPadTemplate src_factory =
+  GST_STATIC_PAD_TEMPLATE ("src%d",
+			   GST_PAD_SRC,
+			   GST_PAD_SOMETIMES,
+			   GST_STATIC_CAPS ("video/mpeg,"
+					    "width = (int) [16, 720],"
+					    "height = (int) [16, 720],"
+					    "framerate = (fraction) [0, 30],"
+					    "mpegversion = (int) 4"
+					    "; "
+					    "video/x-h264,"
+					    "width = (int) [16, 720],"
+					    "height = (int) [16, 720],"
+					    "framerate = (fraction) [0, 30]"
+					    )
+			   );
+
+GST_DEBUG_CATEGORY_STATIC (gst_sh_mobile_debug);
+#define GST_CAT_DEFAULT gst_sh_mobile_debug
+
+static GstBinClass *parent_class = NULL;
+
+/**
+ * Define simulcast bin properties
+ */
+
+enum
+{
+  PROP_0,
+  PROP_OUTPUTS,
+  PROP_LAST
+};
+
+static void
+gst_shvideo_simulcast_init_class (gpointer g_class, gpointer data)
+{
+  parent_class = g_type_class_peek_parent (g_class);
+  gst_shvideo_simulcast_class_init ((GstshvideoSimulcastClass *) g_class);
+}
+
+GType gst_shvideo_simulcast_get_type (void)
+{
+  static GType object_type = 0;
+
+  if (object_type == 0) {
+    static const GTypeInfo object_info = {
+      sizeof (GstshvideoSimulcastClass),
+      gst_shvideo_simulcast_base_init,
+      NULL,
+      gst_shvideo_simulcast_init_class,
+      NULL,
+      NULL,
+      sizeof (GstshvideoSimulcast),
+      0,
+      (GInstanceInitFunc) gst_shvideo_simulcast_init
+    };
+
+    object_type =
+      g_type_register_static (GST_TYPE_BIN, "gst-sh-mobile-simulcast",
+			      &object_info, (GTypeFlags) 0);
+  }
+
+  return object_type;
+}
+
+static void
+gst_shvideo_simulcast_base_init (gpointer klass)
+{
+  static const GstElementDetails plugin_details =
+    GST_ELEMENT_DETAILS ("SH simulcast encoder",
+			 "Codec/Encoder/Video",
+			 "Encode one video in several sizes scaled by the SH-Mobile VEU",
+			 "gst-sh-mobile");
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+  gst_element_class_set_details (element_class, &plugin_details);
+}
+
+static void
+gst_shvideo_simulcast_class_init (GstshvideoSimulcastClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+
+  gobject_class->finalize = gst_shvideo_simulcast_finalize;
+  gobject_class->set_property = gst_shvideo_simulcast_set_property;
+  gobject_class->get_property = gst_shvideo_simulcast_get_property;
+
+  gstelement_class->change_state = gst_shvideo_simulcast_change_state;
+
+  GST_DEBUG_CATEGORY_INIT (gst_sh_mobile_debug, "gst-sh-mobile-simulcast",
+      0, "Multi-resolution encoder for the SH-Mobile VEU and VPU");
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUTS,
+      g_param_spec_string ("outputs", "Outputs",
+			   "Encoded outputs as WIDTHxHEIGHT:control_file, "
+			   "separated by commas. Each output gets a source "
+			   "pad src0, src1 and so on",
+			   NULL,
+			   G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_shvideo_simulcast_init (GstshvideoSimulcast * simulcast,
+			    GstshvideoSimulcastClass * gklass)
+{
+  GstPad *pad;
+
+  GST_LOG_OBJECT(simulcast,"%s called",__FUNCTION__);
+
+  simulcast->outputs = NULL;
+  simulcast->n_outputs = 0;
+
+  simulcast->tee = gst_element_factory_make("tee", "tee");
+  gst_bin_add(GST_BIN(simulcast), simulcast->tee);
+
+  pad = gst_element_get_static_pad(simulcast->tee, "sink");
+  simulcast->sinkpad = gst_ghost_pad_new("sink", pad);
+  gst_object_unref(pad);
+  gst_element_add_pad(GST_ELEMENT(simulcast), simulcast->sinkpad);
+}
+
+static void
+gst_shvideo_simulcast_finalize (GObject * object)
+{
+  GstshvideoSimulcast *simulcast = GST_SHVIDEOSIMULCAST (object);
+
+  g_free(simulcast->outputs);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_shvideo_simulcast_set_property (GObject * object, guint prop_id,
+				    const GValue * value, GParamSpec * pspec)
+{
+  GstshvideoSimulcast *simulcast = GST_SHVIDEOSIMULCAST (object);
+
+  switch (prop_id)
+  {
+    case PROP_OUTPUTS:
+    {
+      // The branches are linked by the time the pipeline is running
+      if(simulcast->n_outputs)
+      {
+	GST_WARNING_OBJECT(simulcast, "The outputs are already set to %s",
+			   simulcast->outputs);
+	break;
+      }
+      g_free(simulcast->outputs);
+      simulcast->outputs = g_value_dup_string(value);
+      if(simulcast->outputs &&
+	 !gst_shvideo_simulcast_build(simulcast, simulcast->outputs))
+      {
+	GST_WARNING_OBJECT(simulcast, "Only %d of the outputs %s were created",
+			   simulcast->n_outputs, simulcast->outputs);
+      }
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static void
+gst_shvideo_simulcast_get_property (GObject * object, guint prop_id,
+				    GValue * value, GParamSpec * pspec)
+{
+  GstshvideoSimulcast *simulcast = GST_SHVIDEOSIMULCAST (object);
+
+  switch (prop_id)
+  {
+    case PROP_OUTPUTS:
+    {
+      g_value_set_string(value, simulcast->outputs);
+      break;
+    }
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static gboolean
+gst_shvideo_simulcast_build (GstshvideoSimulcast * simulcast,
+			     const gchar * outputs)
+{
+  gchar **output;
+  gint width, height, n;
+  gboolean ret;
+  guint i;
+
+  output = g_strsplit(outputs, ",", 0);
+
+  for(i = 0; output[i]; i++)
+  {
+    g_strstrip(output[i]);
+    n = 0;
+    if(sscanf(output[i], "%dx%d:%n", &width, &height, &n) < 2 || !n ||
+       !output[i][n])
+    {
+      GST_WARNING_OBJECT(simulcast, "Output '%s' is not "
+			 "WIDTHxHEIGHT:control_file", output[i]);
+      break;
+    }
+    if(!gst_shvideo_simulcast_add_output(simulcast, width, height,
+					 output[i] + n))
+    {
+      break;
+    }
+  }
+
+  ret = output[i] == NULL;
+  g_strfreev(output);
+
+  return ret;
+}
+
+static gboolean
+gst_shvideo_simulcast_add_output (GstshvideoSimulcast * simulcast,
+				  gint width, gint height,
+				  const gchar * cntl_file)
+{
+  GstElement *queue, *veu, *capsfilter, *enc;
+  GstPad *pad, *teepad, *ghostpad;
+  GstCaps *caps;
+  gchar *name;
+  guint n;
+
+  n = simulcast->n_outputs;
+
+  name = g_strdup_printf("queue%d", n);
+  queue = gst_element_factory_make("queue", name);
+  g_free(name);
+  name = g_strdup_printf("veu%d", n);
+  veu = gst_element_factory_make("gst-sh-mobile-veu", name);
+  g_free(name);
+  name = g_strdup_printf("caps%d", n);
+  capsfilter = gst_element_factory_make("capsfilter", name);
+  g_free(name);
+  name = g_strdup_printf("enc%d", n);
+  enc = gst_element_factory_make("gst-sh-mobile-enc", name);
+  g_free(name);
+
+  if(!queue || !veu || !capsfilter || !enc)
+  {
+    GST_WARNING_OBJECT(simulcast, "Missing the %s element",
+		       !queue ? "queue" : !veu ? "gst-sh-mobile-veu" :
+		       !capsfilter ? "capsfilter" : "gst-sh-mobile-enc");
+    if(queue)
+      gst_object_unref(queue);
+    if(veu)
+      gst_object_unref(veu);
+    if(capsfilter)
+      gst_object_unref(capsfilter);
+    if(enc)
+      gst_object_unref(enc);
+    return FALSE;
+  }
+
+  // The VEU scales to the size the capsfilter asks for
+  caps = gst_caps_new_simple("video/x-raw-yuv",
+			     "format", GST_TYPE_FOURCC,
+			     GST_MAKE_FOURCC('N','V','1','2'),
+			     "width", G_TYPE_INT, width,
+			     "height", G_TYPE_INT, height,
+			     NULL);
+  g_object_set(capsfilter, "caps", caps, NULL);
+  gst_caps_unref(caps);
+
+  g_object_set(enc, "cntl-file", cntl_file, NULL);
+
+  gst_bin_add_many(GST_BIN(simulcast), queue, veu, capsfilter, enc, NULL);
+  if(!gst_element_link_many(queue, veu, capsfilter, enc, NULL))
+  {
+    GST_WARNING_OBJECT(simulcast, "Could not link output %d", n);
+    goto remove;
+  }
+
+  teepad = gst_element_get_request_pad(simulcast->tee, "src%d");
+  pad = gst_element_get_static_pad(queue, "sink");
+  if(GST_PAD_LINK_FAILED(gst_pad_link(teepad, pad)))
+  {
+    GST_WARNING_OBJECT(simulcast, "Could not link output %d to the tee", n);
+    gst_object_unref(pad);
+    gst_element_release_request_pad(simulcast->tee, teepad);
+    gst_object_unref(teepad);
+    goto remove;
+  }
+  gst_object_unref(pad);
+  gst_object_unref(teepad);
+
+  pad = gst_element_get_static_pad(enc, "src");
+  name = g_strdup_printf("src%d", n);
+  ghostpad = gst_ghost_pad_new(name, pad);
+  g_free(name);
+  gst_object_unref(pad);
+
+  gst_pad_set_active(ghostpad, TRUE);
+  gst_element_add_pad(GST_ELEMENT(simulcast), ghostpad);
+
+  simulcast->n_outputs++;
+
+  GST_DEBUG_OBJECT(simulcast, "Output %d: %dx%d with %s", n, width, height,
+		   cntl_file);
+
+  return TRUE;
+
+remove:
+  // Leave no half-built branch behind; the bin drops its references
+  gst_bin_remove_many(GST_BIN(simulcast), queue, veu, capsfilter, enc, NULL);
+  return FALSE;
+}
+
+static GstStateChangeReturn
+gst_shvideo_simulcast_change_state (GstElement * element,
+				    GstStateChange transition)
+{
+  GstshvideoSimulcast *simulcast = GST_SHVIDEOSIMULCAST (element);
+
+  if(transition == GST_STATE_CHANGE_NULL_TO_READY && !simulcast->n_outputs)
+  {
+    GST_ELEMENT_ERROR((GstElement*)simulcast, RESOURCE, SETTINGS,
+		      ("No outputs set"), (NULL));
+    return GST_STATE_CHANGE_FAILURE;
+  }
+
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+gboolean
+gst_shvideo_simulcast_plugin_init (GstPlugin * plugin)
+{
+  if (!gst_element_register (plugin, "gst-sh-mobile-simulcast", GST_RANK_NONE,
+          GST_TYPE_SHVIDEOSIMULCAST))
+    return FALSE;
+
+  return TRUE;
+}
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    "gst-sh-mobile-simulcast",
+    "gst-sh-mobile",
+    gst_shvideo_simulcast_plugin_init,
+    VERSION, "LGPL", GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
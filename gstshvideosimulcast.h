@@ -0,0 +1,169 @@
+/**
+ * gst-sh-mobile-simulcast
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOSIMULCAST_H
+#define  GSTSHVIDEOSIMULCAST_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define GST_TYPE_SHVIDEOSIMULCAST \
+  (gst_shvideo_simulcast_get_type())
+#define GST_SHVIDEOSIMULCAST(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_SHVIDEOSIMULCAST,GstshvideoSimulcast))
+#define GST_SHVIDEOSIMULCAST_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_SHVIDEOSIMULCAST,GstshvideoSimulcast))
+#define GST_IS_SHVIDEOSIMULCAST(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_SHVIDEOSIMULCAST))
+#define GST_IS_SHVIDEOSIMULCAST_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_SHVIDEOSIMULCAST))
+typedef struct _GstshvideoSimulcast GstshvideoSimulcast;
+typedef struct _GstshvideoSimulcastClass GstshvideoSimulcastClass;
+
+/**
+ * Define Gstreamer SH simulcast bin structure. Every output is a
+ * queue ! gst-sh-mobile-veu ! capsfilter ! gst-sh-mobile-enc branch
+ * after a tee
+ */
+
+struct _GstshvideoSimulcast
+{
+  GstBin bin;
+
+  GstPad *sinkpad;
+  GstElement *tee;
+
+  gchar *outputs;
+  guint n_outputs;
+};
+
+/**
+ * Define Gstreamer SH simulcast bin Class structure
+ */
+
+struct _GstshvideoSimulcastClass
+{
+  GstBinClass parent;
+};
+
+/** Get gst-sh-mobile-simulcast object type
+    @return object type
+*/
+
+GType gst_shvideo_simulcast_get_type (void);
+
+/** Initialize shvideosimulcast class plugin event handler
+    @param g_class Gclass
+    @param data user data pointer, unused in the function
+*/
+
+static void gst_shvideo_simulcast_init_class (gpointer g_class,
+					      gpointer data);
+
+/** Initialize the simulcast bin element class details and pad templates
+    @param klass Gstreamer element class
+*/
+
+static void gst_shvideo_simulcast_base_init (gpointer klass);
+
+/** Initialize the class for the simulcast bin
+    @param klass Gstreamer SH simulcast bin class
+*/
+
+static void gst_shvideo_simulcast_class_init (GstshvideoSimulcastClass *klass);
+
+/** Initialize the simulcast bin, creates the tee and the sink pad
+    @param simulcast Gstreamer SH simulcast bin element
+    @param gklass Gstreamer SH simulcast bin class
+*/
+
+static void gst_shvideo_simulcast_init (GstshvideoSimulcast *simulcast,
+					GstshvideoSimulcastClass *gklass);
+
+/** Finalize the simulcast bin
+    @param object Gstreamer element
+*/
+
+static void gst_shvideo_simulcast_finalize (GObject * object);
+
+/** The function will set the outputs of the bin
+    @param object The object where to get Gstreamer SH simulcast bin object
+    @param prop_id The property id
+    @param value The outputs if prop_id is PROP_OUTPUTS
+    @param pspec not used in fuction
+*/
+
+static void gst_shvideo_simulcast_set_property (GObject *object,
+						guint prop_id,
+						const GValue *value,
+						GParamSpec * pspec);
+
+/** The function will return the outputs of the bin
+    @param object The object where to get Gstreamer SH simulcast bin object
+    @param prop_id The property id
+    @param value The outputs if prop_id is PROP_OUTPUTS
+    @param pspec not used in fuction
+*/
+
+static void gst_shvideo_simulcast_get_property (GObject * object,
+						guint prop_id,
+						GValue * value,
+						GParamSpec * pspec);
+
+/** Creates the branches of the outputs and their source pads
+    @param simulcast Gstreamer SH simulcast bin element
+    @param outputs The outputs as WIDTHxHEIGHT:control_file separated by
+    commas
+    @return returns true if all the branches were created, else false
+*/
+
+static gboolean gst_shvideo_simulcast_build (GstshvideoSimulcast *simulcast,
+					     const gchar *outputs);
+
+/** Creates one scaling and encoding branch
+    @param simulcast Gstreamer SH simulcast bin element
+    @param width Width of the encoded picture
+    @param height Height of the encoded picture
+    @param cntl_file Control file of the encoder
+    @return returns true if the branch was created, else false
+*/
+
+static gboolean gst_shvideo_simulcast_add_output (GstshvideoSimulcast *simulcast,
+						  gint width, gint height,
+						  const gchar *cntl_file);
+
+/** Checks that the bin has outputs before it is started
+    @param element Gstreamer element
+    @param transition The state change
+    @return the result of the state change
+*/
+
+static GstStateChangeReturn
+gst_shvideo_simulcast_change_state (GstElement * element,
+				    GstStateChange transition);
+
+/** Initialize the simulcast bin plugin
+    @param plugin Gstreamer plugin
+    @return returns true if the plugin initialized and registered gst-sh-mobile-simulcast, else false
+*/
+
+gboolean gst_shvideo_simulcast_plugin_init (GstPlugin *plugin);
+
+G_END_DECLS
+#endif
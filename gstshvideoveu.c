@@ -0,0 +1,942 @@
+/**
+ * gst-sh-mobile-veu
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <gst/gst.h>
+
+#include "gstshvideoveu.h"
+#include <linux/fb.h>
+#include "vidix/sh_veu_vid.c"
+
+/**
+ * Define capatibilities for the sink factory
+ */
+
+static GstStaticPadTemplate sink_factory =
+  GST_STATIC_PAD_TEMPLATE ("sink",
+			   GST_PAD_SINK,
+			   GST_PAD_ALWAYS,
+			   GST_STATIC_CAPS ("video/x-raw-yuv, "
+					    "format = (fourcc) NV12,"
+					    "width = (int) [16, 2560],"
+					    "height = (int) [16, 1920],"
+					    "framerate = (fraction) [0, MAX]")
+			   );
+
+/**
+ * Define capatibilities for the source factory
+ */
+
+static GstStaticPadTemplate src_factory =
+  GST_STATIC_PAD_TEMPLATE ("src",
+			   GST_PAD_SRC,
+			   GST_PAD_ALWAYS,
+			   GST_STATIC_CAPS ("video/x-raw-yuv, "
+					    "format = (fourcc) NV12,"
+					    "width = (int) [16, 2560],"
+					    "height = (int) [16, 1920],"
+					    "framerate = (fraction) [0, MAX]; "
+					    "video/x-raw-rgb, "
+					    "bpp = (int) 16,"
+					    "depth = (int) 16,"
+					    "endianness = (int) 1234,"
+					    "red_mask = (int) 0xf800,"
+					    "green_mask = (int) 0x07e0,"
+					    "blue_mask = (int) 0x001f,"
+					    "width = (int) [16, 2560],"
+					    "height = (int) [16, 1920],"
+					    "framerate = (fraction) [0, MAX]")
+			   );
+
+GST_DEBUG_CATEGORY_STATIC (gst_sh_mobile_debug);
+#define GST_CAT_DEFAULT gst_sh_mobile_debug
+
+static GstBaseTransformClass *parent_class = NULL;
+static GstBufferClass *buffer_parent_class = NULL;
+
+/**
+ * Define VEU filter properties
+ */
+
+enum
+{
+  PROP_0,
+  PROP_FRAMES,
+  PROP_INPUT_COPIES,
+  PROP_OUTPUT_COPIES,
+  PROP_AVERAGE_LATENCY,
+  PROP_MAX_LATENCY,
+#ifdef SHVIDEO_COPY_STATS
+  PROP_BYTES_COPIED,
+  PROP_BUFFERS_ALLOCATED,
+#endif
+  PROP_LAST
+};
+
+/* Guards the VEU memory allocator and the pools of every instance of
+   the filter. The conversions are ordered by the VEU scheduler */
+static pthread_mutex_t veu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns the physical address of data in the VEU memory, or 0 */
+static unsigned long
+gst_shvideo_veu_phys (const guint8 * data)
+{
+  const guint8 *iomem = (const guint8 *) uio_mem_.iomem;
+
+  if(!sh_veu_veu_found || data < iomem || data >= iomem + uio_mem_.size)
+  {
+    return 0;
+  }
+
+  return uio_mem_.address + (data - iomem);
+}
+
+static GstshvideoVeuPool *
+gst_shvideo_veu_pool_new (guint slot_size, guint max_slots)
+{
+  GstshvideoVeuPool *pool;
+  guint n_slots;
+  long offset;
+
+  slot_size = GST_ROUND_UP_32(slot_size);
+
+  offset = -1;
+  for(n_slots = max_slots; n_slots > 0; n_slots--)
+  {
+    offset = sh_veu_mem_alloc(slot_size * n_slots);
+    if(offset >= 0)
+    {
+      break;
+    }
+  }
+
+  if(n_slots == 0)
+  {
+    return NULL;
+  }
+
+  // Buffers still in use keep the VEU memory mapped
+  sh_veu_ref();
+
+  pool = g_new0(GstshvideoVeuPool, 1);
+  pool->refcount = 1;
+  pool->offset = offset;
+  pool->slot_size = slot_size;
+  pool->n_slots = n_slots;
+  pool->used = 0;
+
+  return pool;
+}
+
+static GstBuffer *
+gst_shvideo_veu_pool_get (GstshvideoVeuPool * pool, guint size,
+			  GstCaps * caps)
+{
+  GstshvideoVeuBuffer *veubuf;
+  gint slot;
+
+  if(!pool || size > pool->slot_size)
+  {
+    return NULL;
+  }
+
+  for(slot = 0; slot < pool->n_slots; slot++)
+  {
+    if(!(pool->used & (1 << slot)))
+    {
+      break;
+    }
+  }
+  if(slot == pool->n_slots)
+  {
+    return NULL;
+  }
+
+  pool->used |= 1 << slot;
+  pool->refcount++;
+
+  veubuf = (GstshvideoVeuBuffer *) gst_mini_object_new(GST_TYPE_SHVIDEOVEU_BUFFER);
+  veubuf->pool = pool;
+  veubuf->slot = slot;
+
+  GST_BUFFER_DATA(veubuf) = (guint8 *) uio_mem_.iomem + pool->offset
+    + slot * pool->slot_size;
+  GST_BUFFER_SIZE(veubuf) = size;
+  gst_buffer_set_caps(GST_BUFFER(veubuf), caps);
+
+  return GST_BUFFER(veubuf);
+}
+
+static void
+gst_shvideo_veu_pool_unref (GstshvideoVeuPool * pool)
+{
+  if(--pool->refcount == 0)
+  {
+    sh_veu_mem_free(pool->offset);
+    g_free(pool);
+    sh_veu_destroy();
+  }
+}
+
+static void
+gst_shvideo_veu_buffer_finalize (GstshvideoVeuBuffer * buffer)
+{
+  pthread_mutex_lock(&veu_mutex);
+  buffer->pool->used &= ~(1 << buffer->slot);
+  gst_shvideo_veu_pool_unref(buffer->pool);
+  pthread_mutex_unlock(&veu_mutex);
+
+  GST_MINI_OBJECT_CLASS (buffer_parent_class)->finalize
+    (GST_MINI_OBJECT (buffer));
+}
+
+static void
+gst_shvideo_veu_buffer_class_init (gpointer g_class, gpointer data)
+{
+  GstMiniObjectClass *mini_object_class = GST_MINI_OBJECT_CLASS (g_class);
+
+  buffer_parent_class = g_type_class_peek_parent (g_class);
+
+  mini_object_class->finalize = (GstMiniObjectFinalizeFunction)
+    gst_shvideo_veu_buffer_finalize;
+}
+
+GType gst_shvideo_veu_buffer_get_type (void)
+{
+  static GType object_type = 0;
+
+  if (object_type == 0) {
+    static const GTypeInfo object_info = {
+      sizeof (GstBufferClass),
+      NULL,
+      NULL,
+      gst_shvideo_veu_buffer_class_init,
+      NULL,
+      NULL,
+      sizeof (GstshvideoVeuBuffer),
+      0,
+      NULL
+    };
+
+    object_type =
+      g_type_register_static (GST_TYPE_BUFFER, "GstshvideoVeuBuffer",
+			      &object_info, (GTypeFlags) 0);
+  }
+
+  return object_type;
+}
+
+static void
+gst_shvideo_veu_init_class (gpointer g_class, gpointer data)
+{
+  parent_class = g_type_class_peek_parent (g_class);
+  gst_shvideo_veu_class_init ((GstshvideoVeuClass *) g_class);
+}
+
+GType gst_shvideo_veu_get_type (void)
+{
+  static GType object_type = 0;
+
+  if (object_type == 0) {
+    static const GTypeInfo object_info = {
+      sizeof (GstshvideoVeuClass),
+      gst_shvideo_veu_base_init,
+      NULL,
+      gst_shvideo_veu_init_class,
+      NULL,
+      NULL,
+      sizeof (GstshvideoVeu),
+      0,
+      (GInstanceInitFunc) gst_shvideo_veu_init
+    };
+
+    object_type =
+      g_type_register_static (GST_TYPE_BASE_TRANSFORM, "gst-sh-mobile-veu",
+			      &object_info, (GTypeFlags) 0);
+  }
+
+  return object_type;
+}
+
+static void
+gst_shvideo_veu_base_init (gpointer klass)
+{
+  static const GstElementDetails plugin_details =
+    GST_ELEMENT_DETAILS ("SH VEU scaler",
+			 "Filter/Converter/Video/Scaler",
+			 "Scale NV12 video and convert it to RGB565 with the SH-Mobile VEU",
+			 "gst-sh-mobile");
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_factory));
+  gst_element_class_set_details (element_class, &plugin_details);
+}
+
+static void
+gst_shvideo_veu_class_init (GstshvideoVeuClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstBaseTransformClass *trans_class;
+
+  gobject_class = (GObjectClass *) klass;
+  trans_class = (GstBaseTransformClass *) klass;
+
+  gobject_class->finalize = gst_shvideo_veu_finalize;
+  gobject_class->get_property = gst_shvideo_veu_get_property;
+
+  trans_class->transform_caps = gst_shvideo_veu_transform_caps;
+  trans_class->fixate_caps = gst_shvideo_veu_fixate_caps;
+  trans_class->get_unit_size = gst_shvideo_veu_get_unit_size;
+  trans_class->set_caps = gst_shvideo_veu_set_caps;
+  trans_class->start = gst_shvideo_veu_start;
+  trans_class->stop = gst_shvideo_veu_stop;
+  trans_class->prepare_output_buffer = gst_shvideo_veu_prepare_output_buffer;
+  trans_class->transform = gst_shvideo_veu_transform;
+  trans_class->passthrough_on_same_caps = TRUE;
+
+  GST_DEBUG_CATEGORY_INIT (gst_sh_mobile_debug, "gst-sh-mobile-veu",
+      0, "Scaler and color converter for the SH-Mobile VEU");
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES,
+      g_param_spec_uint64 ("frames", "Frames",
+			   "Number of frames processed by the VEU",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_INPUT_COPIES,
+      g_param_spec_uint64 ("input-copies", "Input copies",
+			   "Number of input frames copied to the VEU memory",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_COPIES,
+      g_param_spec_uint64 ("output-copies", "Output copies",
+			   "Number of output frames copied from the VEU memory",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_AVERAGE_LATENCY,
+      g_param_spec_uint64 ("average-latency", "Average latency",
+			   "Average time in microseconds from queuing a frame "
+			   "to the VEU to the end of its conversion",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Maximum latency",
+			   "Longest time in microseconds from queuing a frame "
+			   "to the VEU to the end of its conversion",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+#ifdef SHVIDEO_COPY_STATS
+  g_object_class_install_property (gobject_class, PROP_BYTES_COPIED,
+      g_param_spec_uint64 ("bytes-copied", "Bytes copied",
+			   "Bytes of the frames copied to and from the "
+			   "VEU memory",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BUFFERS_ALLOCATED,
+      g_param_spec_uint64 ("buffers-allocated", "Buffers allocated",
+			   "Output buffers allocated outside the VEU memory",
+			   0, G_MAXUINT64, 0,
+			   G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+#endif
+}
+
+static void
+gst_shvideo_veu_init (GstshvideoVeu * shvideoveu,
+		      GstshvideoVeuClass * gklass)
+{
+  GstPad *pad;
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  shvideoveu->in_width = 0;
+  shvideoveu->in_height = 0;
+  shvideoveu->in_stride = 0;
+  shvideoveu->in_size = 0;
+  shvideoveu->out_format = SH_VEU_NV12;
+  shvideoveu->out_width = 0;
+  shvideoveu->out_height = 0;
+  shvideoveu->out_stride = 0;
+  shvideoveu->out_size = 0;
+
+  shvideoveu->staging_offset = -1;
+  shvideoveu->staging_stride = 0;
+  shvideoveu->bounce_offset = -1;
+  shvideoveu->pool = NULL;
+  shvideoveu->in_pool = NULL;
+  shvideoveu->veu = g_new0(struct sh_veu_context, 1);
+  shvideoveu->veu->convert = 1;
+
+  shvideoveu->frames = 0;
+  shvideoveu->input_copies = 0;
+  shvideoveu->output_copies = 0;
+  GST_SHVIDEO_COPY_STATS_INIT(shvideoveu->copy_stats);
+
+  // Upstream allocating from us gets the VEU memory, like the CEU source
+  pad = GST_BASE_TRANSFORM_SINK_PAD(shvideoveu);
+  shvideoveu->sink_alloc = GST_PAD_BUFFERALLOCFUNC(pad);
+  gst_pad_set_bufferalloc_function(pad, gst_shvideo_veu_buffer_alloc);
+}
+
+static void
+gst_shvideo_veu_finalize (GObject * object)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (object);
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  g_free(shvideoveu->veu);
+  shvideoveu->veu = NULL;
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_shvideo_veu_get_property (GObject * object, guint prop_id,
+			      GValue * value, GParamSpec * pspec)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (object);
+
+  switch (prop_id)
+  {
+    case PROP_FRAMES:
+    {
+      g_value_set_uint64(value, shvideoveu->frames);
+      break;
+    }
+    case PROP_INPUT_COPIES:
+    {
+      g_value_set_uint64(value, shvideoveu->input_copies);
+      break;
+    }
+    case PROP_OUTPUT_COPIES:
+    {
+      g_value_set_uint64(value, shvideoveu->output_copies);
+      break;
+    }
+    case PROP_AVERAGE_LATENCY:
+    case PROP_MAX_LATENCY:
+    {
+      unsigned long jobs;
+      unsigned long long avg_wait, avg_latency, max_latency;
+
+      sh_veu_get_latency(shvideoveu->veu, &jobs, &avg_wait,
+			 &avg_latency, &max_latency);
+      g_value_set_uint64(value, prop_id == PROP_AVERAGE_LATENCY ?
+			 avg_latency : max_latency);
+      break;
+    }
+#ifdef SHVIDEO_COPY_STATS
+    case PROP_BYTES_COPIED:
+    case PROP_BUFFERS_ALLOCATED:
+    {
+      guint64 bytes, buffers;
+
+      gst_shvideo_copy_stats_get(&shvideoveu->copy_stats, &bytes, &buffers);
+      g_value_set_uint64(value, prop_id == PROP_BYTES_COPIED ?
+			 bytes : buffers);
+      break;
+    }
+#endif
+    default:
+    {
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+  }
+}
+
+static GstCaps *
+gst_shvideo_veu_transform_caps (GstBaseTransform * trans,
+				GstPadDirection direction, GstCaps * caps)
+{
+  GstCaps *ret;
+  GstStructure *structure;
+  const GValue *framerate;
+  guint i;
+
+  ret = gst_caps_new_empty();
+
+  for(i = 0; i < gst_caps_get_size(caps); i++)
+  {
+    framerate = gst_structure_get_value(gst_caps_get_structure(caps, i),
+					"framerate");
+
+    // The VEU only reads NV12, but scales to any size it supports
+    structure = gst_structure_new("video/x-raw-yuv",
+				  "format", GST_TYPE_FOURCC,
+				  GST_MAKE_FOURCC('N','V','1','2'),
+				  "width", GST_TYPE_INT_RANGE,
+				  sh_veu_cap.minwidth, sh_veu_cap.maxwidth,
+				  "height", GST_TYPE_INT_RANGE,
+				  sh_veu_cap.minheight, sh_veu_cap.maxheight,
+				  NULL);
+    if(framerate)
+    {
+      gst_structure_set_value(structure, "framerate", framerate);
+    }
+    gst_caps_append_structure(ret, structure);
+
+    if(direction == GST_PAD_SINK)
+    {
+      structure = gst_structure_new("video/x-raw-rgb",
+				    "bpp", G_TYPE_INT, 16,
+				    "depth", G_TYPE_INT, 16,
+				    "endianness", G_TYPE_INT, G_LITTLE_ENDIAN,
+				    "red_mask", G_TYPE_INT, 0xf800,
+				    "green_mask", G_TYPE_INT, 0x07e0,
+				    "blue_mask", G_TYPE_INT, 0x001f,
+				    "width", GST_TYPE_INT_RANGE,
+				    sh_veu_cap.minwidth, sh_veu_cap.maxwidth,
+				    "height", GST_TYPE_INT_RANGE,
+				    sh_veu_cap.minheight, sh_veu_cap.maxheight,
+				    NULL);
+      if(framerate)
+      {
+	gst_structure_set_value(structure, "framerate", framerate);
+      }
+      gst_caps_append_structure(ret, structure);
+    }
+  }
+
+  GST_LOG_OBJECT(trans, "Transformed %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT,
+		 caps, ret);
+
+  return ret;
+}
+
+static void
+gst_shvideo_veu_fixate_caps (GstBaseTransform * trans,
+			     GstPadDirection direction, GstCaps * caps,
+			     GstCaps * othercaps)
+{
+  GstStructure *structure;
+  GstStructure *outs;
+  gint width, height;
+  gint out_width, out_height;
+
+  structure = gst_caps_get_structure(caps, 0);
+  if(!gst_structure_get_int(structure, "width", &width) ||
+     !gst_structure_get_int(structure, "height", &height))
+  {
+    return;
+  }
+
+  outs = gst_caps_get_structure(othercaps, 0);
+
+  // Keep the aspect ratio when only one side was asked for
+  if(gst_structure_get_int(outs, "width", &out_width))
+  {
+    gst_structure_fixate_field_nearest_int(outs, "height",
+					   (out_width * height / width) & ~1);
+  }
+  else if(gst_structure_get_int(outs, "height", &out_height))
+  {
+    gst_structure_fixate_field_nearest_int(outs, "width",
+					   (out_height * width / height) & ~3);
+  }
+  else
+  {
+    gst_structure_fixate_field_nearest_int(outs, "width", width);
+    gst_structure_fixate_field_nearest_int(outs, "height", height);
+  }
+
+  GST_DEBUG_OBJECT(trans, "Fixated to %" GST_PTR_FORMAT, othercaps);
+}
+
+static gboolean
+gst_shvideo_veu_get_unit_size (GstBaseTransform * trans, GstCaps * caps,
+			       guint * size)
+{
+  GstStructure *structure;
+  gint width, height;
+
+  structure = gst_caps_get_structure(caps, 0);
+  if(!gst_structure_get_int(structure, "width", &width) ||
+     !gst_structure_get_int(structure, "height", &height))
+  {
+    return FALSE;
+  }
+
+  if(gst_structure_has_name(structure, "video/x-raw-rgb"))
+  {
+    *size = width * 2 * height;
+  }
+  else
+  {
+    *size = width * height * 3 / 2;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_shvideo_veu_free_memory (GstshvideoVeu * shvideoveu)
+{
+  if(shvideoveu->staging_offset >= 0)
+  {
+    sh_veu_mem_free(shvideoveu->staging_offset);
+    shvideoveu->staging_offset = -1;
+  }
+  if(shvideoveu->bounce_offset >= 0)
+  {
+    sh_veu_mem_free(shvideoveu->bounce_offset);
+    shvideoveu->bounce_offset = -1;
+  }
+  // Buffers still downstream keep their slots until they are finalized
+  if(shvideoveu->pool)
+  {
+    gst_shvideo_veu_pool_unref(shvideoveu->pool);
+    shvideoveu->pool = NULL;
+  }
+}
+
+static gboolean
+gst_shvideo_veu_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+			  GstCaps * outcaps)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (trans);
+  GstStructure *structure;
+  gint in_width, in_height, out_width, out_height;
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  structure = gst_caps_get_structure(incaps, 0);
+  if(!gst_structure_get_int(structure, "width", &in_width) ||
+     !gst_structure_get_int(structure, "height", &in_height))
+  {
+    return FALSE;
+  }
+
+  structure = gst_caps_get_structure(outcaps, 0);
+  if(!gst_structure_get_int(structure, "width", &out_width) ||
+     !gst_structure_get_int(structure, "height", &out_height))
+  {
+    return FALSE;
+  }
+
+  // The VEU works on 4 pixel wide columns and 4:2:0 chroma
+  if((in_width | out_width) & 3 || (in_height | out_height) & 1)
+  {
+    GST_WARNING_OBJECT(shvideoveu, "Can't scale %dx%d to %dx%d, the width "
+		       "must be a multiple of 4 and the height even",
+		       in_width, in_height, out_width, out_height);
+    return FALSE;
+  }
+
+  shvideoveu->in_width = in_width;
+  shvideoveu->in_height = in_height;
+  shvideoveu->in_stride = in_width;
+  shvideoveu->in_size = in_width * in_height * 3 / 2;
+
+  shvideoveu->out_width = out_width;
+  shvideoveu->out_height = out_height;
+  if(gst_structure_has_name(structure, "video/x-raw-rgb"))
+  {
+    shvideoveu->out_format = SH_VEU_RGB565;
+    shvideoveu->out_stride = out_width * 2;
+    shvideoveu->out_size = shvideoveu->out_stride * out_height;
+  }
+  else
+  {
+    shvideoveu->out_format = SH_VEU_NV12;
+    shvideoveu->out_stride = out_width;
+    shvideoveu->out_size = out_width * out_height * 3 / 2;
+  }
+
+  pthread_mutex_lock(&veu_mutex);
+
+  gst_shvideo_veu_free_memory(shvideoveu);
+
+  // Input that is not in the VEU memory is copied there first
+  shvideoveu->staging_stride = GST_ROUND_UP_16(in_width);
+  shvideoveu->staging_offset =
+    sh_veu_mem_alloc(shvideoveu->staging_stride * in_height * 3 / 2);
+
+  // Output for buffers that are not in the VEU memory
+  shvideoveu->bounce_offset = sh_veu_mem_alloc(shvideoveu->out_size);
+
+  if(shvideoveu->staging_offset < 0 || shvideoveu->bounce_offset < 0)
+  {
+    gst_shvideo_veu_free_memory(shvideoveu);
+    pthread_mutex_unlock(&veu_mutex);
+    GST_ELEMENT_ERROR((GstElement*)shvideoveu, RESOURCE, NO_SPACE_LEFT,
+		      ("Not enough VEU memory to scale %dx%d to %dx%d",
+		       in_width, in_height, out_width, out_height), (NULL));
+    return FALSE;
+  }
+
+  // As many output slots as fit, downstream then gets the VEU memory
+  shvideoveu->pool = gst_shvideo_veu_pool_new(shvideoveu->out_size,
+					      SHVIDEOVEU_POOL_SLOTS);
+
+  pthread_mutex_unlock(&veu_mutex);
+
+  GST_DEBUG_OBJECT(shvideoveu, "Scaling %dx%d to %dx%d %s, %d output slots",
+		   in_width, in_height, out_width, out_height,
+		   shvideoveu->out_format == SH_VEU_RGB565 ? "RGB565" : "NV12",
+		   shvideoveu->pool ? shvideoveu->pool->n_slots : 0);
+
+  return TRUE;
+}
+
+static gboolean
+gst_shvideo_veu_start (GstBaseTransform * trans)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (trans);
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  // The VEU is looked up and reset by the first user only, the last
+  // one stops the VEU scheduler and unmaps the VEU
+  if(sh_veu_probe_convert() < 0)
+  {
+    GST_ELEMENT_ERROR((GstElement*)shvideoveu, RESOURCE, OPEN_READ_WRITE,
+		      ("Could not open the VEU"), (NULL));
+    return FALSE;
+  }
+
+  shvideoveu->frames = 0;
+  shvideoveu->input_copies = 0;
+  shvideoveu->output_copies = 0;
+  shvideoveu->veu->jobs = 0;
+  shvideoveu->veu->wait_us = 0;
+  shvideoveu->veu->run_us = 0;
+  shvideoveu->veu->max_latency_us = 0;
+
+  return TRUE;
+}
+
+static gboolean
+gst_shvideo_veu_stop (GstBaseTransform * trans)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (trans);
+  unsigned long jobs;
+  unsigned long long avg_wait, avg_latency, max_latency;
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  sh_veu_get_latency(shvideoveu->veu, &jobs, &avg_wait,
+		     &avg_latency, &max_latency);
+
+  pthread_mutex_lock(&veu_mutex);
+  gst_shvideo_veu_free_memory(shvideoveu);
+  // The input pool outlives the caps, upstream allocates before them
+  if(shvideoveu->in_pool)
+  {
+    gst_shvideo_veu_pool_unref(shvideoveu->in_pool);
+    shvideoveu->in_pool = NULL;
+  }
+  pthread_mutex_unlock(&veu_mutex);
+
+  sh_veu_destroy();
+
+  GST_DEBUG_OBJECT(shvideoveu, "%" G_GUINT64_FORMAT " frames, %"
+		   G_GUINT64_FORMAT " input and %" G_GUINT64_FORMAT
+		   " output copies, latency %" G_GUINT64_FORMAT " us (max %"
+		   G_GUINT64_FORMAT " us)", shvideoveu->frames,
+		   shvideoveu->input_copies, shvideoveu->output_copies,
+		   (guint64) avg_latency, (guint64) max_latency);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_shvideo_veu_prepare_output_buffer (GstBaseTransform * trans,
+				       GstBuffer * input, gint size,
+				       GstCaps * caps, GstBuffer ** buf)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (trans);
+
+  pthread_mutex_lock(&veu_mutex);
+  *buf = gst_shvideo_veu_pool_get(shvideoveu->pool, size, caps);
+  pthread_mutex_unlock(&veu_mutex);
+
+  if(!*buf)
+  {
+    GST_LOG_OBJECT(shvideoveu, "All output slots in use");
+    *buf = gst_buffer_new_and_alloc(size);
+    gst_buffer_set_caps(*buf, caps);
+    GST_SHVIDEO_COPY_STATS_ADD(shvideoveu, shvideoveu->copy_stats, 0, 1);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_shvideo_veu_buffer_alloc (GstPad * pad, guint64 offset, guint size,
+			      GstCaps * caps, GstBuffer ** buf)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (GST_PAD_PARENT (pad));
+  GstStructure *structure;
+  gint width;
+
+  *buf = NULL;
+
+  // Frames are read in place only with a stride the VEU can take
+  structure = caps ? gst_caps_get_structure(caps, 0) : NULL;
+  if(structure && gst_structure_get_int(structure, "width", &width) &&
+     !(width & 15) &&
+     !gst_base_transform_is_passthrough(GST_BASE_TRANSFORM(shvideoveu)))
+  {
+    pthread_mutex_lock(&veu_mutex);
+    if(shvideoveu->in_pool &&
+       shvideoveu->in_pool->slot_size != GST_ROUND_UP_32(size))
+    {
+      // Buffers still upstream keep their slots until they are finalized
+      gst_shvideo_veu_pool_unref(shvideoveu->in_pool);
+      shvideoveu->in_pool = NULL;
+    }
+    if(!shvideoveu->in_pool && sh_veu_veu_found)
+    {
+      shvideoveu->in_pool = gst_shvideo_veu_pool_new(size,
+						     SHVIDEOVEU_INPUT_SLOTS);
+    }
+    *buf = gst_shvideo_veu_pool_get(shvideoveu->in_pool, size, caps);
+    pthread_mutex_unlock(&veu_mutex);
+  }
+
+  if(*buf)
+  {
+    GST_BUFFER_OFFSET(*buf) = offset;
+    return GST_FLOW_OK;
+  }
+
+  return shvideoveu->sink_alloc(pad, offset, size, caps, buf);
+}
+
+static GstFlowReturn
+gst_shvideo_veu_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+			   GstBuffer * outbuf)
+{
+  GstshvideoVeu *shvideoveu = GST_SHVIDEOVEU (trans);
+  struct sh_veu_context *veu = shvideoveu->veu;
+  unsigned long src_addr, dst_addr;
+  guint8 *staging;
+  gint src_stride;
+  gint i;
+
+  GST_LOG_OBJECT(shvideoveu,"%s called",__FUNCTION__);
+
+  if(GST_BUFFER_SIZE(inbuf) < shvideoveu->in_size)
+  {
+    GST_WARNING_OBJECT(shvideoveu, "Input buffer of %d bytes, expected %d",
+		       GST_BUFFER_SIZE(inbuf), shvideoveu->in_size);
+    return GST_FLOW_ERROR;
+  }
+
+  /* Read the frame in place if it is already in the VEU memory. The
+     staging and bounce memory belong to this instance and are only used
+     by its streaming thread, no lock is held while the VEU converts */
+  src_addr = 0;
+  src_stride = shvideoveu->in_stride;
+  if(!(src_stride & 15))
+  {
+    src_addr = gst_shvideo_veu_phys(GST_BUFFER_DATA(inbuf));
+  }
+  if(!src_addr)
+  {
+    staging = (guint8 *) uio_mem_.iomem + shvideoveu->staging_offset;
+    src_stride = shvideoveu->staging_stride;
+    for(i = 0; i < shvideoveu->in_height * 3 / 2; i++)
+    {
+      memcpy(staging + i * src_stride,
+	     GST_BUFFER_DATA(inbuf) + i * shvideoveu->in_stride,
+	     shvideoveu->in_width);
+    }
+    src_addr = uio_mem_.address + shvideoveu->staging_offset;
+    shvideoveu->input_copies++;
+    GST_SHVIDEO_COPY_STATS_ADD(shvideoveu, shvideoveu->copy_stats,
+			       shvideoveu->in_width *
+			       shvideoveu->in_height * 3 / 2, 0);
+  }
+
+  dst_addr = gst_shvideo_veu_phys(GST_BUFFER_DATA(outbuf));
+  if(!dst_addr)
+  {
+    dst_addr = uio_mem_.address + shvideoveu->bounce_offset;
+  }
+
+  /* Queued to the VEU scheduler with the jobs of the other filters,
+     which run back to back. The decoders have their own scheduler in
+     their plugin. The base transform pushes the buffer on return, so
+     this one is waited for here */
+  veu->info.src.w = shvideoveu->in_width;
+  veu->info.src.h = shvideoveu->in_height;
+  veu->src_stride = src_stride;
+  veu->dst_w = shvideoveu->out_width;
+  veu->dst_h = shvideoveu->out_height;
+  veu->dst_stride = shvideoveu->out_stride;
+  veu->dst_addr = dst_addr;
+  veu->dst_format = shvideoveu->out_format;
+  veu->info.offset.y = src_addr;
+  veu->info.offset.u = src_addr + src_stride * shvideoveu->in_height;
+  sh_veu_run(veu);
+
+  if(dst_addr == uio_mem_.address + shvideoveu->bounce_offset)
+  {
+    memcpy(GST_BUFFER_DATA(outbuf),
+	   (guint8 *) uio_mem_.iomem + shvideoveu->bounce_offset,
+	   shvideoveu->out_size);
+    shvideoveu->output_copies++;
+    GST_SHVIDEO_COPY_STATS_ADD(shvideoveu, shvideoveu->copy_stats,
+			       shvideoveu->out_size, 0);
+  }
+
+  shvideoveu->frames++;
+
+  return GST_FLOW_OK;
+}
+
+gboolean
+gst_shvideo_veu_plugin_init (GstPlugin * plugin)
+{
+  if (!gst_element_register (plugin, "gst-sh-mobile-veu", GST_RANK_NONE,
+          GST_TYPE_SHVIDEOVEU))
+    return FALSE;
+
+  return TRUE;
+}
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    "gst-sh-mobile-veu",
+    "gst-sh-mobile",
+    gst_shvideo_veu_plugin_init,
+    VERSION, "LGPL", GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
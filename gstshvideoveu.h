@@ -0,0 +1,360 @@
+/**
+ * gst-sh-mobile-veu
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  GSTSHVIDEOVEU_H
+#define  GSTSHVIDEOVEU_H
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <pthread.h>
+
+#include "gstshvideocopystats.h"
+
+G_BEGIN_DECLS
+#define GST_TYPE_SHVIDEOVEU \
+  (gst_shvideo_veu_get_type())
+#define GST_SHVIDEOVEU(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_SHVIDEOVEU,GstshvideoVeu))
+#define GST_SHVIDEOVEU_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_SHVIDEOVEU,GstshvideoVeu))
+#define GST_IS_SHVIDEOVEU(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_SHVIDEOVEU))
+#define GST_IS_SHVIDEOVEU_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_SHVIDEOVEU))
+#define GST_TYPE_SHVIDEOVEU_BUFFER \
+  (gst_shvideo_veu_buffer_get_type())
+#define GST_IS_SHVIDEOVEU_BUFFER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_SHVIDEOVEU_BUFFER))
+typedef struct _GstshvideoVeu GstshvideoVeu;
+typedef struct _GstshvideoVeuClass GstshvideoVeuClass;
+typedef struct _GstshvideoVeuBuffer GstshvideoVeuBuffer;
+typedef struct _GstshvideoVeuPool GstshvideoVeuPool;
+
+struct sh_veu_context;
+
+/**
+ * Number of output buffers kept in the contiguous VEU memory
+ */
+
+#define SHVIDEOVEU_POOL_SLOTS 4
+
+/**
+ * Number of input buffers handed upstream in the contiguous VEU memory,
+ * enough for the capture buffers of the CEU and the frames in flight
+ */
+
+#define SHVIDEOVEU_INPUT_SLOTS 8
+
+/**
+ * Buffers in the contiguous VEU memory. The pool lives until the
+ * element and all the buffers have released it
+ */
+
+struct _GstshvideoVeuPool
+{
+  gint refcount;
+  long offset;
+  guint slot_size;
+  guint n_slots;
+  guint32 used;
+};
+
+/**
+ * Define Gstreamer SH VEU filter structure
+ */
+
+struct _GstshvideoVeu
+{
+  GstBaseTransform element;
+
+  /* Input, always NV12 */
+  gint in_width;
+  gint in_height;
+  gint in_stride;
+  guint in_size;
+
+  /* Output */
+  gint out_format;
+  gint out_width;
+  gint out_height;
+  gint out_stride;
+  guint out_size;
+
+  /* Contiguous VEU memory */
+  long staging_offset;
+  gint staging_stride;
+  long bounce_offset;
+  GstshvideoVeuPool *pool;
+  GstshvideoVeuPool *in_pool;
+
+  /* Buffer allocation of the sink pad of the base transform */
+  GstPadBufferAllocFunction sink_alloc;
+
+  /* Conversion jobs queued to the VEU scheduler */
+  struct sh_veu_context *veu;
+
+  guint64 frames;
+  guint64 input_copies;
+  guint64 output_copies;
+#ifdef SHVIDEO_COPY_STATS
+  GstshvideoCopyStats copy_stats;
+#endif
+};
+
+/**
+ * Define Gstreamer SH VEU filter Class structure
+ */
+
+struct _GstshvideoVeuClass
+{
+  GstBaseTransformClass parent;
+};
+
+/**
+ * A buffer in an output slot of the VEU memory
+ */
+
+struct _GstshvideoVeuBuffer
+{
+  GstBuffer buffer;
+
+  GstshvideoVeuPool *pool;
+  gint slot;
+};
+
+/** Get gst-sh-mobile-veu object type
+    @return object type
+*/
+
+GType gst_shvideo_veu_get_type (void);
+
+/** Get the type of the buffers in the VEU memory
+    @return buffer type
+*/
+
+GType gst_shvideo_veu_buffer_get_type (void);
+
+/** Initialize shvideoveu class plugin event handler
+    @param g_class Gclass
+    @param data user data pointer, unused in the function
+*/
+
+static void gst_shvideo_veu_init_class (gpointer g_class, gpointer data);
+
+/** Initialize the VEU filter element class details and pad templates
+    @param klass Gstreamer element class
+*/
+
+static void gst_shvideo_veu_base_init (gpointer klass);
+
+/** Initialize the class for the VEU filter
+    @param klass Gstreamer SH VEU filter class
+*/
+
+static void gst_shvideo_veu_class_init (GstshvideoVeuClass *klass);
+
+/** Initialize the VEU filter
+    @param shvideoveu Gstreamer SH VEU filter element
+    @param gklass Gstreamer SH VEU filter class
+*/
+
+static void gst_shvideo_veu_init (GstshvideoVeu *shvideoveu,
+				  GstshvideoVeuClass *gklass);
+
+/** Finalize the VEU filter
+    @param object Gstreamer element
+*/
+
+static void gst_shvideo_veu_finalize (GObject * object);
+
+/** The function will return the statistics of the filter
+    @param object The object where to get Gstreamer SH VEU filter object
+    @param prop_id The property id
+    @param value The value of the property
+    @param pspec not used in fuction
+*/
+
+static void gst_shvideo_veu_get_property (GObject * object, guint prop_id,
+					  GValue * value, GParamSpec * pspec);
+
+/** Returns the caps the other pad can have: NV12 on the sink pad and
+    NV12 or RGB565 on the source pad in any size the VEU supports
+    @param trans Gstreamer base transform
+    @param direction Direction of the pad of the caps
+    @param caps The caps of the pad
+    @return the caps, the caller owns the reference
+*/
+
+static GstCaps *gst_shvideo_veu_transform_caps (GstBaseTransform * trans,
+						GstPadDirection direction,
+						GstCaps * caps);
+
+/** Fixates the size of the other pad to the size of the pad, so that
+    the filter only scales when asked
+    @param trans Gstreamer base transform
+    @param direction Direction of the pad of the caps
+    @param caps The fixed caps of the pad
+    @param othercaps The caps to fixate
+*/
+
+static void gst_shvideo_veu_fixate_caps (GstBaseTransform * trans,
+					 GstPadDirection direction,
+					 GstCaps * caps, GstCaps * othercaps);
+
+/** Returns the size of a frame in the caps
+    @param trans Gstreamer base transform
+    @param caps The caps
+    @param size The frame size
+    @return TRUE if the caps are supported
+*/
+
+static gboolean gst_shvideo_veu_get_unit_size (GstBaseTransform * trans,
+					       GstCaps * caps, guint * size);
+
+/** Reads the sizes and formats and reserves the VEU memory
+    @param trans Gstreamer base transform
+    @param incaps Caps of the sink pad
+    @param outcaps Caps of the source pad
+    @return TRUE if the conversion is supported and the memory reserved
+*/
+
+static gboolean gst_shvideo_veu_set_caps (GstBaseTransform * trans,
+					  GstCaps * incaps,
+					  GstCaps * outcaps);
+
+/** Opens the VEU
+    @param trans Gstreamer base transform
+    @return TRUE if the VEU was found
+*/
+
+static gboolean gst_shvideo_veu_start (GstBaseTransform * trans);
+
+/** Releases the VEU memory of the element
+    @param trans Gstreamer base transform
+    @return TRUE
+*/
+
+static gboolean gst_shvideo_veu_stop (GstBaseTransform * trans);
+
+/** Gives a buffer in a free output slot of the VEU memory, or a normal
+    buffer if all the slots are in use
+    @param trans Gstreamer base transform
+    @param input The input buffer
+    @param size Size of the output buffer
+    @param caps Caps of the output buffer
+    @param buf The output buffer
+    @return GST_FLOW_OK
+*/
+
+static GstFlowReturn
+gst_shvideo_veu_prepare_output_buffer (GstBaseTransform * trans,
+				       GstBuffer * input, gint size,
+				       GstCaps * caps, GstBuffer ** buf);
+
+/** Gives upstream a buffer in a free input slot of the VEU memory, so
+    that the frame is read in place, or else allocates as the base
+    transform does
+    @param pad The sink pad
+    @param offset Offset of the buffer
+    @param size Size of the buffer
+    @param caps Caps of the buffer
+    @param buf The new buffer
+    @return GST_FLOW_OK if a buffer was allocated
+*/
+
+static GstFlowReturn gst_shvideo_veu_buffer_alloc (GstPad * pad,
+						   guint64 offset, guint size,
+						   GstCaps * caps,
+						   GstBuffer ** buf);
+
+/** Scales and converts a frame with the VEU
+    @param trans Gstreamer base transform
+    @param inbuf The NV12 input frame
+    @param outbuf The output frame
+    @return GST_FLOW_OK
+*/
+
+static GstFlowReturn gst_shvideo_veu_transform (GstBaseTransform * trans,
+						GstBuffer * inbuf,
+						GstBuffer * outbuf);
+
+/** Returns the physical address of data in the VEU memory
+    @param data Pointer to the data
+    @return the physical address, or 0 if the data is not in the VEU memory
+*/
+
+static unsigned long gst_shvideo_veu_phys (const guint8 * data);
+
+/** Releases the VEU memory reserved for the current caps. The mutex
+    must be held
+    @param shvideoveu VEU filter object
+*/
+
+static void gst_shvideo_veu_free_memory (GstshvideoVeu * shvideoveu);
+
+/** Reserves the VEU memory for a pool of as many slots as fit, up to
+    max_slots. The mutex must be held
+    @param slot_size Size of a slot
+    @param max_slots Maximum number of slots
+    @return the pool, or NULL if not even one slot fits
+*/
+
+static GstshvideoVeuPool *gst_shvideo_veu_pool_new (guint slot_size,
+						    guint max_slots);
+
+/** Wraps a free slot of the pool in a buffer. The mutex must be held
+    @param pool The pool
+    @param size Size of the buffer
+    @param caps Caps of the buffer
+    @return the buffer, or NULL if all the slots are in use
+*/
+
+static GstBuffer *gst_shvideo_veu_pool_get (GstshvideoVeuPool * pool,
+					    guint size, GstCaps * caps);
+
+/** Releases a reference to a pool, the last one gives back its VEU
+    memory. The mutex must be held
+    @param pool The pool
+*/
+
+static void gst_shvideo_veu_pool_unref (GstshvideoVeuPool * pool);
+
+/** Gives the slot back to the pool
+    @param buffer VEU memory buffer
+*/
+
+static void gst_shvideo_veu_buffer_finalize (GstshvideoVeuBuffer * buffer);
+
+/** Initialize the VEU memory buffer class
+    @param g_class Gclass
+    @param data user data pointer, unused in the function
+*/
+
+static void gst_shvideo_veu_buffer_class_init (gpointer g_class,
+					       gpointer data);
+
+/** Initialize the VEU filter plugin
+    @param plugin Gstreamer plugin
+    @return returns true if the plugin initialized and registered gst-sh-mobile-veu, else false
+*/
+
+gboolean gst_shvideo_veu_plugin_init (GstPlugin *plugin);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,42 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  SHCODECS_COMMON_H
+#define  SHCODECS_COMMON_H
+
+/**
+ * Formats of the encoded streams, the values are the stream types of
+ * the encoder control files
+ */
+
+typedef enum {
+  SHCodecs_Format_NONE = 0,
+  SHCodecs_Format_MPEG4 = 1,
+  SHCodecs_Format_H264 = 2
+} SHCodecs_Format;
+
+/** Reads the time the mock spends on each frame, emulating the VPU
+    @param name Name of the environment variable with the time in
+    microseconds
+    @return the time in microseconds, 0 if the variable is not set
+*/
+
+unsigned long shcodecs_mock_get_delay (const char *name);
+
+#endif
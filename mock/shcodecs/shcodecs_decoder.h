@@ -0,0 +1,109 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  SHCODECS_DECODER_H
+#define  SHCODECS_DECODER_H
+
+#include <shcodecs/shcodecs_common.h>
+
+typedef struct _SHCodecs_Decoder SHCodecs_Decoder;
+
+/**
+ * Called for every decoded frame. The planes stay valid until the
+ * callback returns
+ * @return 1 to return from shcodecs_decode() after the frame, 0 to go on
+ */
+
+typedef int (*SHCodecs_Decoded_Callback) (SHCodecs_Decoder * decoder,
+					  unsigned char * y_buf, int y_size,
+					  unsigned char * c_buf, int c_size,
+					  void * user_data);
+
+/** Creates a decoder emitting synthetic NV12 frames
+    @param width Width of the frames
+    @param height Height of the frames
+    @param format Format of the stream
+    @return the decoder, or NULL if out of memory
+*/
+
+SHCodecs_Decoder *shcodecs_decoder_init (int width, int height,
+					 SHCodecs_Format format);
+
+/** Releases a decoder
+    @param decoder The decoder
+*/
+
+void shcodecs_decoder_close (SHCodecs_Decoder * decoder);
+
+/** Sets the callback for the decoded frames
+    @param decoder The decoder
+    @param decoded_cb The callback
+    @param user_data Passed to the callback
+*/
+
+void shcodecs_decoder_set_decoded_callback (SHCodecs_Decoder * decoder,
+					    SHCodecs_Decoded_Callback decoded_cb,
+					    void * user_data);
+
+/** Selects physical addresses for the frames. The mock has no physical
+    memory and always gives the addresses of its own frames
+    @param decoder The decoder
+    @param use_physical 1 for physical addresses
+    @return the previous setting
+*/
+
+int shcodecs_decoder_set_use_physical (SHCodecs_Decoder * decoder,
+				       int use_physical);
+
+/** Selects whether the data given to shcodecs_decode() holds whole frames
+    @param decoder The decoder
+    @param frame_by_frame 1 if every call has whole frames
+    @return the previous setting
+*/
+
+int shcodecs_decoder_set_frame_by_frame (SHCodecs_Decoder * decoder,
+					 int frame_by_frame);
+
+/** Decodes a frame for every picture start code in the data. H.264 slices
+    with first_mb_in_slice 0 and MPEG-4 VOPs start a picture
+    @param decoder The decoder
+    @param data The stream
+    @param len Length of the stream
+    @return the number of bytes used
+*/
+
+int shcodecs_decode (SHCodecs_Decoder * decoder, unsigned char * data,
+		     int len);
+
+/** Ends the stream. The mock emits a frame as soon as its start code is
+    found, so no frame is left in the decoder
+    @param decoder The decoder
+    @return 0
+*/
+
+int shcodecs_decoder_finalize (SHCodecs_Decoder * decoder);
+
+/** Gets the number of decoded frames
+    @param decoder The decoder
+    @return the number of frames
+*/
+
+int shcodecs_decoder_get_frame_count (SHCodecs_Decoder * decoder);
+
+#endif
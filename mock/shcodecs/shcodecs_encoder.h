@@ -0,0 +1,230 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#ifndef  SHCODECS_ENCODER_H
+#define  SHCODECS_ENCODER_H
+
+#include <shcodecs/shcodecs_common.h>
+
+typedef struct _SHCodecs_Encoder SHCodecs_Encoder;
+
+/**
+ * Called when the encoder wants the next frame, the callback gives it
+ * with shcodecs_encoder_input_provide()
+ * @return 0 to go on, 1 at the end of the input
+ */
+
+typedef int (*SHCodecs_Encoder_Input) (SHCodecs_Encoder * encoder,
+				       void * user_data);
+
+/**
+ * Called with the encoded stream of a frame. The data is valid until the
+ * callback returns
+ * @return 0 to go on, 1 to stop the encoder
+ */
+
+typedef int (*SHCodecs_Encoder_Output) (SHCodecs_Encoder * encoder,
+					unsigned char * data, int length,
+					void * user_data);
+
+/**
+ * The encoder parameters set from the control file. Every parameter has
+ * a shcodecs_encoder_set_<name> function returning the previous value
+ * and a shcodecs_encoder_get_<name> function
+ */
+
+#define SHCODECS_ENCODER_PARAMS \
+  SHCODECS_ENCODER_PARAM(I_vop_interval) \
+  SHCODECS_ENCODER_PARAM(bitrate) \
+  SHCODECS_ENCODER_PARAM(control_bitrate_length) \
+  SHCODECS_ENCODER_PARAM(fcode_forward) \
+  SHCODECS_ENCODER_PARAM(frame_no_increment) \
+  SHCODECS_ENCODER_PARAM(frame_num_resolution) \
+  SHCODECS_ENCODER_PARAM(frame_number_to_encode) \
+  SHCODECS_ENCODER_PARAM(frame_rate) \
+  SHCODECS_ENCODER_PARAM(h264_Ivop_quant_initial_value) \
+  SHCODECS_ENCODER_PARAM(h264_Pvop_quant_initial_value) \
+  SHCODECS_ENCODER_PARAM(h264_call_unit) \
+  SHCODECS_ENCODER_PARAM(h264_changeable_max_bitrate) \
+  SHCODECS_ENCODER_PARAM(h264_chroma_qp_index_offset) \
+  SHCODECS_ENCODER_PARAM(h264_clip_dquant_frame) \
+  SHCODECS_ENCODER_PARAM(h264_clip_dquant_next_mb) \
+  SHCODECS_ENCODER_PARAM(h264_constrained_intra_pred) \
+  SHCODECS_ENCODER_PARAM(h264_constraint_set_flag) \
+  SHCODECS_ENCODER_PARAM(h264_deblocking_alpha_offset) \
+  SHCODECS_ENCODER_PARAM(h264_deblocking_beta_offset) \
+  SHCODECS_ENCODER_PARAM(h264_deblocking_mode) \
+  SHCODECS_ENCODER_PARAM(h264_intra_thr_1) \
+  SHCODECS_ENCODER_PARAM(h264_intra_thr_2) \
+  SHCODECS_ENCODER_PARAM(h264_level_type) \
+  SHCODECS_ENCODER_PARAM(h264_level_value) \
+  SHCODECS_ENCODER_PARAM(h264_mb_partition_vector_thr) \
+  SHCODECS_ENCODER_PARAM(h264_me_skip_mode) \
+  SHCODECS_ENCODER_PARAM(h264_out_vui_parameters) \
+  SHCODECS_ENCODER_PARAM(h264_param_changeable) \
+  SHCODECS_ENCODER_PARAM(h264_profile) \
+  SHCODECS_ENCODER_PARAM(h264_put_start_code) \
+  SHCODECS_ENCODER_PARAM(h264_quant_max) \
+  SHCODECS_ENCODER_PARAM(h264_quant_min) \
+  SHCODECS_ENCODER_PARAM(h264_quant_min_Ivop_under_range) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_Ivop_noskip) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_buffer_mode) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_buffer_unit_size) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_max_size) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_offset) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_offset_rate) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_remain_zero_skip_enable) \
+  SHCODECS_ENCODER_PARAM(h264_ratecontrol_cpb_skipcheck_enable) \
+  SHCODECS_ENCODER_PARAM(h264_regularly_inserted_I_type) \
+  SHCODECS_ENCODER_PARAM(h264_sad_intra_bias) \
+  SHCODECS_ENCODER_PARAM(h264_seq_param_set_id) \
+  SHCODECS_ENCODER_PARAM(h264_slice_size_bit) \
+  SHCODECS_ENCODER_PARAM(h264_slice_size_mb) \
+  SHCODECS_ENCODER_PARAM(h264_slice_type_value_pattern) \
+  SHCODECS_ENCODER_PARAM(h264_use_deblocking_filter_control) \
+  SHCODECS_ENCODER_PARAM(h264_use_dquant) \
+  SHCODECS_ENCODER_PARAM(h264_use_mb_partition) \
+  SHCODECS_ENCODER_PARAM(h264_use_slice) \
+  SHCODECS_ENCODER_PARAM(intra_macroblock_refresh_cycle) \
+  SHCODECS_ENCODER_PARAM(mpeg4_Ivop_quant_initial_value) \
+  SHCODECS_ENCODER_PARAM(mpeg4_Pvop_quant_initial_value) \
+  SHCODECS_ENCODER_PARAM(mpeg4_aspect_ratio_info_type) \
+  SHCODECS_ENCODER_PARAM(mpeg4_aspect_ratio_info_value) \
+  SHCODECS_ENCODER_PARAM(mpeg4_b_vop_num) \
+  SHCODECS_ENCODER_PARAM(mpeg4_changeable_max_bitrate) \
+  SHCODECS_ENCODER_PARAM(mpeg4_clip_dquant_frame) \
+  SHCODECS_ENCODER_PARAM(mpeg4_data_partitioned) \
+  SHCODECS_ENCODER_PARAM(mpeg4_error_resilience_mode) \
+  SHCODECS_ENCODER_PARAM(mpeg4_high_quality) \
+  SHCODECS_ENCODER_PARAM(mpeg4_intra_thr) \
+  SHCODECS_ENCODER_PARAM(mpeg4_out_gov) \
+  SHCODECS_ENCODER_PARAM(mpeg4_out_object_layer_identifier) \
+  SHCODECS_ENCODER_PARAM(mpeg4_out_visual_object_identifier) \
+  SHCODECS_ENCODER_PARAM(mpeg4_out_vos) \
+  SHCODECS_ENCODER_PARAM(mpeg4_param_changeable) \
+  SHCODECS_ENCODER_PARAM(mpeg4_quant_max) \
+  SHCODECS_ENCODER_PARAM(mpeg4_quant_min) \
+  SHCODECS_ENCODER_PARAM(mpeg4_quant_min_Ivop_under_range) \
+  SHCODECS_ENCODER_PARAM(mpeg4_quant_type) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_rcperiod_Ivop_noskip) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_rcperiod_skipcheck_enable) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_Ivop_noskip) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_buffer_mode) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_buffer_unit_size) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_max_size) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_offset) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_offset_rate) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_remain_zero_skip_enable) \
+  SHCODECS_ENCODER_PARAM(mpeg4_ratecontrol_vbv_skipcheck_enable) \
+  SHCODECS_ENCODER_PARAM(mpeg4_reversible_vlc) \
+  SHCODECS_ENCODER_PARAM(mpeg4_use_AC_prediction) \
+  SHCODECS_ENCODER_PARAM(mpeg4_use_dquant) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_object_layer_priority) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_object_layer_verid) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_object_type_indication) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_packet_header_extention) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_packet_size_bit) \
+  SHCODECS_ENCODER_PARAM(mpeg4_video_packet_size_mb) \
+  SHCODECS_ENCODER_PARAM(mpeg4_visual_object_priority) \
+  SHCODECS_ENCODER_PARAM(mpeg4_visual_object_verid) \
+  SHCODECS_ENCODER_PARAM(mpeg4_vop_min_mode) \
+  SHCODECS_ENCODER_PARAM(mpeg4_vop_min_size) \
+  SHCODECS_ENCODER_PARAM(mpeg4_vos_profile_level_type) \
+  SHCODECS_ENCODER_PARAM(mpeg4_vos_profile_level_value) \
+  SHCODECS_ENCODER_PARAM(mv_mode) \
+  SHCODECS_ENCODER_PARAM(noise_reduction) \
+  SHCODECS_ENCODER_PARAM(output_filler_enable) \
+  SHCODECS_ENCODER_PARAM(ratecontrol_intra_thr_changeable) \
+  SHCODECS_ENCODER_PARAM(ratecontrol_respect_type) \
+  SHCODECS_ENCODER_PARAM(ratecontrol_skip_enable) \
+  SHCODECS_ENCODER_PARAM(ratecontrol_use_prevquant) \
+  SHCODECS_ENCODER_PARAM(reaction_param_coeff) \
+  SHCODECS_ENCODER_PARAM(ref_frame_num) \
+  SHCODECS_ENCODER_PARAM(search_mode) \
+  SHCODECS_ENCODER_PARAM(search_time_fixed) \
+  SHCODECS_ENCODER_PARAM(stream_type) \
+  SHCODECS_ENCODER_PARAM(video_format) \
+  SHCODECS_ENCODER_PARAM(weightedQ_mode) \
+  SHCODECS_ENCODER_PARAM(xpic_size) \
+  SHCODECS_ENCODER_PARAM(ypic_size)
+
+#define SHCODECS_ENCODER_PARAM(name) \
+  long shcodecs_encoder_set_##name (SHCodecs_Encoder * encoder, long value); \
+  long shcodecs_encoder_get_##name (SHCodecs_Encoder * encoder);
+SHCODECS_ENCODER_PARAMS
+#undef SHCODECS_ENCODER_PARAM
+
+/** Creates an encoder emitting placeholder NAL units or VOPs
+    @param width Width of the frames
+    @param height Height of the frames
+    @param format Format of the stream
+    @return the encoder, or NULL if out of memory
+*/
+
+SHCodecs_Encoder *shcodecs_encoder_init (int width, int height,
+					 SHCodecs_Format format);
+
+/** Releases an encoder
+    @param encoder The encoder
+*/
+
+void shcodecs_encoder_close (SHCodecs_Encoder * encoder);
+
+/** Sets the callback asking for the frames
+    @param encoder The encoder
+    @param input_cb The callback
+    @param user_data Passed to the callback
+    @return 0
+*/
+
+int shcodecs_encoder_set_input_callback (SHCodecs_Encoder * encoder,
+					 SHCodecs_Encoder_Input input_cb,
+					 void * user_data);
+
+/** Sets the callback for the encoded stream
+    @param encoder The encoder
+    @param output_cb The callback
+    @param user_data Passed to the callback
+    @return 0
+*/
+
+int shcodecs_encoder_set_output_callback (SHCodecs_Encoder * encoder,
+					  SHCodecs_Encoder_Output output_cb,
+					  void * user_data);
+
+/** Encodes a NV12 frame, called from the input callback
+    @param encoder The encoder
+    @param y_input The luma plane
+    @param c_input The interleaved chroma plane
+    @return 0, or 1 if the output callback stopped the encoder
+*/
+
+int shcodecs_encoder_input_provide (SHCodecs_Encoder * encoder,
+				    unsigned char * y_input,
+				    unsigned char * c_input);
+
+/** Asks the input callback for frames until the end of the input or
+    until frame_number_to_encode frames are encoded
+    @param encoder The encoder
+    @return 0
+*/
+
+int shcodecs_encoder_run (SHCodecs_Encoder * encoder);
+
+#endif
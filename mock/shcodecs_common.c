@@ -0,0 +1,34 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+
+#include <shcodecs/shcodecs_common.h>
+
+unsigned long
+shcodecs_mock_get_delay (const char *name)
+{
+  const char *value = getenv(name);
+
+  if(!value)
+  {
+    return 0;
+  }
+  return strtoul(value, NULL, 10);
+}
@@ -0,0 +1,215 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shcodecs/shcodecs_decoder.h>
+
+struct _SHCodecs_Decoder
+{
+  int width;
+  int height;
+  SHCodecs_Format format;
+
+  SHCodecs_Decoded_Callback decoded_cb;
+  void *user_data;
+
+  int use_physical;
+  int frame_by_frame;
+
+  /* NV12 frame given to the callback */
+  unsigned char *frame;
+  int y_size;
+  int c_size;
+
+  int frame_count;
+  unsigned long delay;
+};
+
+/** Checks for a start code beginning a picture
+    @param decoder The decoder
+    @param data The stream
+    @param len Length of the stream
+    @return 1 if a picture starts at data
+*/
+
+static int
+shcodecs_decoder_picture_start (SHCodecs_Decoder * decoder,
+				unsigned char * data, int len)
+{
+  if(len < 5 || data[0] || data[1] || data[2] != 1)
+  {
+    return 0;
+  }
+
+  if(decoder->format == SHCodecs_Format_H264)
+  {
+    // A coded slice with first_mb_in_slice 0, coded as the single bit 1
+    return ((data[3] & 0x1f) == 1 || (data[3] & 0x1f) == 5) &&
+      (data[4] & 0x80);
+  }
+  return data[3] == 0xb6;
+}
+
+/** Fills the frame with a pattern moving with the frame number and gives
+    it to the callback
+    @param decoder The decoder
+    @return the return value of the callback
+*/
+
+static int
+shcodecs_decoder_emit_frame (SHCodecs_Decoder * decoder)
+{
+  int y;
+
+  for(y = 0; y < decoder->height; y++)
+  {
+    memset(decoder->frame + y * decoder->width,
+	   (y + decoder->frame_count) & 0xff, decoder->width);
+  }
+  memset(decoder->frame + decoder->y_size, 0x80, decoder->c_size);
+
+  if(decoder->delay)
+  {
+    usleep(decoder->delay);
+  }
+
+  decoder->frame_count++;
+
+  if(!decoder->decoded_cb)
+  {
+    return 0;
+  }
+  return decoder->decoded_cb(decoder,
+			     decoder->frame, decoder->y_size,
+			     decoder->frame + decoder->y_size, decoder->c_size,
+			     decoder->user_data);
+}
+
+SHCodecs_Decoder *
+shcodecs_decoder_init (int width, int height, SHCodecs_Format format)
+{
+  SHCodecs_Decoder *decoder;
+
+  decoder = calloc(1, sizeof(SHCodecs_Decoder));
+  if(!decoder)
+  {
+    return NULL;
+  }
+
+  decoder->width = width;
+  decoder->height = height;
+  decoder->format = format;
+  decoder->y_size = width * height;
+  decoder->c_size = width * height / 2;
+  decoder->frame = malloc(decoder->y_size + decoder->c_size);
+  if(!decoder->frame)
+  {
+    free(decoder);
+    return NULL;
+  }
+  decoder->delay = shcodecs_mock_get_delay("SHCODECS_MOCK_DECODE_US");
+
+  return decoder;
+}
+
+void
+shcodecs_decoder_close (SHCodecs_Decoder * decoder)
+{
+  if(!decoder)
+  {
+    return;
+  }
+  free(decoder->frame);
+  free(decoder);
+}
+
+void
+shcodecs_decoder_set_decoded_callback (SHCodecs_Decoder * decoder,
+				       SHCodecs_Decoded_Callback decoded_cb,
+				       void * user_data)
+{
+  decoder->decoded_cb = decoded_cb;
+  decoder->user_data = user_data;
+}
+
+int
+shcodecs_decoder_set_use_physical (SHCodecs_Decoder * decoder,
+				   int use_physical)
+{
+  int old = decoder->use_physical;
+
+  decoder->use_physical = use_physical;
+  return old;
+}
+
+int
+shcodecs_decoder_set_frame_by_frame (SHCodecs_Decoder * decoder,
+				     int frame_by_frame)
+{
+  int old = decoder->frame_by_frame;
+
+  decoder->frame_by_frame = frame_by_frame;
+  return old;
+}
+
+int
+shcodecs_decode (SHCodecs_Decoder * decoder, unsigned char * data, int len)
+{
+  int i;
+
+  for(i = 0; i + 4 < len; i++)
+  {
+    if(!shcodecs_decoder_picture_start(decoder, data + i, len - i))
+    {
+      continue;
+    }
+
+    if(shcodecs_decoder_emit_frame(decoder))
+    {
+      // The caller wants to return after the frame, the data up to the
+      // next picture is used
+      for(i += 3; i + 4 < len; i++)
+      {
+	if(shcodecs_decoder_picture_start(decoder, data + i, len - i))
+	{
+	  return i;
+	}
+      }
+      return len;
+    }
+    i += 3;
+  }
+
+  return len;
+}
+
+int
+shcodecs_decoder_finalize (SHCodecs_Decoder * decoder)
+{
+  return 0;
+}
+
+int
+shcodecs_decoder_get_frame_count (SHCodecs_Decoder * decoder)
+{
+  return decoder->frame_count;
+}
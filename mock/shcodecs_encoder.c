@@ -0,0 +1,257 @@
+/**
+ * Software stand-in for libshcodecs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA  02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shcodecs/shcodecs_encoder.h>
+
+#define SHCODECS_ENCODER_PARAM(name) SHCODECS_PARAM_##name,
+enum
+{
+  SHCODECS_ENCODER_PARAMS
+  SHCODECS_N_PARAMS
+};
+#undef SHCODECS_ENCODER_PARAM
+
+struct _SHCodecs_Encoder
+{
+  int width;
+  int height;
+  long params[SHCODECS_N_PARAMS];
+
+  SHCodecs_Encoder_Input input_cb;
+  void *input_data;
+  SHCodecs_Encoder_Output output_cb;
+  void *output_data;
+
+  /* Stream of the frame given to the output callback */
+  unsigned char *stream;
+  int stream_size;
+
+  int frames;
+  int stop;
+  unsigned long delay;
+};
+
+#define SHCODECS_ENCODER_PARAM(name)					\
+  long									\
+  shcodecs_encoder_set_##name (SHCodecs_Encoder * encoder, long value)	\
+  {									\
+    long old = encoder->params[SHCODECS_PARAM_##name];			\
+									\
+    encoder->params[SHCODECS_PARAM_##name] = value;			\
+    return old;								\
+  }									\
+									\
+  long									\
+  shcodecs_encoder_get_##name (SHCodecs_Encoder * encoder)		\
+  {									\
+    return encoder->params[SHCODECS_PARAM_##name];			\
+  }
+SHCODECS_ENCODER_PARAMS
+#undef SHCODECS_ENCODER_PARAM
+
+/* Headers written before the first frame and before every intra frame */
+static const unsigned char shcodecs_h264_headers[] = {
+  0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x1e, 0x8d, 0x68, 0x0b, 0x04,
+  0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x38, 0x80
+};
+
+static const unsigned char shcodecs_mpeg4_headers[] = {
+  0x00, 0x00, 0x01, 0xb0, 0x03,
+  0x00, 0x00, 0x01, 0xb5, 0x09,
+  0x00, 0x00, 0x01, 0x00,
+  0x00, 0x00, 0x01, 0x20, 0x08, 0xc8, 0x88, 0x80
+};
+
+SHCodecs_Encoder *
+shcodecs_encoder_init (int width, int height, SHCodecs_Format format)
+{
+  SHCodecs_Encoder *encoder;
+
+  encoder = calloc(1, sizeof(SHCodecs_Encoder));
+  if(!encoder)
+  {
+    return NULL;
+  }
+
+  encoder->width = width;
+  encoder->height = height;
+  encoder->stream_size = width * height * 3 / 2 + 64;
+  encoder->stream = malloc(encoder->stream_size);
+  if(!encoder->stream)
+  {
+    free(encoder);
+    return NULL;
+  }
+
+  encoder->params[SHCODECS_PARAM_stream_type] = format;
+  encoder->params[SHCODECS_PARAM_xpic_size] = width;
+  encoder->params[SHCODECS_PARAM_ypic_size] = height;
+  encoder->params[SHCODECS_PARAM_bitrate] = 1000000;
+  encoder->params[SHCODECS_PARAM_frame_rate] = 300;
+  encoder->params[SHCODECS_PARAM_frame_num_resolution] = 30;
+  encoder->params[SHCODECS_PARAM_frame_no_increment] = 1;
+  encoder->params[SHCODECS_PARAM_I_vop_interval] = 30;
+
+  encoder->delay = shcodecs_mock_get_delay("SHCODECS_MOCK_ENCODE_US");
+
+  return encoder;
+}
+
+void
+shcodecs_encoder_close (SHCodecs_Encoder * encoder)
+{
+  if(!encoder)
+  {
+    return;
+  }
+  free(encoder->stream);
+  free(encoder);
+}
+
+int
+shcodecs_encoder_set_input_callback (SHCodecs_Encoder * encoder,
+				     SHCodecs_Encoder_Input input_cb,
+				     void * user_data)
+{
+  encoder->input_cb = input_cb;
+  encoder->input_data = user_data;
+  return 0;
+}
+
+int
+shcodecs_encoder_set_output_callback (SHCodecs_Encoder * encoder,
+				      SHCodecs_Encoder_Output output_cb,
+				      void * user_data)
+{
+  encoder->output_cb = output_cb;
+  encoder->output_data = user_data;
+  return 0;
+}
+
+int
+shcodecs_encoder_input_provide (SHCodecs_Encoder * encoder,
+				unsigned char * y_input,
+				unsigned char * c_input)
+{
+  long *params = encoder->params;
+  int intra, y_size, length, size, i;
+
+  intra = params[SHCODECS_PARAM_I_vop_interval] <= 0 ||
+    encoder->frames % params[SHCODECS_PARAM_I_vop_interval] == 0;
+
+  // The bits of one frame at the bit rate, intra frames three times that
+  size = params[SHCODECS_PARAM_frame_num_resolution] > 0 ?
+    params[SHCODECS_PARAM_bitrate] / 8 *
+    params[SHCODECS_PARAM_frame_no_increment] /
+    params[SHCODECS_PARAM_frame_num_resolution] : 4096;
+  if(intra)
+  {
+    size *= 3;
+  }
+  if(size < 16)
+  {
+    size = 16;
+  }
+  if(size > encoder->stream_size - 64)
+  {
+    size = encoder->stream_size - 64;
+  }
+
+  length = 0;
+  if(params[SHCODECS_PARAM_stream_type] == SHCodecs_Format_H264)
+  {
+    if(intra)
+    {
+      memcpy(encoder->stream, shcodecs_h264_headers,
+	     sizeof(shcodecs_h264_headers));
+      length += sizeof(shcodecs_h264_headers);
+    }
+    // A slice with first_mb_in_slice 0, IDR or not
+    memcpy(encoder->stream + length, "\0\0\0\1", 4);
+    length += 4;
+    encoder->stream[length++] = intra ? 0x65 : 0x41;
+    encoder->stream[length++] = 0x88;
+  }
+  else
+  {
+    if(!encoder->frames)
+    {
+      memcpy(encoder->stream, shcodecs_mpeg4_headers,
+	     sizeof(shcodecs_mpeg4_headers));
+      length += sizeof(shcodecs_mpeg4_headers);
+    }
+    // A VOP, vop_coding_type in the two most significant bits
+    memcpy(encoder->stream + length, "\0\0\1\xb6", 4);
+    length += 4;
+    encoder->stream[length++] = intra ? 0x10 : 0x50;
+  }
+
+  // The payload samples the input like the VPU reading it, the set
+  // most significant bit keeps start codes out of it
+  y_size = encoder->width * encoder->height;
+  for(i = 0; i < size; i++)
+  {
+    encoder->stream[length + i] =
+      (i & 1 ? c_input[(i * 61) % (y_size / 2)] : y_input[(i * 127) % y_size])
+      | 0x80;
+  }
+  length += size;
+
+  if(encoder->delay)
+  {
+    usleep(encoder->delay);
+  }
+
+  encoder->frames++;
+
+  if(encoder->output_cb &&
+     encoder->output_cb(encoder, encoder->stream, length,
+			encoder->output_data))
+  {
+    encoder->stop = 1;
+    return 1;
+  }
+  return 0;
+}
+
+int
+shcodecs_encoder_run (SHCodecs_Encoder * encoder)
+{
+  long to_encode;
+
+  encoder->stop = 0;
+  while(!encoder->stop && encoder->input_cb)
+  {
+    to_encode = encoder->params[SHCODECS_PARAM_frame_number_to_encode];
+    if(to_encode > 0 && encoder->frames >= to_encode)
+    {
+      break;
+    }
+    if(encoder->input_cb(encoder, encoder->input_data))
+    {
+      break;
+    }
+  }
+
+  return 0;
+}
@@ -31,7 +31,10 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/file.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <linux/fb.h>
 #include <inttypes.h>
 #include <unistd.h>
@@ -132,16 +135,19 @@ struct fb_info {
     unsigned long height;
     unsigned long bpp;
     unsigned long line_length;
+    unsigned long red_offset;
+    unsigned long blue_offset;
 
     unsigned long address;
     unsigned long size;
+
+    unsigned char *iomem; /* mapped by the first sh_veu_clear_rect */
 };
 
 static int get_fb_info(char *device, struct fb_info *fip)
 {
     struct fb_var_screeninfo vinfo;
     struct fb_fix_screeninfo finfo;
-    void *iomem;
     int fd;
 
     fd = open(device, O_RDWR);
@@ -158,6 +164,8 @@ static int get_fb_info(char *device, struct fb_info *fip)
     fip->width = vinfo.xres;
     fip->height = vinfo.yres;
     fip->bpp = vinfo.bits_per_pixel;
+    fip->red_offset = vinfo.red.offset;
+    fip->blue_offset = vinfo.blue.offset;
 
     if (ioctl(fd, FBIOGET_FSCREENINFO, &finfo) == -1) {
         perror("ioctl(FBIOGET_FSCREENINFO)");
@@ -168,18 +176,94 @@ static int get_fb_info(char *device, struct fb_info *fip)
     fip->size = finfo.smem_len;
     fip->line_length = finfo.line_length;
 
-    iomem = mmap(0, fip->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    /* the contents are left alone, see sh_veu_clear_rect */
+    close(fd);
+    return 0;
+}
+
+static void unmap_uio_map(struct uio_map *ump)
+{
+    munmap(ump->iomem, ump->size);
+}
+
+static void release_uio_device(struct uio_device *udp)
+{
+    close(udp->fd);
+    free(udp->name);
+    free(udp->path);
+}
+
+static int map_fb(char *device, struct fb_info *fip)
+{
+    void *iomem;
+    int fd;
+
+    fd = open(device, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
 
+    iomem = mmap(0, fip->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
     if (iomem == MAP_FAILED) {
         perror("mmap");
         return -1;
     }
+    fip->iomem = iomem;
+    return 0;
+}
 
-    /* clear framebuffer */
-    memset(iomem, 0, fip->line_length * fip->height);
-    munmap(iomem, fip->size);
+static void unmap_fb(struct fb_info *fip)
+{
+    munmap(fip->iomem, fip->size);
+}
+
+/* Access to the UIO devices and the framebuffer. The hardware backend
+ * uses /sys/class/uio, /dev/uioN and /dev/fb0, the fake one memory, see
+ * sh_veu_get_backend */
+struct sh_veu_backend {
+    const char *name;
+    int (*locate)(char *name, struct uio_device *udp);
+    int (*map)(struct uio_device *udp, int nr, struct uio_map *ump);
+    void (*unmap)(struct uio_map *ump);
+    void (*release)(struct uio_device *udp);
+    int (*get_fb_info)(char *device, struct fb_info *fip);
+    int (*map_fb)(char *device, struct fb_info *fip);
+    void (*unmap_fb)(struct fb_info *fip);
+    /* called before the VEU is started */
+    void (*irq_enable)(struct uio_device *udp);
+    void (*irq_wait)(struct uio_device *udp);
+    /* consumes the pending interrupts */
+    void (*irq_drain)(struct uio_device *udp);
+    void (*lock)(struct uio_device *udp, int lock);
+};
+
+static struct sh_veu_backend *sh_veu_get_backend(void);
+
+/* Fills a rectangle of the framebuffer with black. The framebuffer
+ * stays mapped for the next call */
+static int sh_veu_clear_rect(char *device, struct fb_info *fip,
+                             unsigned long x, unsigned long y,
+                             unsigned long w, unsigned long h)
+{
+    unsigned long i, bytes_pp;
+
+    if (x >= fip->width || y >= fip->height)
+        return 0;
+    if (x + w > fip->width)
+        w = fip->width - x;
+    if (y + h > fip->height)
+        h = fip->height - y;
+
+    if (!fip->iomem && sh_veu_get_backend()->map_fb(device, fip) < 0)
+        return -1;
+
+    bytes_pp = fip->bpp / 8;
+    for (i = 0; i < h; i++)
+        memset(fip->iomem + (y + i) * fip->line_length + x * bytes_pp, 0,
+               w * bytes_pp);
 
-    close(fd);
     return 0;
 }
 
@@ -222,18 +306,19 @@ static int get_fb_info(char *device, struct fb_info *fip)
 #define VCOFFR 0x224 /* color conversion offset */
 #define VCBR   0x228 /* color conversion clip */
 
-/* Helper functions for reading registers. */
+/* Helper functions for reading registers. The registers are 32 bit
+ * wide whatever the size of a long */
 
 static unsigned long read_reg(struct uio_map *ump, int reg_offs)
 {
-    volatile unsigned long *reg = ump->iomem;
+    volatile uint32_t *reg = ump->iomem;
 
     return reg[reg_offs / 4];
 }
 
 static void write_reg(struct uio_map *ump, unsigned long value, int reg_offs)
 {
-    volatile unsigned long *reg = ump->iomem;
+    volatile uint32_t *reg = ump->iomem;
 
     reg[reg_offs / 4] = value;
 }
@@ -261,6 +346,216 @@ static struct uio_device uio_dev;
 static struct uio_device vpu_dev;
 static struct uio_map uio_mmio, uio_mem_, vpu_mem, vpu_mmio;
 
+/* The devices are looked up and mapped by the first probe and unmapped
+ * by the destroy matching the last one. sh_veu_users counts the probes
+ * that have not been matched by a destroy. sh_veu_probe_mutex guards
+ * it, the found flags and the mappings */
+static int sh_veu_fb_found, sh_veu_vpu_found, sh_veu_veu_found;
+static int sh_veu_users;
+static pthread_mutex_t sh_veu_probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void uio_irq_enable(struct uio_device *udp)
+{
+    unsigned long enable = 1;
+
+    write(udp->fd, &enable, sizeof(unsigned long));
+}
+
+static void uio_irq_wait(struct uio_device *udp)
+{
+    unsigned long n_pending;
+
+    read(udp->fd, &n_pending, sizeof(unsigned long));
+}
+
+static void uio_irq_drain(struct uio_device *udp)
+{
+    struct pollfd pfd = { udp->fd, POLLIN, 0 };
+    unsigned long n_pending;
+
+    while (poll(&pfd, 1, 0) > 0)
+        read(udp->fd, &n_pending, sizeof(unsigned long));
+}
+
+static void uio_lock(struct uio_device *udp, int lock)
+{
+    flock(udp->fd, lock ? LOCK_EX : LOCK_UN);
+}
+
+static struct sh_veu_backend sh_veu_uio_backend = {
+    "uio",
+    locate_uio_device,
+    setup_uio_map,
+    unmap_uio_map,
+    release_uio_device,
+    get_fb_info,
+    map_fb,
+    unmap_fb,
+    uio_irq_enable,
+    uio_irq_wait,
+    uio_irq_drain,
+    uio_lock,
+};
+
+/* Fake backend for running without the hardware. The registers and the
+ * memories are plain memory and the physical addresses are the virtual
+ * ones. A conversion ends SH_VEU_FAKE_LATENCY_US microseconds after the
+ * start, the blits are recorded instead of done. SH_VEU_FAKE_FB gives
+ * the framebuffer as WIDTHxHEIGHTxBPP */
+
+#define SH_VEU_FAKE_LOG 64
+
+struct sh_veu_fake_blit {
+    unsigned long src_y, src_c, src_size;
+    unsigned long dst_y, dst_pitch;
+    struct timeval started, ended;
+};
+
+static struct {
+    unsigned long latency_us;
+    struct timeval started;
+    unsigned long blits;
+    struct sh_veu_fake_blit log[SH_VEU_FAKE_LOG];
+} sh_veu_fake;
+
+static int fake_locate(char *name, struct uio_device *udp)
+{
+    char *env;
+
+    env = getenv("SH_VEU_FAKE_LATENCY_US");
+    sh_veu_fake.latency_us = env ? strtoul(env, NULL, 0) : 2000;
+
+    udp->name = strdup(name);
+    udp->path = strdup("fake");
+    udp->fd = -1;
+    return 0;
+}
+
+static int fake_map(struct uio_device *udp, int nr, struct uio_map *ump)
+{
+    /* registers of a VEU2H, up to VCBR, or 4MB of memory */
+    ump->size = nr ? 4 << 20 : 0x400;
+    ump->iomem = calloc(1, ump->size);
+    if (!ump->iomem)
+        return -1;
+    ump->address = (unsigned long)ump->iomem;
+    return 0;
+}
+
+static void fake_unmap(struct uio_map *ump)
+{
+    free(ump->iomem);
+}
+
+static void fake_release(struct uio_device *udp)
+{
+    free(udp->name);
+    free(udp->path);
+}
+
+static int fake_get_fb_info(char *device, struct fb_info *fip)
+{
+    char *env;
+
+    fip->width = 800;
+    fip->height = 480;
+    fip->bpp = 16;
+    env = getenv("SH_VEU_FAKE_FB");
+    if (env)
+        sscanf(env, "%lux%lux%lu", &fip->width, &fip->height, &fip->bpp);
+
+    fip->red_offset = fip->bpp == 16 ? 11 : 16;
+    fip->blue_offset = 0;
+    fip->line_length = fip->width * (fip->bpp / 8);
+    fip->size = fip->line_length * fip->height;
+    fip->iomem = calloc(1, fip->size);
+    if (!fip->iomem)
+        return -1;
+    fip->address = (unsigned long)fip->iomem;
+    return 0;
+}
+
+static int fake_map_fb(char *device, struct fb_info *fip)
+{
+    /* allocated by fake_get_fb_info */
+    return fip->iomem ? 0 : -1;
+}
+
+static void fake_unmap_fb(struct fb_info *fip)
+{
+    free(fip->iomem);
+}
+
+static void fake_irq_enable(struct uio_device *udp)
+{
+    gettimeofday(&sh_veu_fake.started, NULL);
+}
+
+static void fake_irq_wait(struct uio_device *udp)
+{
+    struct sh_veu_fake_blit *blit;
+    struct timeval now;
+    long long left;
+
+    blit = &sh_veu_fake.log[sh_veu_fake.blits++ % SH_VEU_FAKE_LOG];
+    blit->src_y = read_reg(&uio_mmio, VSAYR);
+    blit->src_c = read_reg(&uio_mmio, VSACR);
+    blit->src_size = read_reg(&uio_mmio, VESSR);
+    blit->dst_y = read_reg(&uio_mmio, VDAYR);
+    blit->dst_pitch = read_reg(&uio_mmio, VEDWR);
+    blit->started = sh_veu_fake.started;
+
+    gettimeofday(&now, NULL);
+    left = sh_veu_fake.latency_us
+        - (now.tv_sec - sh_veu_fake.started.tv_sec) * 1000000LL
+        - (now.tv_usec - sh_veu_fake.started.tv_usec);
+    if (left > 0)
+        usleep(left);
+
+    gettimeofday(&blit->ended, NULL);
+    write_reg(&uio_mmio, 0, VESTR);
+    write_reg(&uio_mmio, 1, VEVTR);
+}
+
+static void fake_irq_drain(struct uio_device *udp)
+{
+}
+
+static void fake_lock(struct uio_device *udp, int lock)
+{
+}
+
+static struct sh_veu_backend sh_veu_fake_backend = {
+    "fake",
+    fake_locate,
+    fake_map,
+    fake_unmap,
+    fake_release,
+    fake_get_fb_info,
+    fake_map_fb,
+    fake_unmap_fb,
+    fake_irq_enable,
+    fake_irq_wait,
+    fake_irq_drain,
+    fake_lock,
+};
+
+/* The backend is selected with SH_VEU_BACKEND=fake or uio, the default */
+static struct sh_veu_backend *sh_veu_get_backend(void)
+{
+    static struct sh_veu_backend *backend;
+    char *env;
+
+    if (!backend) {
+        env = getenv("SH_VEU_BACKEND");
+        if (env && !strcmp(env, "fake"))
+            backend = &sh_veu_fake_backend;
+        else
+            backend = &sh_veu_uio_backend;
+    }
+    return backend;
+}
+
 struct sh_veu_plane {
     unsigned long width;
     unsigned long height;
@@ -269,61 +564,229 @@ struct sh_veu_plane {
     unsigned long pos_y;
 };
 
-static struct sh_veu_plane _src, _dst;
-static vidix_playback_t my_info;
+/* Per stream state. The VEU itself is shared, the scheduler programs
+ * the registers of a stream for each of its frames under the arbiter
+ * lock. A context has at most one job queued at a time */
+struct sh_veu_context {
+    vidix_playback_t info;
+    struct sh_veu_plane src, dst;
+
+    /* Memory to memory conversion of info.src, used instead of the
+     * framebuffer output when set */
+    int convert;
+    unsigned long src_stride;
+    unsigned long dst_w, dst_h, dst_stride, dst_addr;
+    int dst_format;
+
+    /* Job state and latency accounting, under sh_veu_sched_mutex. busy
+     * is set from the submit of a job to its end */
+    int busy;
+    struct sh_veu_context *next;
+    struct timeval queued, started;
+    unsigned long jobs;
+    unsigned long long wait_us, run_us, max_latency_us;
+};
 
-static int sh_veu_probe(int verbose, int force)
+/* Used through the vidix driver interface */
+static struct sh_veu_context sh_veu_default_ctx;
+
+/* Arbiter of the VEU. The mutex orders the threads of this plugin, the
+ * file lock the other plugins and the users that opened the VEU on
+ * their own */
+static pthread_mutex_t sh_veu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void sh_veu_lock(void)
 {
-    int ret;
+    pthread_mutex_lock(&sh_veu_mutex);
+    sh_veu_get_backend()->lock(&uio_dev, 1);
+}
 
-    ret = get_fb_info("/dev/fb0", &fbi);
-    if (ret < 0)
-        return ret;
+static void sh_veu_unlock(void)
+{
+    sh_veu_get_backend()->lock(&uio_dev, 0);
+    pthread_mutex_unlock(&sh_veu_mutex);
+}
+
+/* Pixel formats the VEU can write */
+enum sh_veu_format {
+    SH_VEU_NV12,
+    SH_VEU_RGB565,
+    SH_VEU_RGB888,   /* 24bpp */
+    SH_VEU_RGBX8888, /* 32bpp, the top byte is unused */
+};
+
+/* VTRCR fields */
+#define VTRCR_DST_FMT_YCBCR420 (0 << 22)
+#define VTRCR_DST_FMT_RGB565   (6 << 16)
+#define VTRCR_DST_FMT_RGBX888  (19 << 16)
+#define VTRCR_DST_FMT_RGB888   (21 << 16)
+#define VTRCR_SRC_FMT_YCBCR420 (0 << 14)
+#define VTRCR_FULL_COLOR_CONV  (1 << 2)
+#define VTRCR_TE_BIT_SET       (1 << 1)
+
+static void sh_veu_setup_transform(enum sh_veu_format dst_format, int bgr);
+static int sh_veu_init(void);
 
-    if (fbi.bpp != 16) {
-        printf("sh_veu: only 16bpp supported\n");
+/* Returns the VEU output format matching the framebuffer */
+static int sh_veu_fb_format(struct fb_info *fip)
+{
+    switch (fip->bpp) {
+    case 16:
+        return SH_VEU_RGB565;
+    case 24:
+        return SH_VEU_RGB888;
+    case 32:
+        return SH_VEU_RGBX8888;
+    default:
         return -1;
     }
+}
+
+static int sh_veu_is_veu2h(void)
+{
+    return uio_mmio.size > 0xb8;
+}
+
+/* Returns 1 if the framebuffer has blue in the most significant bits */
+static int sh_veu_fb_bgr(struct fb_info *fip)
+{
+    return fip->red_offset < fip->blue_offset;
+}
 
-    ret = locate_uio_device("VPU", &vpu_dev);
+/* Locates the VEU and maps its registers and contiguous memory */
+static int sh_veu_probe_veu(void)
+{
+    int ret;
+
+    if (sh_veu_veu_found)
+        return 0;
+
+    ret = sh_veu_get_backend()->locate("VEU", &uio_dev);
     if (ret < 0) {
-        printf("sh_veu: unable to locate matching VPU device\n");
+        printf("sh_veu: unable to locate matching UIO device\n");
         return ret;
     }
 
-    ret = setup_uio_map(&vpu_dev, 0, &vpu_mmio);
+    ret = sh_veu_get_backend()->map(&uio_dev, 0, &uio_mmio);
     if (ret < 0) {
-        printf("sh_veu: cannot setup (vpu) MMIO\n");
+        printf("sh_veu: cannot setup MMIO\n");
+        sh_veu_get_backend()->release(&uio_dev);
         return ret;
     }
 
-    ret = setup_uio_map(&vpu_dev, 1, &vpu_mem);
+    ret = sh_veu_get_backend()->map(&uio_dev, 1, &uio_mem_);
     if (ret < 0) {
-        printf("sh_veu: cannot setup contiguous (vpu) memory\n");
+        printf("sh_veu: cannot setup contiguous memory\n");
+        sh_veu_get_backend()->unmap(&uio_mmio);
+        sh_veu_get_backend()->release(&uio_dev);
         return ret;
-    } else {
-      printf("sh_veu: vpu memory %lx\n",
-	     vpu_mem.address);
     }
-    
-    ret = locate_uio_device("VEU", &uio_dev);
+
+    sh_veu_veu_found = 1;
+
+    /* reset once, the VEU may be running jobs of other users later */
+    sh_veu_init();
+    return ret;
+}
+
+/* Locates the VPU and maps its registers and decoded picture memory */
+static int sh_veu_probe_vpu(void)
+{
+    int ret;
+
+    if (sh_veu_vpu_found)
+        return 0;
+
+    ret = sh_veu_get_backend()->locate("VPU", &vpu_dev);
     if (ret < 0) {
-        printf("sh_veu: unable to locate matching UIO device\n");
+        printf("sh_veu: unable to locate matching VPU device\n");
         return ret;
     }
 
-    ret = setup_uio_map(&uio_dev, 0, &uio_mmio);
+    ret = sh_veu_get_backend()->map(&vpu_dev, 0, &vpu_mmio);
     if (ret < 0) {
-        printf("sh_veu: cannot setup MMIO\n");
+        printf("sh_veu: cannot setup (vpu) MMIO\n");
+        sh_veu_get_backend()->release(&vpu_dev);
         return ret;
     }
 
-    ret = setup_uio_map(&uio_dev, 1, &uio_mem_);
+    ret = sh_veu_get_backend()->map(&vpu_dev, 1, &vpu_mem);
     if (ret < 0) {
-        printf("sh_veu: cannot setup contiguous memory\n");
+        printf("sh_veu: cannot setup contiguous (vpu) memory\n");
+        sh_veu_get_backend()->unmap(&vpu_mmio);
+        sh_veu_get_backend()->release(&vpu_dev);
         return ret;
     }
 
+    printf("sh_veu: vpu memory %lx\n", vpu_mem.address);
+
+    sh_veu_vpu_found = 1;
+    return ret;
+}
+
+/* Unmaps all the devices, with sh_veu_probe_mutex held */
+static void sh_veu_unmap(void)
+{
+    struct sh_veu_backend *backend = sh_veu_get_backend();
+
+    if (sh_veu_veu_found) {
+        write_reg(&uio_mmio, 0, VEIER); /* disable interrupt in VEU */
+        backend->unmap(&uio_mem_);
+        backend->unmap(&uio_mmio);
+        backend->release(&uio_dev);
+        sh_veu_veu_found = 0;
+    }
+
+    if (sh_veu_vpu_found) {
+        backend->unmap(&vpu_mem);
+        backend->unmap(&vpu_mmio);
+        backend->release(&vpu_dev);
+        sh_veu_vpu_found = 0;
+    }
+
+    if (sh_veu_fb_found) {
+        if (fbi.iomem)
+            backend->unmap_fb(&fbi);
+        fbi.iomem = NULL;
+        sh_veu_fb_found = 0;
+    }
+}
+
+/* Looks up and maps the framebuffer, the VPU and the VEU, with
+ * sh_veu_probe_mutex held */
+static int sh_veu_probe_all(void)
+{
+    int ret;
+
+    if (sh_veu_fb_found && sh_veu_vpu_found && sh_veu_veu_found)
+        return 0;
+
+    if (!sh_veu_fb_found) {
+        ret = sh_veu_get_backend()->get_fb_info("/dev/fb0", &fbi);
+        if (ret < 0)
+            return ret;
+        sh_veu_fb_found = 1;
+    }
+
+    if (sh_veu_fb_format(&fbi) < 0) {
+        printf("sh_veu: %ldbpp not supported, only 16, 24 and 32bpp\n",
+               fbi.bpp);
+        return -1;
+    }
+
+    ret = sh_veu_probe_vpu();
+    if (ret < 0)
+        return ret;
+
+    ret = sh_veu_probe_veu();
+    if (ret < 0)
+        return ret;
+
+    /* BGR is written by swapping the rows of the color matrix */
+    if (sh_veu_fb_bgr(&fbi) && !sh_veu_is_veu2h())
+        printf("sh_veu: no color matrix for the BGR framebuffer, "
+               "red and blue will be swapped\n");
+
     printf("sh_veu: Using %s at %s on %lux%lu %ldbpp /dev/fb0\n",
            uio_dev.name, uio_dev.path,
            fbi.width, fbi.height, fbi.bpp);
@@ -331,19 +794,58 @@ static int sh_veu_probe(int verbose, int force)
     return ret;
 }
 
-static void sh_veu_wait_irq(vidix_playback_t *info)
+/* Counts a user of the devices, or unmaps what a failed first probe
+ * mapped. With sh_veu_probe_mutex held */
+static int sh_veu_probe_done(int ret)
 {
-    unsigned long n_pending;
+    if (ret < 0) {
+        if (!sh_veu_users)
+            sh_veu_unmap();
+        return ret;
+    }
 
-    /* Wait for an interrupt */
-    read(uio_dev.fd, &n_pending, sizeof(unsigned long));
+    sh_veu_users++;
+    return ret;
+}
 
-    write_reg(&uio_mmio, 0x100, VEVTR); /* ack int, write 0 to bit 0 */
+static int sh_veu_probe(int verbose, int force)
+{
+    int ret;
+
+    pthread_mutex_lock(&sh_veu_probe_mutex);
+    ret = sh_veu_probe_done(sh_veu_probe_all());
+    pthread_mutex_unlock(&sh_veu_probe_mutex);
+
+    return ret;
 }
 
-static int sh_veu_is_veu2h(void)
+/* Probes the VEU alone, for memory to memory conversions */
+static int sh_veu_probe_convert(void)
 {
-    return uio_mmio.size > 0xb8;
+    int ret;
+
+    pthread_mutex_lock(&sh_veu_probe_mutex);
+    ret = sh_veu_probe_done(sh_veu_probe_veu());
+    pthread_mutex_unlock(&sh_veu_probe_mutex);
+
+    return ret;
+}
+
+/* Counts one more user of devices already probed, for memory in use
+ * after the user that probed is gone. Matched by a destroy */
+static void sh_veu_ref(void)
+{
+    pthread_mutex_lock(&sh_veu_probe_mutex);
+    sh_veu_users++;
+    pthread_mutex_unlock(&sh_veu_probe_mutex);
+}
+
+static void sh_veu_wait_irq(vidix_playback_t *info)
+{
+    /* Wait for an interrupt */
+    sh_veu_get_backend()->irq_wait(&uio_dev);
+
+    write_reg(&uio_mmio, 0x100, VEVTR); /* ack int, write 0 to bit 0 */
 }
 
 static unsigned long sh_veu_do_scale(struct uio_map *ump,
@@ -464,52 +966,350 @@ static void sh_veu_setup_planes(vidix_playback_t *info,
     write_reg(&uio_mmio, addr, VDAYR);
     write_reg(&uio_mmio, 0, VDACR); /* unused for RGB */
 
-    write_reg(&uio_mmio, 0x67, VSWPR);
-    write_reg(&uio_mmio, (6 << 16) | (0 << 14) | 2 | 4, VTRCR);
+    sh_veu_setup_transform(sh_veu_fb_format(&fbi), sh_veu_fb_bgr(&fbi));
+
+    write_reg(&uio_mmio, 1, VEIER); /* enable interrupt in VEU */
+}
+
+/* Sets the byte swapping, format conversion and color matrix. The
+ * VEU writes red in the most significant bits of a pixel, bgr swaps
+ * the red and blue rows of the matrix to write blue there */
+static void sh_veu_setup_transform(enum sh_veu_format dst_format, int bgr)
+{
+    unsigned long vtrcr;
+    unsigned long red, blue;
+
+    if (dst_format == SH_VEU_NV12) {
+        write_reg(&uio_mmio, 0x77, VSWPR);
+        write_reg(&uio_mmio, VTRCR_DST_FMT_YCBCR420 |
+                  VTRCR_SRC_FMT_YCBCR420, VTRCR);
+        return;
+    }
+
+    /* RGB is written in the pixel size, 24bpp as a byte stream */
+    switch (dst_format) {
+    case SH_VEU_RGB888:
+        write_reg(&uio_mmio, 0x77, VSWPR);
+        vtrcr = VTRCR_DST_FMT_RGB888;
+        break;
+    case SH_VEU_RGBX8888:
+        write_reg(&uio_mmio, 0x47, VSWPR);
+        vtrcr = VTRCR_DST_FMT_RGBX888;
+        break;
+    default:
+        write_reg(&uio_mmio, 0x67, VSWPR);
+        vtrcr = VTRCR_DST_FMT_RGB565;
+        break;
+    }
+
+    write_reg(&uio_mmio, vtrcr | VTRCR_SRC_FMT_YCBCR420 |
+              VTRCR_TE_BIT_SET | VTRCR_FULL_COLOR_CONV, VTRCR);
 
     if (sh_veu_is_veu2h()) {
-        write_reg(&uio_mmio, 0x0cc5, VMCR00);
-        write_reg(&uio_mmio, 0x0950, VMCR01);
-        write_reg(&uio_mmio, 0x0000, VMCR02);
+        /* rows are the output components, columns Cr, Y and Cb */
+        red = bgr ? VMCR20 : VMCR00;
+        blue = bgr ? VMCR00 : VMCR20;
+
+        write_reg(&uio_mmio, 0x0cc5, red);
+        write_reg(&uio_mmio, 0x0950, red + 4);
+        write_reg(&uio_mmio, 0x0000, red + 8);
 
         write_reg(&uio_mmio, 0x397f, VMCR10);
         write_reg(&uio_mmio, 0x0950, VMCR11);
         write_reg(&uio_mmio, 0x3ccd, VMCR12);
 
-        write_reg(&uio_mmio, 0x0000, VMCR20);
-        write_reg(&uio_mmio, 0x0950, VMCR21);
-        write_reg(&uio_mmio, 0x1023, VMCR22);
+        write_reg(&uio_mmio, 0x0000, blue);
+        write_reg(&uio_mmio, 0x0950, blue + 4);
+        write_reg(&uio_mmio, 0x1023, blue + 8);
 
         write_reg(&uio_mmio, 0x00800010, VCOFFR);
     }
+}
+
+/* Sets up a memory to memory conversion of a NV12 image. Addresses
+ * are physical, the c plane of a NV12 destination follows the y plane */
+static void sh_veu_setup_convert(unsigned long src_w, unsigned long src_h,
+                                 unsigned long src_stride,
+                                 unsigned long dst_w, unsigned long dst_h,
+                                 unsigned long dst_stride,
+                                 unsigned long dst_addr,
+                                 enum sh_veu_format dst_format)
+{
+    src_w = sh_veu_do_scale(&uio_mmio, 0, src_w, dst_w, dst_w);
+    src_h = sh_veu_do_scale(&uio_mmio, 1, src_h, dst_h, dst_h);
+
+    write_reg(&uio_mmio, src_stride, VESWR);
+    write_reg(&uio_mmio, src_w | (src_h << 16), VESSR);
+    write_reg(&uio_mmio, 0, VBSSR); /* not using bundle mode */
+
+    write_reg(&uio_mmio, dst_stride, VEDWR);
+    write_reg(&uio_mmio, dst_addr, VDAYR);
+    if (dst_format == SH_VEU_NV12)
+        write_reg(&uio_mmio, dst_addr + dst_stride * dst_h, VDACR);
+    else
+        write_reg(&uio_mmio, 0, VDACR); /* unused for RGB */
+
+    sh_veu_setup_transform(dst_format, 0);
 
     write_reg(&uio_mmio, 1, VEIER); /* enable interrupt in VEU */
 }
 
+/* Allocator for the contiguous VEU memory, offsets are from uio_mem_.
+ * Each plugin including this file has its own allocator, only the VEU
+ * filter plugin allocates */
+
+#define SH_VEU_MAX_ALLOCS 32
+
+static struct {
+    unsigned long offset;
+    unsigned long size;
+} sh_veu_allocs[SH_VEU_MAX_ALLOCS];
+static int sh_veu_n_allocs;
+
+static long sh_veu_mem_alloc(unsigned long size)
+{
+    unsigned long offset = 0;
+    int i;
+
+    size = (size + 31) & ~31;
+
+    if (sh_veu_n_allocs == SH_VEU_MAX_ALLOCS)
+        return -1;
+
+    /* first fit, the list is sorted by offset */
+    for (i = 0; i < sh_veu_n_allocs; i++) {
+        if (sh_veu_allocs[i].offset - offset >= size)
+            break;
+        offset = sh_veu_allocs[i].offset + sh_veu_allocs[i].size;
+    }
+
+    if (offset + size > uio_mem_.size)
+        return -1;
+
+    memmove(&sh_veu_allocs[i + 1], &sh_veu_allocs[i],
+            (sh_veu_n_allocs - i) * sizeof(sh_veu_allocs[0]));
+    sh_veu_allocs[i].offset = offset;
+    sh_veu_allocs[i].size = size;
+    sh_veu_n_allocs++;
+
+    return offset;
+}
+
+static void sh_veu_mem_free(long offset)
+{
+    int i;
+
+    for (i = 0; i < sh_veu_n_allocs; i++) {
+        if (sh_veu_allocs[i].offset == offset) {
+            sh_veu_n_allocs--;
+            memmove(&sh_veu_allocs[i], &sh_veu_allocs[i + 1],
+                    (sh_veu_n_allocs - i) * sizeof(sh_veu_allocs[0]));
+            return;
+        }
+    }
+}
+
 static void sh_veu_blit(vidix_playback_t *info, int frame)
 {
-    unsigned long enable = 1;
     unsigned long addr;
-    
+
+    /* Consume the interrupts of jobs started through other descriptors,
+     * so that sh_veu_wait_irq waits for this one */
+    sh_veu_get_backend()->irq_drain(&uio_dev);
+
     addr = 0 ; //uio_mem_.address + info->offsets[frame];
 
     write_reg(&uio_mmio, addr + info->offset.y, VSAYR);
     write_reg(&uio_mmio, addr + info->offset.u, VSACR);
 
     /* Enable interrupt in UIO driver */
-    write(uio_dev.fd, &enable, sizeof(unsigned long));
+    sh_veu_get_backend()->irq_enable(&uio_dev);
 
     write_reg(&uio_mmio, 1, VESTR); /* start operation */
 }
 
 static int sh_veu_init(void)
 {
+    sh_veu_lock();
     write_reg(&uio_mmio, 0x100, VBSRR); /* reset VEU */
+    sh_veu_unlock();
     return 0;
 }
 
+/* Job scheduler. The clients queue their frames and a single thread
+ * programs the VEU for a job, waits for its interrupt and starts the
+ * next one, so the VEU is not left idle while the clients wake up.
+ * Each plugin including this file runs its own scheduler for its own
+ * clients, the arbiter lock orders the schedulers on the VEU */
+
+static pthread_mutex_t sh_veu_sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sh_veu_sched_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sh_veu_done_cond = PTHREAD_COND_INITIALIZER;
+static struct sh_veu_context *sh_veu_queue_head, *sh_veu_queue_tail;
+static pthread_t sh_veu_sched_thread;
+static int sh_veu_sched_running, sh_veu_sched_quit;
+
+static unsigned long long sh_veu_usec_diff(struct timeval *from,
+                                           struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000LL
+        + (to->tv_usec - from->tv_usec);
+}
+
+/* Converts the frame at info.offset of a context, the VEU must be locked */
+static void sh_veu_execute(struct sh_veu_context *ctx)
+{
+    if (ctx->convert)
+        sh_veu_setup_convert(ctx->info.src.w, ctx->info.src.h,
+                             ctx->src_stride, ctx->dst_w, ctx->dst_h,
+                             ctx->dst_stride, ctx->dst_addr,
+                             ctx->dst_format);
+    else
+        sh_veu_setup_planes(&ctx->info, &ctx->src, &ctx->dst);
+
+    sh_veu_blit(&ctx->info, 0);
+    sh_veu_wait_irq(&ctx->info);
+}
+
+static void *sh_veu_sched_loop(void *arg)
+{
+    struct sh_veu_context *ctx;
+    struct timeval now;
+    unsigned long long latency;
+
+    pthread_mutex_lock(&sh_veu_sched_mutex);
+    for (;;) {
+        while (!sh_veu_queue_head && !sh_veu_sched_quit)
+            pthread_cond_wait(&sh_veu_sched_cond, &sh_veu_sched_mutex);
+        if (!sh_veu_queue_head)
+            break;
+
+        ctx = sh_veu_queue_head;
+        sh_veu_queue_head = ctx->next;
+        if (!sh_veu_queue_head)
+            sh_veu_queue_tail = NULL;
+        gettimeofday(&ctx->started, NULL);
+        pthread_mutex_unlock(&sh_veu_sched_mutex);
+
+        sh_veu_lock();
+        sh_veu_execute(ctx);
+        sh_veu_unlock();
+
+        gettimeofday(&now, NULL);
+        pthread_mutex_lock(&sh_veu_sched_mutex);
+        latency = sh_veu_usec_diff(&ctx->queued, &now);
+        ctx->jobs++;
+        ctx->wait_us += sh_veu_usec_diff(&ctx->queued, &ctx->started);
+        ctx->run_us += sh_veu_usec_diff(&ctx->started, &now);
+        if (latency > ctx->max_latency_us)
+            ctx->max_latency_us = latency;
+        ctx->busy = 0;
+        pthread_cond_broadcast(&sh_veu_done_cond);
+    }
+    pthread_mutex_unlock(&sh_veu_sched_mutex);
+
+    return NULL;
+}
+
+/* Queues the frame at info.offset of a context, the thread is started
+ * with the first job. Returns -1 if the thread can not be started */
+static int sh_veu_submit(struct sh_veu_context *ctx)
+{
+    pthread_mutex_lock(&sh_veu_sched_mutex);
+    if (!sh_veu_sched_running) {
+        sh_veu_sched_quit = 0;
+        if (pthread_create(&sh_veu_sched_thread, NULL,
+                           sh_veu_sched_loop, NULL) != 0) {
+            pthread_mutex_unlock(&sh_veu_sched_mutex);
+            return -1;
+        }
+        sh_veu_sched_running = 1;
+    }
+
+    ctx->busy = 1;
+    ctx->next = NULL;
+    gettimeofday(&ctx->queued, NULL);
+    if (sh_veu_queue_tail)
+        sh_veu_queue_tail->next = ctx;
+    else
+        sh_veu_queue_head = ctx;
+    sh_veu_queue_tail = ctx;
+
+    pthread_cond_signal(&sh_veu_sched_cond);
+    pthread_mutex_unlock(&sh_veu_sched_mutex);
+    return 0;
+}
+
+/* Waits for the end of the job of a context, if it has one. The
+ * context and the memory of its frame can be changed after that */
+static void sh_veu_wait(struct sh_veu_context *ctx)
+{
+    pthread_mutex_lock(&sh_veu_sched_mutex);
+    while (ctx->busy)
+        pthread_cond_wait(&sh_veu_done_cond, &sh_veu_sched_mutex);
+    pthread_mutex_unlock(&sh_veu_sched_mutex);
+}
+
+/* Starts converting the frame at info.offset of a context and returns
+ * while the VEU works. The previous job must have ended, see
+ * sh_veu_wait. Converts at once if the scheduler can not be started */
+static void sh_veu_start(struct sh_veu_context *ctx)
+{
+    if (sh_veu_submit(ctx) == 0)
+        return;
+
+    sh_veu_lock();
+    sh_veu_execute(ctx);
+    sh_veu_unlock();
+}
+
+/* Converts the frame at info.offset of a context and waits for the end */
+static void sh_veu_run(struct sh_veu_context *ctx)
+{
+    sh_veu_start(ctx);
+    sh_veu_wait(ctx);
+}
+
+/* Reads the latency accounting of a context, in microseconds */
+static void sh_veu_get_latency(struct sh_veu_context *ctx,
+                               unsigned long *jobs,
+                               unsigned long long *avg_wait_us,
+                               unsigned long long *avg_latency_us,
+                               unsigned long long *max_latency_us)
+{
+    pthread_mutex_lock(&sh_veu_sched_mutex);
+    *jobs = ctx->jobs;
+    *avg_wait_us = ctx->jobs ? ctx->wait_us / ctx->jobs : 0;
+    *avg_latency_us =
+        ctx->jobs ? (ctx->wait_us + ctx->run_us) / ctx->jobs : 0;
+    *max_latency_us = ctx->max_latency_us;
+    pthread_mutex_unlock(&sh_veu_sched_mutex);
+}
+
+static void sh_veu_sched_stop(void)
+{
+    pthread_mutex_lock(&sh_veu_sched_mutex);
+    if (!sh_veu_sched_running) {
+        pthread_mutex_unlock(&sh_veu_sched_mutex);
+        return;
+    }
+    sh_veu_sched_quit = 1;
+    pthread_cond_signal(&sh_veu_sched_cond);
+    pthread_mutex_unlock(&sh_veu_sched_mutex);
+
+    pthread_join(sh_veu_sched_thread, NULL);
+    sh_veu_sched_running = 0;
+}
+
+/* The last user stops the scheduler and unmaps the devices */
 static void sh_veu_destroy(void)
 {
+    pthread_mutex_lock(&sh_veu_probe_mutex);
+    if (sh_veu_users > 0 && --sh_veu_users == 0) {
+        sh_veu_sched_stop();
+        sh_veu_unmap();
+    }
+    pthread_mutex_unlock(&sh_veu_probe_mutex);
 }
 
 static int sh_veu_get_caps(vidix_capability_t *to)
@@ -530,7 +1330,8 @@ static int sh_veu_query_fourcc(vidix_fourcc_t *to)
 }
 
 
-static int sh_veu_config_playback(vidix_playback_t *info)
+static int sh_veu_config_context(struct sh_veu_context *ctx,
+                                 vidix_playback_t *info)
 {
     unsigned int i, y_pitch;
 
@@ -565,24 +1366,31 @@ static int sh_veu_config_playback(vidix_playback_t *info)
     for (i = 0; i < info->num_frames; i++)
         info->offsets[i] = info->frame_size * i;
 
-    my_info = *info;
+    ctx->info = *info;
 
     fprintf(stderr,"sh_veu: %d frames * %d bytes, total size = %d\n",
            (int)info->num_frames, (int)info->frame_size,
            (int)uio_mem_.size);
 
-    sh_veu_setup_planes(info, &_src, &_dst);
+    sh_veu_lock();
+    sh_veu_setup_planes(info, &ctx->src, &ctx->dst);
+    sh_veu_unlock();
 
     fprintf(stderr,"sh_veu: %dx%d->%dx%d@%dx%d -> %dx%d->%dx%d@%dx%d \n",
            (int)info->src.w, (int)info->src.h,
            (int)info->dest.w, (int)info->dest.h,
            (int)info->dest.x, (int)info->dest.y,
-           (int)_src.width, (int)_src.height,
-           (int)_dst.width, (int)_dst.height,
-           (int)_dst.pos_x, (int)_dst.pos_y);
+           (int)ctx->src.width, (int)ctx->src.height,
+           (int)ctx->dst.width, (int)ctx->dst.height,
+           (int)ctx->dst.pos_x, (int)ctx->dst.pos_y);
     return 0;
 }
 
+static int sh_veu_config_playback(vidix_playback_t *info)
+{
+    return sh_veu_config_context(&sh_veu_default_ctx, info);
+}
+
 
 static int sh_veu_playback_on(void)
 {
@@ -594,15 +1402,17 @@ static int sh_veu_playback_off(void)
     return 0;
 }
 
-static int sh_veu_first_frame = 1;
-
 static int sh_veu_frame_sel(unsigned int frame)
 {
-    if (!sh_veu_first_frame)
-        sh_veu_wait_irq(&my_info);
+    struct sh_veu_context *ctx = &sh_veu_default_ctx;
+
+    /* the previous frame is converted while the caller prepares this */
+    sh_veu_wait(ctx);
 
-    sh_veu_blit(&my_info, frame);
-    sh_veu_first_frame = 0;
+    ctx->info.offset.y = uio_mem_.address + ctx->info.offsets[frame];
+    ctx->info.offset.u = ctx->info.offset.y +
+        ((ctx->info.src.w + 15) & ~15) * ctx->info.src.h;
+    sh_veu_start(ctx);
     return 0;
 }
 